@@ -0,0 +1,216 @@
+/*
+ * Copyright 2017 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Measure the cost of reading a high-rate event device.
+ *
+ * A uinput device sends frames of ABS_X, ABS_Y and SYN_REPORT as fast as
+ * possible while the main thread reads them back with one of the reading
+ * strategies, then the read syscalls and reader CPU time per event are
+ * printed.
+ *
+ * Usage: input-scripts-bench-evdev [libevdev|raw] [frame_count]
+ *  - libevdev: libevdev_next_event grouped in frames (EventDevice),
+ *  - raw: read() into a 64 events buffer without libevdev state.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+
+extern "C" {
+#include <libevdev/libevdev.h>
+#include <libevdev/libevdev-uinput.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/select.h>
+}
+
+enum class Mode
+{
+	Libevdev,
+	Raw,
+};
+
+struct Stats
+{
+	unsigned long events = 0;
+	unsigned long frames = 0;
+	unsigned long dropped = 0;
+};
+
+// Read syscalls of the whole process (the writer thread only writes)
+static unsigned long readSyscalls ()
+{
+	std::ifstream io ("/proc/self/io");
+	std::string key;
+	unsigned long value;
+	while (io >> key >> value)
+		if (key == "syscr:")
+			return value;
+	return 0;
+}
+
+static double threadCPUTime ()
+{
+	struct timespec ts;
+	clock_gettime (CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Wait until fd is readable, returns false after one idle second
+static bool waitReadable (int fd)
+{
+	fd_set set;
+	FD_ZERO (&set);
+	FD_SET (fd, &set);
+	struct timeval timeout = { 1, 0 };
+	return select (fd+1, &set, nullptr, nullptr, &timeout) > 0;
+}
+
+static void countEvent (Stats &stats, std::vector<int32_t> &frame, const struct input_event &ev)
+{
+	++stats.events;
+	if (ev.type == EV_SYN && ev.code == SYN_REPORT) {
+		++stats.frames;
+		frame.clear ();
+	}
+	else
+		frame.insert (frame.end (), { ev.type, ev.code, ev.value });
+}
+
+static void readLibevdev (struct libevdev *dev, int fd, unsigned long frame_count, Stats &stats)
+{
+	std::vector<int32_t> frame;
+	struct input_event ev;
+	while (stats.frames < frame_count && waitReadable (fd)) {
+		int ret;
+		do {
+			ret = libevdev_next_event (dev, LIBEVDEV_READ_FLAG_NORMAL, &ev);
+			if (ret == LIBEVDEV_READ_STATUS_SUCCESS)
+				countEvent (stats, frame, ev);
+			else if (ret == LIBEVDEV_READ_STATUS_SYNC) {
+				++stats.dropped;
+				frame.clear ();
+				while (LIBEVDEV_READ_STATUS_SYNC == libevdev_next_event (dev, LIBEVDEV_READ_FLAG_SYNC, &ev))
+					countEvent (stats, frame, ev);
+			}
+		} while (ret >= 0);
+	}
+}
+
+static void readRaw (int fd, unsigned long frame_count, Stats &stats)
+{
+	std::vector<int32_t> frame;
+	struct input_event buffer[64];
+	while (stats.frames < frame_count && waitReadable (fd)) {
+		ssize_t ret;
+		while ((ret = read (fd, buffer, sizeof (buffer))) > 0) {
+			for (std::size_t i = 0; i < ret / sizeof (struct input_event); ++i) {
+				if (buffer[i].type == EV_SYN && buffer[i].code == SYN_DROPPED)
+					++stats.dropped;
+				else
+					countEvent (stats, frame, buffer[i]);
+			}
+		}
+	}
+}
+
+int main (int argc, char *argv[])
+{
+	Mode mode = Mode::Libevdev;
+	unsigned long frame_count = 100000;
+	if (argc > 1) {
+		std::string name = argv[1];
+		if (name == "libevdev")
+			mode = Mode::Libevdev;
+		else if (name == "raw")
+			mode = Mode::Raw;
+		else {
+			std::cerr << "Unknown mode: " << name << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+	if (argc > 2)
+		frame_count = std::strtoul (argv[2], nullptr, 0);
+
+	// Virtual device
+	struct libevdev *template_dev = libevdev_new ();
+	libevdev_set_name (template_dev, "input-scripts benchmark device");
+	struct input_absinfo absinfo = { 0, -32768, 32767, 0, 0, 0 };
+	libevdev_enable_event_code (template_dev, EV_ABS, ABS_X, &absinfo);
+	libevdev_enable_event_code (template_dev, EV_ABS, ABS_Y, &absinfo);
+	struct libevdev_uinput *uidev;
+	int ret = libevdev_uinput_create_from_device (template_dev, LIBEVDEV_UINPUT_OPEN_MANAGED, &uidev);
+	if (ret < 0) {
+		std::cerr << "Cannot create uinput device: " << strerror (-ret) << std::endl;
+		return EXIT_FAILURE;
+	}
+	// Let udev set up the node
+	std::this_thread::sleep_for (std::chrono::milliseconds (500));
+	int fd = open (libevdev_uinput_get_devnode (uidev), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (fd == -1) {
+		std::cerr << "Cannot open " << libevdev_uinput_get_devnode (uidev) << ": " << strerror (errno) << std::endl;
+		return EXIT_FAILURE;
+	}
+	struct libevdev *dev;
+	if ((ret = libevdev_new_from_fd (fd, &dev)) < 0) {
+		std::cerr << "libevdev_new_from_fd: " << strerror (-ret) << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::thread writer ([uidev, frame_count] () {
+		for (unsigned long i = 0; i < frame_count; ++i) {
+			int32_t value = i % 65536 - 32768;
+			libevdev_uinput_write_event (uidev, EV_ABS, ABS_X, value);
+			libevdev_uinput_write_event (uidev, EV_ABS, ABS_Y, -value-1);
+			libevdev_uinput_write_event (uidev, EV_SYN, SYN_REPORT, 0);
+		}
+	});
+
+	Stats stats;
+	unsigned long syscalls = readSyscalls ();
+	double cpu_time = threadCPUTime ();
+	if (mode == Mode::Raw)
+		readRaw (fd, frame_count, stats);
+	else
+		readLibevdev (dev, fd, frame_count, stats);
+	cpu_time = threadCPUTime () - cpu_time;
+	syscalls = readSyscalls () - syscalls;
+	writer.join ();
+
+	std::cout << "events: " << stats.events
+		  << ", frames: " << stats.frames
+		  << ", SYN_DROPPED: " << stats.dropped << std::endl;
+	if (stats.events > 0)
+		std::cout << "read syscalls per event: " << double (syscalls) / stats.events
+			  << ", reader CPU time per event: " << cpu_time * 1e9 / stats.events << " ns" << std::endl;
+
+	libevdev_free (dev);
+	close (fd);
+	libevdev_uinput_destroy (uidev);
+	libevdev_free (template_dev);
+	return EXIT_SUCCESS;
+}
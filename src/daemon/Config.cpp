@@ -22,17 +22,174 @@
 #include <json/json.h>
 #include <json/reader.h>
 #include "Log.h"
+#include "Profile.h"
 
 extern "C" {
 #include <unistd.h>
 #include <sys/stat.h>
+#include <fnmatch.h>
+#include <sched.h>
+#include <libevdev/libevdev.h>
 }
 
 Config::Config ()
 {
 }
 
-Config Config::config;
+std::shared_ptr<const Config> Config::_current = std::make_shared<Config> ();
+
+std::shared_ptr<const Config> Config::get ()
+{
+	return std::atomic_load (&_current);
+}
+
+bool Config::load (const std::string &filename)
+{
+	auto config = std::make_shared<Config> ();
+	if (!config->loadConfig (filename))
+		return false;
+	config->buildIndex ();
+	std::atomic_store (&_current, std::shared_ptr<const Config> (config));
+	return true;
+}
+
+Config::Pattern::Pattern (const std::map<std::string, std::string> &rules, const char *key)
+{
+	auto it = rules.find (key);
+	any = it == rules.end ();
+	glob = false;
+	if (!any) {
+		static constexpr char GlobPrefix[] = "glob:";
+		static constexpr std::size_t GlobPrefixLength = sizeof (GlobPrefix) - 1;
+		// Wildcards are opt-in, names may contain '*', '?' or '['
+		glob = it->second.compare (0, GlobPrefixLength, GlobPrefix) == 0;
+		value = glob ? it->second.substr (GlobPrefixLength) : it->second;
+	}
+}
+
+bool Config::Pattern::matches (const std::string &str) const
+{
+	if (any)
+		return true;
+	if (glob)
+		return fnmatch (value.c_str (), str.c_str (), 0) == 0;
+	return value == str;
+}
+
+void Config::buildIndex ()
+{
+	_compiled_rules.clear ();
+	_driver_rules.clear ();
+	_fallback_rules.clear ();
+	for (std::size_t i = 0; i < default_scripts.size (); ++i) {
+		const auto &rules = default_scripts[i].rules;
+		_compiled_rules.push_back ({
+			Pattern (rules, "driver"),
+			Pattern (rules, "name"),
+			Pattern (rules, "serial")
+		});
+		const Pattern &driver = _compiled_rules.back ().driver;
+		if (driver.any || driver.glob)
+			_fallback_rules.push_back (i);
+		else
+			_driver_rules[driver.value].push_back (i);
+	}
+}
+
+const Config::ScriptRule *Config::findDefaultScript (const std::string &driver, const std::string &name, const std::string &serial) const
+{
+	static const std::vector<std::size_t> no_rules;
+	auto bucket = _driver_rules.find (driver);
+	const auto &driver_rules = bucket == _driver_rules.end () ? no_rules : bucket->second;
+	// Merge both sorted lists so that the first matching rule in
+	// configuration order is used
+	auto d = driver_rules.begin ();
+	auto f = _fallback_rules.begin ();
+	while (d != driver_rules.end () || f != _fallback_rules.end ()) {
+		std::size_t i;
+		if (f == _fallback_rules.end () || (d != driver_rules.end () && *d < *f))
+			i = *d++;
+		else
+			i = *f++;
+		const CompiledRule &rule = _compiled_rules[i];
+		if (rule.driver.matches (driver) &&
+		    rule.name.matches (name) &&
+		    rule.serial.matches (serial))
+			return &default_scripts[i];
+	}
+	return nullptr;
+}
+
+bool Config::parseThreadPolicy (const Json::Value &value, const std::string &where, ThreadPolicy &result)
+{
+	if (!value.isObject ()) {
+		Log::error () << where << " must be an object." << std::endl;
+		return false;
+	}
+	// result is only modified when the whole policy is valid
+	ThreadPolicy policy;
+	bool has_priority = false;
+	for (const auto &key: value.getMemberNames ()) {
+		Json::Value setting = value[key];
+		if (key == "cpus") {
+			if (!setting.isArray ()) {
+				Log::error () << where << ".cpus must be an array." << std::endl;
+				return false;
+			}
+			policy.cpus.clear ();
+			for (unsigned int i = 0; i < setting.size (); ++i) {
+				if (!setting[i].isUInt ()) {
+					Log::error () << where << ".cpus[" << i << "] must be an unsigned integer." << std::endl;
+					return false;
+				}
+				policy.cpus.push_back (setting[i].asUInt ());
+			}
+		}
+		else if (key == "scheduler") {
+			try {
+				policy.scheduler = ThreadPolicy::parseScheduler (setting.asString ());
+			}
+			catch (std::exception &e) {
+				Log::error () << where << ".scheduler: " << e.what () << std::endl;
+				return false;
+			}
+		}
+		else if (key == "priority") {
+			if (!setting.isInt ()) {
+				Log::error () << where << ".priority must be an integer." << std::endl;
+				return false;
+			}
+			has_priority = true;
+			policy.priority = setting.asInt ();
+		}
+		else if (key == "nice") {
+			if (!setting.isInt ()) {
+				Log::error () << where << ".nice must be an integer." << std::endl;
+				return false;
+			}
+			policy.has_nice = true;
+			policy.nice = setting.asInt ();
+		}
+		else
+			Log::warning () << "Unknown setting: " << where << "." << key << std::endl;
+	}
+	if (policy.scheduler == ThreadPolicy::FIFO || policy.scheduler == ThreadPolicy::RR) {
+		int policy_id = policy.scheduler == ThreadPolicy::FIFO ? SCHED_FIFO : SCHED_RR;
+		int min = sched_get_priority_min (policy_id);
+		int max = sched_get_priority_max (policy_id);
+		if (!has_priority)
+			policy.priority = min;
+		else if (policy.priority < min || policy.priority > max) {
+			Log::error () << where << ".priority must be between "
+				      << min << " and " << max << " for real-time schedulers." << std::endl;
+			return false;
+		}
+	}
+	else if (has_priority)
+		Log::warning () << where << ".priority is only used by real-time schedulers." << std::endl;
+	result = std::move (policy);
+	return true;
+}
 
 bool Config::loadConfig (const std::string &filename)
 {
@@ -68,19 +225,111 @@ bool Config::loadConfig (const std::string &filename)
 			for (unsigned int i = 0; i < value.size (); ++i) {
 				Json::Value script = value[i];
 				default_scripts.emplace_back ();
-				if (!script.isMember ("file")) {
-					Log::error () << "default_scripts[" << i << "] need a \"file\" property." << std::endl;
+				if (!script.isMember ("file") && !script.isMember ("profile")) {
+					Log::error () << "default_scripts[" << i << "] need a \"file\" or \"profile\" property." << std::endl;
 					default_scripts.pop_back ();
 					continue;
 				}
 				auto &last = default_scripts.back ();
-				last.script_file = script["file"].asString ();
-				Log::debug () << "Added rule for file: " << last.script_file << std::endl;
+				if (script.isMember ("profile")) {
+					last.profile = Profile::parse (script["profile"], "default_scripts[" + std::to_string (i) + "].profile");
+					if (!last.profile) {
+						default_scripts.pop_back ();
+						continue;
+					}
+					LOG (Debug) << "Added rule for a profile" << std::endl;
+					if (script.isMember ("file"))
+						Log::warning () << "default_scripts[" << i << "].file is ignored when a profile is used." << std::endl;
+				}
+				else {
+					last.script_file = script["file"].asString ();
+					LOG (Debug) << "Added rule for file: " << last.script_file << std::endl;
+				}
+				if (script.isMember ("group") && last.profile) {
+					Log::error () << "default_scripts[" << i << "].group cannot be used with a profile." << std::endl;
+				}
+				else if (script.isMember ("group")) {
+					last.group = script["group"].asString ();
+					LOG (Debug) << "group = " << last.group << std::endl;
+				}
 				for (auto &rule: { "driver", "name", "serial" })
 					if (script.isMember (rule)) {
-						Log::debug () << rule << " = " << script[rule].asString () << std::endl;
+						LOG (Debug) << rule << " = " << script[rule].asString () << std::endl;
 						last.rules.emplace (rule, script[rule].asString ());
 					}
+				for (auto &setting: std::initializer_list<std::pair<const char *, unsigned int ScriptRule::*>> {
+						{ "heap_size", &ScriptRule::heap_size },
+						{ "nursery_size", &ScriptRule::nursery_size },
+						{ "idle_gc_delay", &ScriptRule::idle_gc_delay },
+						{ "gc_slice_budget", &ScriptRule::gc_slice_budget },
+						{ "task_budget", &ScriptRule::task_budget },
+						{ "max_queued_events", &ScriptRule::max_queued_events },
+						{ "coalesce_threshold", &ScriptRule::coalesce_threshold } })
+					if (script.isMember (setting.first)) {
+						if (!script[setting.first].isUInt ()) {
+							Log::error () << "default_scripts[" << i << "]." << setting.first << " must be an unsigned integer." << std::endl;
+							continue;
+						}
+						last.*setting.second = script[setting.first].asUInt ();
+						LOG (Debug) << setting.first << " = " << last.*setting.second << std::endl;
+					}
+				if (script.isMember ("recycle_events")) {
+					if (!script["recycle_events"].isBool ())
+						Log::error () << "default_scripts[" << i << "].recycle_events must be a boolean." << std::endl;
+					else
+						last.recycle_events = script["recycle_events"].asBool ();
+				}
+				if (script.isMember ("overload_policy")) {
+					std::string policy = script["overload_policy"].asString ();
+					if (policy == "block")
+						last.overload_policy = QueueOverflow::Block;
+					else if (policy == "drop_oldest")
+						last.overload_policy = QueueOverflow::DropOldest;
+					else if (policy == "coalesce")
+						last.overload_policy = QueueOverflow::Coalesce;
+					else
+						Log::error () << "default_scripts[" << i << "].overload_policy must be \"block\", \"drop_oldest\" or \"coalesce\"." << std::endl;
+				}
+				if (script.isMember ("coalesce_types")) {
+					Json::Value types = script["coalesce_types"];
+					if (!types.isArray ()) {
+						Log::error () << "default_scripts[" << i << "].coalesce_types must be an array." << std::endl;
+						continue;
+					}
+					last.coalesced_types.clear ();
+					last.coalesce_sensors = false;
+					for (unsigned int j = 0; j < types.size (); ++j) {
+						Json::Value type_value = types[j];
+						if (type_value.isString () && type_value.asString () == "sensor") {
+							last.coalesce_sensors = true;
+							continue;
+						}
+						int type = -1;
+						if (type_value.isUInt ())
+							type = type_value.asUInt ();
+						else if (type_value.isString ())
+							type = libevdev_event_type_from_name (type_value.asCString ());
+						if (type < 0 || type > UINT16_MAX) {
+							Log::error () << "default_scripts[" << i << "].coalesce_types[" << j << "] is not a valid event type." << std::endl;
+							continue;
+						}
+						last.coalesced_types.insert (type);
+					}
+				}
+				if (script.isMember ("threads")) {
+					Json::Value threads = script["threads"];
+					std::string where = "default_scripts[" + std::to_string (i) + "].threads";
+					if (!threads.isObject ()) {
+						Log::error () << where << " must be an object." << std::endl;
+						continue;
+					}
+					for (auto &thread: std::initializer_list<std::pair<const char *, ThreadPolicy ScriptRule::*>> {
+							{ "reader", &ScriptRule::reader_thread },
+							{ "script", &ScriptRule::script_thread } })
+						if (threads.isMember (thread.first) &&
+						    !parseThreadPolicy (threads[thread.first], where + "." + thread.first, last.*thread.second))
+							Log::error () << where << "." << thread.first << " is ignored." << std::endl;
+				}
 			}
 		}
 		else {
@@ -21,26 +21,105 @@
 
 #include <string>
 #include <map>
+#include <memory>
+#include <unordered_map>
 #include <vector>
+#include <set>
+#include "ThreadPolicy.h"
+#include "MTQueue.h"
+
+extern "C" {
+#include <linux/input.h>
+}
+
+namespace Json { class Value; }
+class Profile;
 
 class Config
 {
 public:
+	Config ();
+
 	bool loadConfig (const std::string &filename);
 
 	struct ScriptRule
 	{
 		std::map<std::string, std::string> rules;
 		std::string script_file;
+		// Native profile used instead of a script when not null
+		std::shared_ptr<const Profile> profile;
+		// Matching devices share a single script when not empty
+		std::string group;
+		// JS runtime settings (0 means default)
+		unsigned int heap_size = 0; // in bytes
+		unsigned int nursery_size = 0; // in bytes
+		unsigned int idle_gc_delay = 0; // in milliseconds
+		unsigned int gc_slice_budget = 0; // in milliseconds
+		bool recycle_events = false;
+		unsigned int task_budget = 0; // in milliseconds
+		unsigned int max_queued_events = 0;
+		QueueOverflow overload_policy = QueueOverflow::Block;
+		unsigned int coalesce_threshold = 0;
+		std::set<uint16_t> coalesced_types = { EV_ABS };
+		bool coalesce_sensors = true;
+		// Scheduling settings for the device reader and JS threads
+		ThreadPolicy reader_thread;
+		ThreadPolicy script_thread;
 	};
 	std::vector<ScriptRule> default_scripts;
 
-	static Config config;
+	/**
+	 * Find the first rule from default_scripts matching the device.
+	 *
+	 * Rule values containing *, ? or [ are shell wildcard patterns.
+	 *
+	 * \returns nullptr if no rule matches.
+	 */
+	const ScriptRule *findDefaultScript (const std::string &driver, const std::string &name, const std::string &serial) const;
+
+	/**
+	 * Current configuration.
+	 *
+	 * Keep the returned pointer while using the rules, the
+	 * configuration may be replaced by load() at any time.
+	 */
+	static std::shared_ptr<const Config> get ();
+	/**
+	 * Load \p filename and atomically make it the current configuration.
+	 *
+	 * The current configuration is kept if loading fails.
+	 */
+	static bool load (const std::string &filename);
 	static std::string getConfigFilePath (const std::string &file);
 
 private:
-	Config ();
+	void buildIndex ();
+	/**
+	 * Parse a thread policy into \p result, which is left unchanged when
+	 * any setting is invalid.
+	 */
+	static bool parseThreadPolicy (const Json::Value &value, const std::string &where, ThreadPolicy &result);
+
+	struct Pattern
+	{
+		std::string value;
+		bool any; // missing rule, matches anything
+		bool glob; // value had the "glob:" prefix, it is a shell wildcard pattern
+
+		Pattern (const std::map<std::string, std::string> &rules, const char *key);
+		bool matches (const std::string &str) const;
+	};
+	struct CompiledRule
+	{
+		Pattern driver, name, serial;
+	};
+	std::vector<CompiledRule> _compiled_rules;
+	// Indices of rules with an exact driver, by driver name
+	std::unordered_map<std::string, std::vector<std::size_t>> _driver_rules;
+	// Indices of rules with any driver or a driver pattern
+	std::vector<std::size_t> _fallback_rules;
 
+	static std::shared_ptr<const Config> _current;
 	static const std::string _user_config_path;
 };
 
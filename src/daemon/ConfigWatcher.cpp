@@ -0,0 +1,132 @@
+/*
+ * Copyright 2017 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ConfigWatcher.h"
+
+#include "Config.h"
+#include "Log.h"
+
+#include <algorithm>
+#include <cstring>
+#include <system_error>
+
+extern "C" {
+#include <sys/inotify.h>
+#include <sys/select.h>
+#include <unistd.h>
+#include <fcntl.h>
+}
+
+ConfigWatcher::ConfigWatcher (const std::string &config_file_path):
+	_path (config_file_path),
+	_state (Stopped)
+{
+	auto slash = config_file_path.rfind ('/');
+	if (slash == std::string::npos) {
+		_directory = ".";
+		_filename = config_file_path;
+	}
+	else {
+		_directory = config_file_path.substr (0, slash+1);
+		_filename = config_file_path.substr (slash+1);
+	}
+	if (-1 == pipe2 (_pipe, O_CLOEXEC))
+		throw std::system_error (errno, std::system_category (), "pipe2");
+}
+
+ConfigWatcher::~ConfigWatcher ()
+{
+	close (_pipe[0]);
+	close (_pipe[1]);
+}
+
+void ConfigWatcher::interrupt ()
+{
+	char c = 0;
+	// Interrupting before exec started makes it return immediately
+	if (_state.exchange (Stopping) == Stopped)
+		return;
+	write (_pipe[1], &c, sizeof (char));
+}
+
+void ConfigWatcher::exec ()
+{
+	State expected = Stopped;
+	if (!_state.compare_exchange_strong (expected, Running)) {
+		_state = Stopped;
+		return;
+	}
+
+	int fd = inotify_init1 (IN_CLOEXEC);
+	if (fd == -1) {
+		Log::error () << "Cannot watch config file, inotify_init1: " << strerror (errno) << std::endl;
+		_state = Stopped;
+		return;
+	}
+	if (-1 == inotify_add_watch (fd, _directory.c_str (), IN_CLOSE_WRITE | IN_MOVED_TO)) {
+		Log::error () << "Cannot watch " << _directory << ": " << strerror (errno) << std::endl;
+		close (fd);
+		_state = Stopped;
+		return;
+	}
+	LOG (Debug) << "Watching config file " << _path << std::endl;
+
+	alignas (struct inotify_event) char buffer[4096];
+	while (_state == Running) {
+		int nfds = std::max (fd, _pipe[0]) + 1;
+		fd_set fds;
+		FD_ZERO (&fds);
+		FD_SET (fd, &fds);
+		FD_SET (_pipe[0], &fds);
+		if (-1 == select (nfds, &fds, nullptr, nullptr, nullptr)) {
+			if (errno == EINTR)
+				continue;
+			Log::error () << "Stop watching config file, select: " << strerror (errno) << std::endl;
+			break;
+		}
+		if (FD_ISSET (fd, &fds)) {
+			ssize_t len = read (fd, buffer, sizeof (buffer));
+			if (len == -1) {
+				if (errno == EINTR)
+					continue;
+				Log::error () << "Stop watching config file, read: " << strerror (errno) << std::endl;
+				break;
+			}
+			// Several events may be read at once, reload only once
+			bool changed = false;
+			for (char *ptr = buffer; ptr < buffer + len; ) {
+				auto event = reinterpret_cast<const struct inotify_event *> (ptr);
+				if (event->len > 0 && _filename == event->name)
+					changed = true;
+				ptr += sizeof (struct inotify_event) + event->len;
+			}
+			if (changed) {
+				Log::info () << "Config file changed, reloading" << std::endl;
+				if (!Config::load (_path))
+					Log::error () << "Keeping previous configuration" << std::endl;
+			}
+		}
+		if (FD_ISSET (_pipe[0], &fds)) {
+			char c;
+			read (_pipe[0], &c, sizeof (char));
+		}
+	}
+
+	close (fd);
+	_state = Stopped;
+}
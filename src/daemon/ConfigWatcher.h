@@ -0,0 +1,58 @@
+/*
+ * Copyright 2017 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef CONFIG_WATCHER_H
+#define CONFIG_WATCHER_H
+
+#include <string>
+#include <atomic>
+
+/**
+ * Reload the configuration when its file changes.
+ *
+ * The parent directory is watched with inotify so that files replaced
+ * by renaming (as many editors do) are also detected. Running scripts
+ * keep the configuration they were started with.
+ */
+class ConfigWatcher
+{
+public:
+	ConfigWatcher (const std::string &config_file_path);
+	~ConfigWatcher ();
+
+	void interrupt ();
+	/**
+	 * Watch the config file until interrupted.
+	 *
+	 * Failures are logged and end the watch: the daemon keeps running
+	 * without hot reload.
+	 */
+	void exec ();
+
+private:
+	std::string _directory, _filename, _path;
+	enum State {
+		Running,
+		Stopping,
+		Stopped,
+	};
+	std::atomic<State> _state;
+	int _pipe[2];
+};
+
+#endif
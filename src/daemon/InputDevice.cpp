@@ -18,14 +18,78 @@
 
 #include "InputDevice.h"
 
+#include <algorithm>
+#include <stdexcept>
+
 extern "C" {
 #include <linux/input.h>
+#include <time.h>
+}
+
+InputDevice::InputDevice ():
+	_sensor_batch (0),
+	_current_sensor_batch (0),
+	_reader_policy_changed (true),
+	_event_time (0)
+{
 }
 
 InputDevice::~InputDevice ()
 {
 }
 
+void InputDevice::setReaderThreadPolicy (const ThreadPolicy &policy)
+{
+	std::unique_lock<std::mutex> lock (_reader_policy_mutex);
+	_reader_policy = policy;
+	_reader_policy_changed = true;
+}
+
+std::string InputDevice::readerThreadPolicy () const
+{
+	std::unique_lock<std::mutex> lock (_reader_policy_mutex);
+	return _applied_reader_policy;
+}
+
+void InputDevice::initReaderThread (const char *name)
+{
+	_reader_policy_changed = false;
+	std::unique_lock<std::mutex> lock (_reader_policy_mutex);
+	ThreadPolicy policy = _reader_policy;
+	lock.unlock ();
+	std::string applied = policy.apply (name);
+	lock.lock ();
+	_applied_reader_policy = applied;
+}
+
+void InputDevice::updateReaderThread (const char *name)
+{
+	if (_reader_policy_changed.exchange (false))
+		initReaderThread (name);
+}
+
+void InputDevice::setEventTime (double time)
+{
+	_event_time = time;
+}
+
+double InputDevice::eventTime () const
+{
+	return _event_time;
+}
+
+double InputDevice::monotonicTime ()
+{
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+double InputDevice::monotonicTime (const struct timeval &time)
+{
+	return time.tv_sec * 1000.0 + time.tv_usec / 1000.0;
+}
+
 bool InputDevice::keyPressed (uint16_t code)
 {
 	return getEvent ({
@@ -44,17 +108,122 @@ int32_t InputDevice::getAxisValue (uint16_t code)
 
 void InputDevice::eventRead (const Event &e)
 {
-	event.emit (e);
+	event.emit (e, _event_time);
 }
 
 void InputDevice::simpleEventRead (uint16_t type, uint16_t code, int32_t value)
 {
-	simpleEvent.emit (type, code, value);
-	eventRead ({
-		{ "type", type },
-		{ "code", code },
-		{ "value", value },
-	});
+	simpleEvent.emit (type, code, value, _event_time);
+	// Avoid building the map when nothing is connected
+	if (!event.empty ())
+		eventRead ({
+			{ "type", type },
+			{ "code", code },
+			{ "value", value },
+		});
+}
+
+unsigned int InputDevice::complexEventField (uint16_t type, const std::string &name) const
+{
+	auto fields = _complex_fields.find (type);
+	if (fields == _complex_fields.end ())
+		throw std::invalid_argument ("Event type has no declared fields");
+	auto it = std::find (fields->second.begin (), fields->second.end (), name);
+	if (it == fields->second.end ())
+		throw std::invalid_argument ("Unknown event field: " + name);
+	return it - fields->second.begin ();
+}
+
+void InputDevice::declareComplexEvent (uint16_t type, std::initializer_list<const char *> fields)
+{
+	_complex_fields[type].assign (fields.begin (), fields.end ());
+}
+
+void InputDevice::complexEventRead (uint16_t type, int code, std::initializer_list<int32_t> values)
+{
+	if (!complexEvent.empty ()) {
+		_complex_values.assign (values);
+		complexEvent.emit (type, code < 0 ? 0 : code, _complex_values, _event_time);
+	}
+	// Avoid building the map when nothing is connected
+	if (event.empty ())
+		return;
+	const auto &names = _complex_fields.at (type);
+	Event e;
+	e.emplace ("type", type);
+	if (code >= 0)
+		e.emplace ("code", code);
+	auto value = values.begin ();
+	for (unsigned int i = 0; i < names.size () && value != values.end (); ++i, ++value)
+		e.emplace (names[i], *value);
+	eventRead (e);
+}
+
+void InputDevice::setSensorBatch (unsigned int count)
+{
+	_sensor_batch = count;
+}
+
+void InputDevice::sensorRead (uint16_t type, int code, std::initializer_list<std::pair<const char *, int32_t>> axes)
+{
+	if (!complexEvent.empty ()) {
+		_complex_values.clear ();
+		for (const auto &axis: axes)
+			_complex_values.push_back (axis.second);
+		complexEvent.emit (type, code < 0 ? 0 : code, _complex_values, _event_time);
+	}
+	unsigned int batch = _sensor_batch;
+	if (batch != _current_sensor_batch) {
+		// Drop partial batches, their samples are stale
+		_sensor_buffers.clear ();
+		_current_sensor_batch = batch;
+	}
+	if (batch == 0) {
+		Event e;
+		e.emplace ("type", type);
+		if (code >= 0)
+			e.emplace ("code", code);
+		for (const auto &axis: axes)
+			e.emplace (axis.first, axis.second);
+		eventRead (e);
+		return;
+	}
+	auto &buffer = _sensor_buffers[{type, code}];
+	for (const auto &axis: axes)
+		buffer.samples.push_back (axis.second);
+	if (++buffer.count >= batch) {
+		sensorEvent.emit (type, code < 0 ? 0 : code, buffer.samples, _event_time);
+		buffer.samples.clear ();
+		buffer.count = 0;
+	}
+}
+
+std::optional<uint64_t> InputDevice::eventKey (const jstpl::Thread::RuntimeOptions &options, const Event &event, double time)
+{
+	auto type = event.find ("type");
+	auto code = event.find ("code");
+	// Only linux input events have code and value
+	if (type == event.end () || code == event.end () || event.count ("value") == 0)
+		return std::nullopt;
+	return simpleEventKey (options, type->second, code->second, 0, time);
+}
+
+std::optional<uint64_t> InputDevice::simpleEventKey (const jstpl::Thread::RuntimeOptions &options, uint16_t type, uint16_t code, int32_t, double)
+{
+	if (options.coalesced_types.count (type) == 0)
+		return std::nullopt;
+	// Multi-touch values apply to the slot selected by the previous
+	// ABS_MT_SLOT event, they cannot be reordered.
+	if (type == EV_ABS && code >= ABS_MT_SLOT)
+		return std::nullopt;
+	return (type << 16) | code;
+}
+
+std::optional<uint64_t> InputDevice::sensorEventKey (const jstpl::Thread::RuntimeOptions &options, uint16_t type, uint16_t code, const SensorSamples &, double)
+{
+	if (!options.coalesce_sensors)
+		return std::nullopt;
+	return (type << 16) | code;
 }
 
 const JSClass InputDevice::js_class = jstpl::make_class<InputDevice> ("InputDevice");
@@ -64,12 +233,17 @@ const JSFunctionSpec InputDevice::js_fs[] = {
 	jstpl::make_method<&InputDevice::getSimpleEvent> ("getSimpleEvent"),
 	jstpl::make_method<&InputDevice::keyPressed> ("keyPressed"),
 	jstpl::make_method<&InputDevice::getAxisValue> ("getAxisValue"),
+	jstpl::make_method<&InputDevice::setSensorBatch> ("setSensorBatch"),
+	jstpl::make_method<&InputDevice::complexEventField> ("complexEventField"),
 	JS_FS_END
 };
 
 const jstpl::SignalMap InputDevice::js_signals = {
-	{ "event", jstpl::make_signal_connector (&InputDevice::event) },
-	{ "simpleEvent", jstpl::make_signal_connector (&InputDevice::simpleEvent) },
+	{ "event", jstpl::make_keyed_signal_connector (&InputDevice::event, &InputDevice::eventKey) },
+	{ "simpleEvent", jstpl::make_keyed_signal_connector (&InputDevice::simpleEvent, &InputDevice::simpleEventKey) },
+	{ "sensorEvent", jstpl::make_typed_array_signal_connector (&InputDevice::sensorEvent, &InputDevice::sensorEventKey) },
+	{ "frame", jstpl::make_typed_array_signal_connector (&InputDevice::frame) },
+	{ "complexEvent", jstpl::make_typed_array_signal_connector (&InputDevice::complexEvent) },
 };
 
 bool InputDevice::_registered = jstpl::ClassManager::registerClass<InputDevice::JsClass> ();
@@ -21,8 +21,17 @@
 
 #include <cstdint>
 #include <functional>
+#include <atomic>
+#include <initializer_list>
+#include <optional>
+
+extern "C" {
+#include <sys/time.h>
+}
+#include <mutex>
 
 #include "jstpl/jstpl.h"
+#include "ThreadPolicy.h"
 
 /**
  * \defgroup InputDevices Input devices
@@ -47,6 +56,27 @@ public:
 	 */
 	typedef std::map<std::string, int> Event;
 
+	/**
+	 * Sensor samples sent by sensorEvent.
+	 *
+	 * Axis values from consecutive samples are interleaved.
+	 */
+	typedef std::vector<int32_t> SensorSamples;
+
+	/**
+	 * Events sent by frame as type, code and value triplets.
+	 */
+	typedef std::vector<int32_t> EventFrame;
+
+	/**
+	 * Field values of a complex event sent by complexEvent, in the
+	 * order declared by the driver for the event type.
+	 *
+	 * \see complexEventField
+	 */
+	typedef std::vector<int32_t> ComplexEventValues;
+
+	InputDevice ();
 	virtual ~InputDevice ();
 
 	/**
@@ -92,6 +122,14 @@ public:
 	 * \returns the current value of the axis.
 	 */
 	int32_t getAxisValue (uint16_t code);
+	/**
+	 * Get the index of the field \p name in the values sent by
+	 * complexEvent for events with type \p type.
+	 *
+	 * \throws std::invalid_argument if the driver did not declare
+	 * this field.
+	 */
+	unsigned int complexEventField (uint16_t type, const std::string &name) const;
 
 	/**
 	 * Get the name of the driver used by this device.
@@ -108,9 +146,110 @@ public:
 
 	/**
 	 * Signals for input events.
+	 *
+	 * The last parameter of every input signal is the time of the
+	 * event in milliseconds from CLOCK_MONOTONIC.
+	 *
+	 * \see monotonicTime
 	 */
-	sigc::signal<void (Event)> event;
-	sigc::signal<void (uint16_t, uint16_t, int32_t)> simpleEvent;
+	sigc::signal<void (Event, double)> event;
+	sigc::signal<void (uint16_t, uint16_t, int32_t, double)> simpleEvent;
+	/**
+	 * Signal for batched sensor events.
+	 *
+	 * Parameters are the event type, code (0 when the event has no code)
+	 * and the samples. JS callbacks receive the samples as an Int32Array
+	 * that is reused for every call.
+	 *
+	 * \see setSensorBatch
+	 */
+	sigc::signal<void (uint16_t, uint16_t, const SensorSamples &, double)> sensorEvent;
+	/**
+	 * Signal for complete frames of linux input events.
+	 *
+	 * Sent by devices reading linux input events when a SYN_REPORT is
+	 * read. The frame contains type, code and value triplets for every
+	 * event before the SYN_REPORT. JS callbacks receive it as an
+	 * Int32Array that is reused for every call.
+	 */
+	sigc::signal<void (const EventFrame &, double)> frame;
+	/**
+	 * Signal for complex events (events with several named fields).
+	 *
+	 * Parameters are the event type, code (0 when the event has no code)
+	 * and the field values, so that a field can be read from its index
+	 * instead of its name. It is sent for every complex event, even
+	 * when sensor batching is enabled. JS callbacks receive the values
+	 * as an Int32Array that is reused for every call.
+	 *
+	 * \see complexEventField
+	 */
+	sigc::signal<void (uint16_t, uint16_t, const ComplexEventValues &, double)> complexEvent;
+
+	/**
+	 * Set how many samples are batched in a single sensorEvent.
+	 *
+	 * When \p count is 0 (default), sensor data is sent through
+	 * the event signal as other events. Otherwise, sensor data is
+	 * only sent with sensorEvent.
+	 */
+	void setSensorBatch (unsigned int count);
+
+	/**
+	 * Set the scheduling settings for the thread reading events.
+	 *
+	 * The settings are applied by the reader thread when it starts or,
+	 * for threads shared with other devices, before reading the next
+	 * event.
+	 */
+	virtual void setReaderThreadPolicy (const ThreadPolicy &policy);
+	/**
+	 * Description of the settings applied on the reader thread.
+	 *
+	 * Empty if the reader thread has not applied any settings yet.
+	 */
+	virtual std::string readerThreadPolicy () const;
+	/**
+	 * Apply the reader thread settings and name the thread \p name.
+	 *
+	 * Must be called by every new reader thread.
+	 */
+	void initReaderThread (const char *name);
+	/**
+	 * Apply pending reader thread settings and name the thread \p name.
+	 *
+	 * Must be called from the reader thread.
+	 */
+	void updateReaderThread (const char *name);
+
+	/**
+	 * Set the time of the next events sent by this device.
+	 *
+	 * Must be called from the reader thread, drivers without kernel
+	 * timestamps use monotonicTime() when the report is read.
+	 */
+	void setEventTime (double time);
+	/**
+	 * Current CLOCK_MONOTONIC time in milliseconds.
+	 */
+	static double monotonicTime ();
+	/**
+	 * Convert a timestamp from CLOCK_MONOTONIC to milliseconds.
+	 */
+	static double monotonicTime (const struct timeval &time);
+
+	/**
+	 * Coalescing keys for queued event callbacks.
+	 *
+	 * Events whose type is in the coalesced types of the runtime options
+	 * are keyed by type and code, so only the latest value is kept
+	 * for each axis. Other events (keys, SYN, ...) are never coalesced.
+	 *
+	 * \see jstpl::make_keyed_signal_connector
+	 */
+	static std::optional<uint64_t> eventKey (const jstpl::Thread::RuntimeOptions &options, const Event &event, double time);
+	static std::optional<uint64_t> simpleEventKey (const jstpl::Thread::RuntimeOptions &options, uint16_t type, uint16_t code, int32_t value, double time);
+	static std::optional<uint64_t> sensorEventKey (const jstpl::Thread::RuntimeOptions &options, uint16_t type, uint16_t code, const SensorSamples &samples, double time);
 
 	static const JSClass js_class;
 	static const JSFunctionSpec js_fs[];
@@ -124,12 +263,67 @@ public:
 	 * \param obj Global object where the class is created.
 	 */
 	virtual JSObject *makeJsObject (const jstpl::Thread *) = 0;
+	/**
+	 * Detach the JS object of this device before it is destroyed.
+	 *
+	 * \see jstpl::Thread::releaseJsObject
+	 */
+	virtual void releaseJsObject (jstpl::Thread *) = 0;
 
 protected:
 	void eventRead (const Event &);
 	void simpleEventRead (uint16_t type, uint16_t code, int32_t value);
+	/**
+	 * Send sensor data.
+	 *
+	 * \param type Event type.
+	 * \param code Event code or -1 if the event has no code.
+	 * \param axes Axis names and values (the names are used when
+	 *             sending data through the event signal).
+	 */
+	void sensorRead (uint16_t type, int code, std::initializer_list<std::pair<const char *, int32_t>> axes);
+	/**
+	 * Declare the fields of complex events with type \p type.
+	 *
+	 * Must be called before starting the device. Values sent by
+	 * complexEventRead and sensorRead must be in the same order.
+	 */
+	void declareComplexEvent (uint16_t type, std::initializer_list<const char *> fields);
+	/**
+	 * Send a complex event.
+	 *
+	 * \param type Event type, its fields must have been declared.
+	 * \param code Event code or -1 if the event has no code.
+	 * \param values Field values in the declared order.
+	 */
+	void complexEventRead (uint16_t type, int code, std::initializer_list<int32_t> values);
+	/**
+	 * Time of the events being sent.
+	 *
+	 * \see setEventTime
+	 */
+	double eventTime () const;
 
 private:
+	struct SensorBuffer
+	{
+		SensorSamples samples;
+		unsigned int count;
+	};
+	std::atomic<unsigned int> _sensor_batch;
+	unsigned int _current_sensor_batch; // reader thread only
+	std::map<std::pair<uint16_t, int>, SensorBuffer> _sensor_buffers;
+
+	std::map<uint16_t, std::vector<std::string>> _complex_fields;
+	ComplexEventValues _complex_values;
+
+	mutable std::mutex _reader_policy_mutex;
+	ThreadPolicy _reader_policy;
+	std::string _applied_reader_policy;
+	std::atomic<bool> _reader_policy_changed;
+
+	double _event_time;
+
 	static bool _registered;
 };
 
@@ -0,0 +1,209 @@
+/*
+ * Copyright 2017 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "InputGroup.h"
+
+#include "Log.h"
+
+InputGroup::InputGroup (const std::string &name):
+	_name (name),
+	_thread (nullptr),
+	_next_id (0),
+	_started (false)
+{
+}
+
+InputGroup::~InputGroup ()
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	for (auto &pair: _members)
+		for (auto &c: pair.second.connections)
+			c.disconnect ();
+}
+
+const std::string &InputGroup::name () const
+{
+	return _name;
+}
+
+void InputGroup::setThread (jstpl::Thread *thread)
+{
+	_thread = thread;
+}
+
+unsigned int InputGroup::addDevice (InputDevice *device)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	unsigned int id = _next_id++;
+	Member &member = _members[id];
+	member.device = device;
+	member.connections.push_back (device->event.connect ([this, id] (InputDevice::Event e, double time) {
+		std::unique_lock<std::mutex> lock (_signal_mutex);
+		event.emit (id, e, time);
+	}));
+	member.connections.push_back (device->simpleEvent.connect ([this, id] (uint16_t type, uint16_t code, int32_t value, double time) {
+		std::unique_lock<std::mutex> lock (_signal_mutex);
+		simpleEvent.emit (id, type, code, value, time);
+	}));
+	member.connections.push_back (device->sensorEvent.connect ([this, id] (uint16_t type, uint16_t code, const InputDevice::SensorSamples &samples, double time) {
+		std::unique_lock<std::mutex> lock (_signal_mutex);
+		sensorEvent.emit (id, type, code, samples, time);
+	}));
+	member.connections.push_back (device->error.connect ([this, device] () {
+		Log::error () << "Device " << device->name () << " in group " << _name << " failed" << std::endl;
+	}));
+	if (_started)
+		device->start ();
+	lock.unlock ();
+	// Queued tasks are run after the script is initialized and has
+	// connected its signals.
+	_thread->execOnJsThreadAsync ([this, id] () {
+		deviceAdded.emit (id);
+	});
+	return id;
+}
+
+bool InputGroup::removeDevice (InputDevice *device)
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	for (auto it = _members.begin (); it != _members.end (); ++it) {
+		if (it->second.device != device)
+			continue;
+		unsigned int id = it->first;
+		bool started = _started;
+		for (auto &c: it->second.connections)
+			c.disconnect ();
+		_members.erase (it);
+		lock.unlock ();
+		// The reader thread may be waiting for the script, which may
+		// need the group mutex.
+		if (started)
+			device->stop ();
+		// The device is destroyed after returning, the script must
+		// not use its object anymore.
+		try {
+			_thread->execOnJsThreadSync<int> ([this, device, id] () {
+				device->releaseJsObject (_thread);
+				deviceRemoved.emit (id);
+				return 0;
+			});
+		}
+		catch (std::future_error &) {
+			// The script is not running, its objects are already gone
+		}
+		return true;
+	}
+	return false;
+}
+
+bool InputGroup::empty () const
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	return _members.empty ();
+}
+
+void InputGroup::start ()
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	_started = true;
+	for (auto &pair: _members)
+		pair.second.device->start ();
+}
+
+void InputGroup::stop ()
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	_started = false;
+	for (auto &pair: _members)
+		pair.second.device->stop ();
+}
+
+bool InputGroup::getDevice (JSContext *cx, JS::CallArgs &args)
+{
+	unsigned int id;
+	try {
+		jstpl::readJSValue (cx, id, args.get (0));
+	}
+	catch (std::invalid_argument &e) {
+		JS_ReportError (cx, "Invalid device id: %s", e.what ());
+		return false;
+	}
+	std::unique_lock<std::mutex> lock (_mutex);
+	auto it = _members.find (id);
+	if (it == _members.end ()) {
+		args.rval ().setNull ();
+		return true;
+	}
+	auto thread = static_cast<const jstpl::Thread *> (JS_GetContextPrivate (cx));
+	args.rval ().setObject (*it->second.device->makeJsObject (thread));
+	return true;
+}
+
+std::vector<unsigned int> InputGroup::devices () const
+{
+	std::unique_lock<std::mutex> lock (_mutex);
+	std::vector<unsigned int> ids;
+	for (const auto &pair: _members)
+		ids.push_back (pair.first);
+	return ids;
+}
+
+const JSClass InputGroup::js_class = jstpl::make_class<InputGroup> ("InputGroup");
+
+const JSFunctionSpec InputGroup::js_fs[] = {
+	{
+		"getDevice",
+		&jstpl::LLMethodWrapper<InputGroup, &InputGroup::getDevice>,
+		1, 0
+	},
+	jstpl::make_method<&InputGroup::devices> ("devices"),
+	JS_FS_END
+};
+
+// Member events are coalesced per member, type and code
+static std::optional<uint64_t> memberKey (unsigned int id, std::optional<uint64_t> key)
+{
+	if (!key)
+		return std::nullopt;
+	return (static_cast<uint64_t> (id) << 32) | *key;
+}
+
+static std::optional<uint64_t> eventKey (const jstpl::Thread::RuntimeOptions &options, unsigned int id, const InputDevice::Event &event, double time)
+{
+	return memberKey (id, InputDevice::eventKey (options, event, time));
+}
+
+static std::optional<uint64_t> simpleEventKey (const jstpl::Thread::RuntimeOptions &options, unsigned int id, uint16_t type, uint16_t code, int32_t value, double time)
+{
+	return memberKey (id, InputDevice::simpleEventKey (options, type, code, value, time));
+}
+
+static std::optional<uint64_t> sensorEventKey (const jstpl::Thread::RuntimeOptions &options, unsigned int id, uint16_t type, uint16_t code, const InputDevice::SensorSamples &samples, double time)
+{
+	return memberKey (id, InputDevice::sensorEventKey (options, type, code, samples, time));
+}
+
+const jstpl::SignalMap InputGroup::js_signals = {
+	{ "event", jstpl::make_keyed_signal_connector (&InputGroup::event, &eventKey) },
+	{ "simpleEvent", jstpl::make_keyed_signal_connector (&InputGroup::simpleEvent, &simpleEventKey) },
+	{ "sensorEvent", jstpl::make_typed_array_signal_connector (&InputGroup::sensorEvent, &sensorEventKey) },
+	{ "deviceAdded", jstpl::make_signal_connector (&InputGroup::deviceAdded) },
+	{ "deviceRemoved", jstpl::make_signal_connector (&InputGroup::deviceRemoved) },
+};
+
+bool InputGroup::_registered = jstpl::ClassManager::registerClass<InputGroup::JsClass> ();
@@ -0,0 +1,126 @@
+/*
+ * Copyright 2017 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef INPUT_GROUP_H
+#define INPUT_GROUP_H
+
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "InputDevice.h"
+
+/**
+ * Several input devices sharing a single script.
+ *
+ * Events from every member device are relayed through the group
+ * signals, with the member id as first parameter. Group signals are
+ * emitted by one thread at a time.
+ *
+ * \ingroup InputDevices
+ */
+class InputGroup
+{
+public:
+	InputGroup (const std::string &name);
+	~InputGroup ();
+
+	const std::string &name () const;
+
+	/**
+	 * Set the thread of the group script.
+	 *
+	 * deviceAdded and deviceRemoved are emitted on this thread, after
+	 * the script is initialized, and the JS objects of removed members
+	 * are released on it.
+	 */
+	void setThread (jstpl::Thread *thread);
+
+	/**
+	 * Add a device to the group.
+	 *
+	 * The device is started if the group is.
+	 *
+	 * \returns the member id of the device.
+	 */
+	unsigned int addDevice (InputDevice *device);
+	/**
+	 * Remove a device from the group, stopping it if needed.
+	 *
+	 * \returns false if the device was not a member.
+	 */
+	bool removeDevice (InputDevice *device);
+	bool empty () const;
+
+	/**
+	 * Start reading events from every member device.
+	 */
+	void start ();
+	/**
+	 * Stop reading events from every member device.
+	 */
+	void stop ();
+
+	/**
+	 * Get the device object for the member \p id.
+	 *
+	 * The object cannot be used after the member is removed.
+	 */
+	bool getDevice (JSContext *cx, JS::CallArgs &args);
+	/**
+	 * Get the ids of all current members.
+	 */
+	std::vector<unsigned int> devices () const;
+
+	/**
+	 * Signals relayed from member devices.
+	 */
+	sigc::signal<void (unsigned int, InputDevice::Event, double)> event;
+	sigc::signal<void (unsigned int, uint16_t, uint16_t, int32_t, double)> simpleEvent;
+	sigc::signal<void (unsigned int, uint16_t, uint16_t, const InputDevice::SensorSamples &, double)> sensorEvent;
+	/**
+	 * Signals sent when a member is added or removed.
+	 */
+	sigc::signal<void (unsigned int)> deviceAdded;
+	sigc::signal<void (unsigned int)> deviceRemoved;
+
+	static const JSClass js_class;
+	static const JSFunctionSpec js_fs[];
+	static const jstpl::SignalMap js_signals;
+	typedef jstpl::AbstractClass<InputGroup> JsClass;
+
+private:
+	struct Member
+	{
+		InputDevice *device;
+		std::vector<sigc::connection> connections;
+	};
+
+	std::string _name;
+	jstpl::Thread *_thread;
+	mutable std::mutex _mutex;
+	// Serializes the signal emissions from member reader threads
+	std::mutex _signal_mutex;
+	std::map<unsigned int, Member> _members;
+	unsigned int _next_id;
+	bool _started;
+
+	static bool _registered;
+};
+
+#endif
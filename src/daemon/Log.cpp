@@ -22,30 +22,202 @@
 #include <cstdarg>
 #include <cstdio>
 #include <cstring>
+#include <array>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
 
-Log::Level Log::_level = Log::Error;
+namespace
+{
 
-std::mutex Log::_mutex;
+// Protects the standard error output
+std::mutex output_mutex;
 
-Log::Log ():
-	_buf ("null")
+void writeRecord (const std::string &record)
 {
+	std::unique_lock<std::mutex> lock (output_mutex);
+	std::cerr << record;
+}
+
+/*
+ * Lock-free ring buffer with a single producer (the logging thread) and a
+ * single consumer at a time (LogWriter::drain, under its rings mutex).
+ */
+class LogRing
+{
+public:
+	LogRing ():
+		_head (0),
+		_tail (0)
+	{
+	}
+
+	bool push (std::string &&record)
+	{
+		std::size_t head = _head.load (std::memory_order_relaxed);
+		std::size_t next = (head + 1) % Size;
+		if (next == _tail.load (std::memory_order_acquire))
+			return false;
+		_records[head] = std::move (record);
+		_head.store (next, std::memory_order_release);
+		return true;
+	}
+
+	bool pop (std::string &record)
+	{
+		std::size_t tail = _tail.load (std::memory_order_relaxed);
+		if (tail == _head.load (std::memory_order_acquire))
+			return false;
+		record = std::move (_records[tail]);
+		_tail.store ((tail + 1) % Size, std::memory_order_release);
+		return true;
+	}
+
+	bool empty () const
+	{
+		return _tail.load (std::memory_order_acquire) == _head.load (std::memory_order_acquire);
+	}
+
+private:
+	static constexpr std::size_t Size = 256;
+	std::array<std::string, Size> _records;
+	std::atomic<std::size_t> _head, _tail;
+};
+
+class LogWriter
+{
+public:
+	LogWriter ():
+		_running (true)
+	{
+		_thread = std::thread (&LogWriter::run, this);
+	}
+
+	void stop ()
+	{
+		_running = false;
+		_condvar.notify_one ();
+		_thread.join ();
+		drain ();
+	}
+
+	void write (std::string &&record)
+	{
+		thread_local std::shared_ptr<LogRing> ring = addRing ();
+		// If the ring is full, give some time to the writer before
+		// falling back to a synchronous write.
+		for (unsigned int i = 0; i < MaxRetries; ++i) {
+			if (ring->push (std::move (record))) {
+				_condvar.notify_one ();
+				return;
+			}
+			_condvar.notify_one ();
+			std::this_thread::yield ();
+		}
+		writeRecord (record);
+	}
+
+	/**
+	 * Write the queued records from the calling thread.
+	 */
+	void drain ()
+	{
+		std::unique_lock<std::mutex> rings_lock (_rings_mutex);
+		std::unique_lock<std::mutex> output_lock (output_mutex);
+		std::string record;
+		auto it = _rings.begin ();
+		while (it != _rings.end ()) {
+			while ((*it)->pop (record))
+				std::cerr << record;
+			// Remove rings from terminated threads
+			if (it->use_count () == 1 && (*it)->empty ())
+				it = _rings.erase (it);
+			else
+				++it;
+		}
+		std::cerr.flush ();
+	}
+
+private:
+	std::shared_ptr<LogRing> addRing ()
+	{
+		auto ring = std::make_shared<LogRing> ();
+		std::unique_lock<std::mutex> lock (_rings_mutex);
+		_rings.push_back (ring);
+		return ring;
+	}
+
+	void run ()
+	{
+		std::unique_lock<std::mutex> lock (_wait_mutex);
+		while (_running) {
+			// Notifications are sent without locking, the timeout
+			// bounds the delay of a missed wake-up.
+			_condvar.wait_for (lock, std::chrono::milliseconds (100));
+			drain ();
+		}
+	}
+
+	static constexpr unsigned int MaxRetries = 100;
+
+	std::atomic<bool> _running;
+	std::thread _thread;
+	std::mutex _wait_mutex;
+	std::condition_variable _condvar;
+	std::mutex _rings_mutex;
+	std::vector<std::shared_ptr<LogRing>> _rings;
+};
+
+/*
+ * The writer is never destroyed: records may still be written from other
+ * threads or static destructors after Log::shutdown.
+ */
+LogWriter *writer = nullptr;
+std::atomic<bool> writer_running (false);
+
 }
 
-Log::Log (const std::string &prefix):
-	std::ostream (&_buf),
-	_buf (prefix)
+std::atomic<Log::Level> Log::_level (Log::Error);
+
+Log::Log ()
 {
 }
 
-Log::Log (Log &&log):
-	std::ostream (std::move (log)),
-	_buf (std::move (log._buf))
+Log::Log (const char *prefix)
 {
+	_stream.emplace (prefix);
 }
 
 Log::~Log ()
 {
+	// Terminate partial records
+	if (_stream)
+		_stream->buf.pubsync ();
+}
+
+std::ostream &Log::stream ()
+{
+	if (_stream)
+		return _stream->out;
+	thread_local std::ostream null (nullptr);
+	return null;
+}
+
+void Log::init ()
+{
+	if (!writer)
+		writer = new LogWriter;
+	writer_running = true;
+}
+
+void Log::shutdown ()
+{
+	if (!writer_running.exchange (false))
+		return;
+	writer->stop ();
 }
 
 void Log::setLevel (Log::Level level)
@@ -58,28 +230,26 @@ Log::Level Log::level ()
 	return _level;
 }
 
-Log Log::log (Log::Level level)
-{
-	if (level <= _level) {
-		switch (level) {
-		case Error:
-			return Log ("error");
-		case Warning:
-			return Log ("warning");
-		case Info:
-			return Log ("info");
-		case Debug:
-			return Log ("debug");
-		}
+const char *Log::prefix (Log::Level level)
+{
+	switch (level) {
+	case Error:
+		return "error";
+	case Warning:
+		return "warning";
+	case Info:
+		return "info";
+	case Debug:
+	default:
+		return "debug";
 	}
-	return Log ();
 }
 
 void Log::printf (const char *format, ...)
 {
 	char *str, *current, *end;
 	int len;
-	if (!*this)
+	if (!_stream)
 		return;
 	va_list args, copy;
 	va_start (args, format);
@@ -99,15 +269,31 @@ void Log::printf (const char *format, ...)
 	va_end (args);
 }
 
-Log::LogBuf::LogBuf (const std::string &prefix):
+Log::LogBuf::LogBuf (const char *prefix):
 	_prefix (prefix)
 {
 }
 
 int Log::LogBuf::sync ()
 {
-	std::unique_lock<std::mutex> lock (_mutex);
-	std::cerr << "[" << _prefix << "] " << str ();
+	if (empty ())
+		return 0;
+	std::string record;
+	record.reserve (std::strlen (_prefix) + 4 + (pptr () - pbase ()));
+	record.append ("[").append (_prefix).append ("] ").append (pbase (), pptr ());
+	// Records flushed without std::endl
+	if (record.back () != '\n')
+		record.push_back ('\n');
 	str (std::string ());
+	if (writer_running.load (std::memory_order_acquire)) {
+		writer->write (std::move (record));
+		// Log::shutdown may have drained the rings before the record
+		// was queued, write it from this thread in that case.
+		std::atomic_thread_fence (std::memory_order_seq_cst);
+		if (!writer_running.load (std::memory_order_relaxed))
+			writer->drain ();
+	}
+	else
+		writeRecord (record);
 	return 0;
 }
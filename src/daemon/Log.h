@@ -23,15 +23,54 @@
 #include <sstream>
 #include <iomanip>
 #include <algorithm>
-#include <mutex>
+#include <atomic>
+#include <optional>
 
-class Log: public std::ostream
+/*
+ * Most verbose level compiled in. Calls for more verbose levels are
+ * reduced to a constant check (see Log::MaxLevel).
+ */
+#ifndef LOG_LEVEL_MAX
+#define LOG_LEVEL_MAX Debug
+#endif
+
+/**
+ * Log to \p level only if it is enabled. Unlike Log::log, the operands
+ * are not evaluated when the level is disabled.
+ *
+ *     LOG (Debug) << expensive () << std::endl;
+ */
+#define LOG(level) \
+	if (!Log::enabled (Log::level)) ; else Log::log (Log::level)
+
+/**
+ * Log streams.
+ *
+ * Each call to Log::log returns a new stream. A record is terminated when
+ * the stream is flushed (e.g. with std::endl) or destroyed, it is then
+ * queued and written to the standard error by a background thread
+ * (between Log::init and Log::shutdown) or written synchronously.
+ *
+ * A stream for a disabled level owns no buffer, output operations on it
+ * only test for it.
+ */
+class Log
 {
 public:
 	Log (const Log &) = delete;
-	Log (Log &&);
 	~Log ();
 
+	/**
+	 * Start the writer thread.
+	 */
+	static void init ();
+	/**
+	 * Stop the writer thread after writing pending records.
+	 *
+	 * Later records are written synchronously.
+	 */
+	static void shutdown ();
+
 	enum Level {
 		Error,
 		Warning,
@@ -39,23 +78,73 @@ public:
 		Debug,
 	};
 
+	static constexpr Level MaxLevel = LOG_LEVEL_MAX;
+
 	static void setLevel (Level level);
 	static Level level ();
 
-	static Log log (Level level);
+	static inline bool enabled (Level level)
+	{
+		return level <= MaxLevel && level <= _level.load (std::memory_order_relaxed);
+	}
+
+	/**
+	 * Get a new stream for \p level.
+	 *
+	 * If the level is disabled, a null stream is returned and output
+	 * operations on it do nothing.
+	 */
+	static inline Log log (Level level)
+	{
+		if (!enabled (level))
+			return Log ();
+		return Log (prefix (level));
+	}
 
 	static inline Log error () { return log (Error); }
 	static inline Log warning () { return log (Warning); }
 	static inline Log info () { return log (Info); }
 	static inline Log debug () { return log (Debug); }
 
+	/**
+	 * Whether the level of this stream is enabled.
+	 */
+	explicit operator bool () const { return _stream.has_value (); }
+
+	/**
+	 * Get the underlying std::ostream, for functions writing to one.
+	 */
+	std::ostream &stream ();
+
+	template <typename T>
+	inline Log &operator<< (const T &value)
+	{
+		if (_stream)
+			_stream->out << value;
+		return *this;
+	}
+
+	inline Log &operator<< (std::ostream &(*manip) (std::ostream &))
+	{
+		if (_stream)
+			manip (_stream->out);
+		return *this;
+	}
+
+	inline Log &operator<< (std::ios_base &(*manip) (std::ios_base &))
+	{
+		if (_stream)
+			manip (_stream->out);
+		return *this;
+	}
+
 	void printf (const char *format, ...)
 		__attribute__ ((format (printf, 2, 3)));
 
 	template <class InputIterator>
 	void printBytes (const std::string &prefix,
 			 InputIterator begin, InputIterator end) {
-		if (!*this)
+		if (!_stream)
 			return;
 		*this << prefix;
 		std::for_each (begin, end, [this] (uint8_t byte) {
@@ -70,20 +159,35 @@ public:
 
 private:
 	Log ();
-	Log (const std::string &prefix);
+	Log (const char *prefix);
+
+	static const char *prefix (Level level);
 
 	class LogBuf: public std::stringbuf {
 	public:
-		LogBuf (const std::string &prefix);
+		LogBuf (const char *prefix);
 		virtual int sync ();
 
+		inline bool empty () const { return pptr () == pbase (); }
+
 	private:
-		std::string _prefix;
-	} _buf;
+		const char *_prefix;
+	};
+
+	struct Stream
+	{
+		LogBuf buf;
+		std::ostream out;
+
+		Stream (const char *prefix):
+			buf (prefix),
+			out (&buf)
+		{
+		}
+	};
+	std::optional<Stream> _stream;
 
-	static Level _level;
-	static Log _error, _warning, _info, _debug, _null;
-	static std::mutex _mutex;
+	static std::atomic<Level> _level;
 };
 
 #endif
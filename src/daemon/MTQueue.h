@@ -19,19 +19,46 @@
 #ifndef MT_QUEUE_H
 #define MT_QUEUE_H
 
-#include <queue>
+#include <deque>
 #include <mutex>
 #include <condition_variable>
 #include <optional>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+
+/**
+ * What MTQueue::push_bounded does when the bounded items reach the limit.
+ */
+enum class QueueOverflow
+{
+	/** Wait until an item is popped. */
+	Block,
+	/** Drop the oldest bounded item. */
+	DropOldest,
+	/**
+	 * Replace the pending item with the same key (it is removed and
+	 * the new one is pushed at the end), or wait as Block if there
+	 * is none.
+	 */
+	Coalesce,
+};
 
 /**
  * Interruptible queue for transfering data across different thread.
+ *
+ * Items pushed with push() are always kept. Items pushed with
+ * push_bounded() are subject to a limit and an overflow policy.
+ *
+ * \p Key is the type of the coalescing keys of bounded items, it must be
+ * default constructible and comparable with ==.
  */
-template <typename T>
+template <typename T, typename Key = uint64_t>
 class MTQueue
 {
 public:
 	MTQueue ():
+		_bounded_count (0),
 		_interrupted (false)
 	{
 	}
@@ -42,15 +69,104 @@ public:
 
 	/**
 	 * Push an item in the queue.
+	 *
+	 * The item is dropped if the queue is interrupted.
 	 */
 	void push (const T &item)
 	{
 		std::unique_lock<std::mutex> lock (_mutex);
-		_queue.push (item);
+		if (_interrupted)
+			return;
+		_queue.push_back ({ item, false, Key () });
 		lock.unlock ();
 		_condvar.notify_one ();
 	}
 
+	/**
+	 * Result of push_bounded().
+	 */
+	struct BoundedPushResult
+	{
+		/** The item was pushed (false if interrupted while blocking). */
+		bool pushed;
+		/** Number of items removed by DropOldest or coalescing. */
+		unsigned int dropped;
+		/** The removed item had the same key as the new one. */
+		bool coalesced;
+	};
+
+	/**
+	 * Push an item counting toward \p limit bounded items.
+	 *
+	 * A pending bounded item with the same non-default \p key is
+	 * replaced (removed, the new item being pushed at the end) when
+	 * there are at least \p coalesce_from bounded items, or when the
+	 * limit is reached with the Coalesce policy.
+	 *
+	 * \param limit		Maximum number of bounded items in the queue (0 for no limit).
+	 * \param overflow		Policy used when the limit is reached.
+	 * \param key			Coalescing key, Key () if the item cannot be coalesced.
+	 * \param coalesce_from	Number of bounded items from which items are coalesced (0 to only coalesce with the Coalesce policy).
+	 */
+	BoundedPushResult push_bounded (const T &item, std::size_t limit, QueueOverflow overflow, const Key &key = Key (), std::size_t coalesce_from = 0)
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		BoundedPushResult result = { true, 0, false };
+		if (_interrupted) {
+			result.pushed = false;
+			return result;
+		}
+		std::size_t threshold = coalesce_from;
+		if (overflow == QueueOverflow::Coalesce && limit > 0 && (threshold == 0 || limit < threshold))
+			threshold = limit;
+		if (threshold > 0 && _bounded_count >= threshold && !(key == Key ())) {
+			auto it = std::find_if (_queue.begin (), _queue.end (), [&key] (const Entry &e) {
+				return e.bounded && e.key == key;
+			});
+			if (it != _queue.end ()) {
+				_queue.erase (it);
+				--_bounded_count;
+				result.dropped = 1;
+				result.coalesced = true;
+			}
+		}
+		if (!result.coalesced && limit > 0 && _bounded_count >= limit) {
+			switch (overflow) {
+			case QueueOverflow::Block:
+			case QueueOverflow::Coalesce:
+				_space_condvar.wait (lock, [this, limit] () {
+					return _bounded_count < limit || _interrupted;
+				});
+				if (_interrupted) {
+					result.pushed = false;
+					return result;
+				}
+				break;
+			case QueueOverflow::DropOldest:
+				_queue.erase (std::find_if (_queue.begin (), _queue.end (), [] (const Entry &e) {
+					return e.bounded;
+				}));
+				--_bounded_count;
+				result.dropped = 1;
+				break;
+			}
+		}
+		_queue.push_back ({ item, true, key });
+		++_bounded_count;
+		lock.unlock ();
+		_condvar.notify_one ();
+		return result;
+	}
+
+	/**
+	 * Number of items in the queue.
+	 */
+	std::size_t size () const
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		return _queue.size ();
+	}
+
 	/**
 	 * Pop an item from the queue.
 	 *
@@ -66,8 +182,29 @@ public:
 		while (_queue.empty () && !_interrupted)
 			_condvar.wait (lock);
 		if (!_interrupted) {
-			ret = std::move (_queue.front ());
-			_queue.pop ();
+			ret = popFront ();
+		}
+		return ret;
+	}
+
+	/**
+	 * Pop an item from the queue, waiting at most \p timeout.
+	 *
+	 * An empty optional is returned if no item was available before
+	 * the timeout or if the queue was interrupted.
+	 *
+	 * \see pop()
+	 */
+	template <class Rep, class Period>
+	std::optional<T> pop_for (const std::chrono::duration<Rep, Period> &timeout)
+	{
+		std::unique_lock<std::mutex> lock (_mutex);
+		std::optional<T> ret;
+		_condvar.wait_for (lock, timeout, [this] () {
+			return !_queue.empty () || _interrupted;
+		});
+		if (!_interrupted && !_queue.empty ()) {
+			ret = popFront ();
 		}
 		return ret;
 	}
@@ -82,22 +219,41 @@ public:
 		std::unique_lock<std::mutex> lock (_mutex);
 		std::optional<T> ret;
 		if(!_queue.empty ()) {
-			ret = std::move (_queue.front ());
-			_queue.pop ();
+			ret = popFront ();
 		}
 		return ret;
 	}
 
+	/**
+	 * Remove every item.
+	 *
+	 * The items are destroyed by the calling thread, without holding
+	 * the queue lock.
+	 */
+	void clear ()
+	{
+		std::deque<Entry> items;
+		std::unique_lock<std::mutex> lock (_mutex);
+		items.swap (_queue);
+		_bounded_count = 0;
+		lock.unlock ();
+		_space_condvar.notify_all ();
+	}
+
 	/**
 	 * Make the current and future calls to pop() return
-	 * immediately with an empty value.
+	 * immediately with an empty value, and drop items pushed
+	 * until resetInterruption() is called.
 	 *
 	 * \see resetInterruption()
 	 */
 	void interrupt ()
 	{
+		std::unique_lock<std::mutex> lock (_mutex);
 		_interrupted = true;
+		lock.unlock ();
 		_condvar.notify_all ();
+		_space_condvar.notify_all ();
 	}
 
 	/**
@@ -107,13 +263,35 @@ public:
 	 */
 	void resetInterruption ()
 	{
+		std::unique_lock<std::mutex> lock (_mutex);
 		_interrupted = false;
 	}
 
 private:
-	std::mutex _mutex;
+	struct Entry
+	{
+		T item;
+		bool bounded;
+		Key key;
+	};
+
+	// Must be called with _mutex locked
+	T popFront ()
+	{
+		Entry entry = std::move (_queue.front ());
+		_queue.pop_front ();
+		if (entry.bounded) {
+			--_bounded_count;
+			_space_condvar.notify_one ();
+		}
+		return std::move (entry.item);
+	}
+
+	mutable std::mutex _mutex;
 	std::condition_variable _condvar;
-	std::queue<T> _queue;
+	std::condition_variable _space_condvar;
+	std::deque<Entry> _queue;
+	std::size_t _bounded_count;
 	bool _interrupted;
 };
 
@@ -0,0 +1,519 @@
+/*
+ * Copyright 2017 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "Profile.h"
+
+#include <algorithm>
+#include <fstream>
+#include <json/json.h>
+#include <json/reader.h>
+
+#include "Config.h"
+#include "Log.h"
+#include "InputDevice.h"
+#include "event/EventDevice.h"
+#include "classes/UInput.h"
+#include "classes/Remapper.h"
+#include "classes/Passthrough.h"
+
+extern "C" {
+#include <libevdev/libevdev.h>
+}
+
+static bool parseInt (const Json::Value &value, const std::string &where, int32_t &result)
+{
+	if (!value.isInt ()) {
+		Log::error () << where << " must be an integer." << std::endl;
+		return false;
+	}
+	result = value.asInt ();
+	return true;
+}
+
+static bool parseIntArray (const Json::Value &value, const std::string &where, std::size_t size, std::vector<int32_t> &result)
+{
+	if (!value.isArray () || (size != 0 && value.size () != size)) {
+		Log::error () << where << " must be an array of " << (size ? std::to_string (size) + " " : "") << "integers." << std::endl;
+		return false;
+	}
+	result.resize (value.size ());
+	for (unsigned int i = 0; i < value.size (); ++i)
+		if (!parseInt (value[i], where + "[" + std::to_string (i) + "]", result[i]))
+			return false;
+	return true;
+}
+
+template <std::size_t N>
+static bool parseIntArray (const Json::Value &value, const std::string &where, std::optional<std::array<int32_t, N>> &result)
+{
+	std::vector<int32_t> values;
+	if (!parseIntArray (value, where, N, values))
+		return false;
+	result.emplace ();
+	std::copy (values.begin (), values.end (), result->begin ());
+	return true;
+}
+
+// Types and codes are numbers or libevdev names
+static bool parseType (const Json::Value &value, const std::string &where, uint16_t &type)
+{
+	int ret = -1;
+	if (value.isUInt ())
+		ret = value.asUInt ();
+	else if (value.isString ())
+		ret = libevdev_event_type_from_name (value.asCString ());
+	if (ret < 0 || ret > UINT16_MAX) {
+		Log::error () << where << " is not a valid event type." << std::endl;
+		return false;
+	}
+	type = ret;
+	return true;
+}
+
+static bool parseCode (uint16_t type, const Json::Value &value, const std::string &where, uint16_t &code)
+{
+	int ret = -1;
+	if (value.isUInt ())
+		ret = value.asUInt ();
+	else if (value.isString ())
+		ret = libevdev_event_code_from_name (type, value.asCString ());
+	if (ret < 0 || ret > UINT16_MAX) {
+		Log::error () << where << " is not a valid event code." << std::endl;
+		return false;
+	}
+	code = ret;
+	return true;
+}
+
+// [type, code] array
+static bool parseEvent (const Json::Value &value, const std::string &where, uint16_t &type, uint16_t &code)
+{
+	if (!value.isArray () || value.size () != 2) {
+		Log::error () << where << " must be a [type, code] array." << std::endl;
+		return false;
+	}
+	return parseType (value[0], where + "[0]", type) &&
+		parseCode (type, value[1], where + "[1]", code);
+}
+
+static bool parseMapping (const Json::Value &value, const std::string &where, Profile::Mapping &mapping)
+{
+	if (!value.isObject ()) {
+		Log::error () << where << " must be an object." << std::endl;
+		return false;
+	}
+	if (!value.isMember ("from")) {
+		Log::error () << where << " needs a \"from\" property." << std::endl;
+		return false;
+	}
+	if (!parseEvent (value["from"], where + ".from", mapping.type, mapping.code))
+		return false;
+	if (value.isMember ("field")) {
+		if (!value["field"].isString ()) {
+			Log::error () << where << ".field must be a string." << std::endl;
+			return false;
+		}
+		mapping.field = value["field"].asString ();
+	}
+	if (value.isMember ("to")) {
+		uint16_t type, code;
+		if (!parseEvent (value["to"], where + ".to", type, code))
+			return false;
+		mapping.output = std::make_pair (type, code);
+	}
+	else if (!mapping.field.empty ()) {
+		Log::error () << where << " needs a \"to\" property for complex events." << std::endl;
+		return false;
+	}
+	if (value.isMember ("modifiers")) {
+		const Json::Value &modifiers = value["modifiers"];
+		if (!modifiers.isArray ()) {
+			Log::error () << where << ".modifiers must be an array." << std::endl;
+			return false;
+		}
+		for (unsigned int i = 0; i < modifiers.size (); ++i) {
+			std::string mod_where = where + ".modifiers[" + std::to_string (i) + "]";
+			const Json::Value &mod = modifiers[i];
+			Profile::Modifier modifier = { 0, 0, INT32_MIN, INT32_MAX };
+			if (!mod.isObject () || !mod.isMember ("event")) {
+				Log::error () << mod_where << " must be an object with an \"event\" property." << std::endl;
+				return false;
+			}
+			if (!parseEvent (mod["event"], mod_where + ".event", modifier.type, modifier.code))
+				return false;
+			if (mod.isMember ("min") && !parseInt (mod["min"], mod_where + ".min", modifier.min))
+				return false;
+			if (mod.isMember ("max") && !parseInt (mod["max"], mod_where + ".max", modifier.max))
+				return false;
+			mapping.modifiers.push_back (modifier);
+		}
+	}
+	if (value.isMember ("transform") && !parseIntArray (value["transform"], where + ".transform", mapping.transform))
+		return false;
+	if (mapping.transform && (*mapping.transform)[1] == 0) {
+		Log::error () << where << ".transform divisor must not be zero." << std::endl;
+		return false;
+	}
+	if (value.isMember ("deadzone") && !parseIntArray (value["deadzone"], where + ".deadzone", mapping.deadzone))
+		return false;
+	if (value.isMember ("radial_deadzone")) {
+		const Json::Value &radial = value["radial_deadzone"];
+		std::string radial_where = where + ".radial_deadzone";
+		if (!radial.isObject () || !radial.isMember ("other")) {
+			Log::error () << radial_where << " must be an object with an \"other\" property." << std::endl;
+			return false;
+		}
+		Profile::RadialDeadzone dz = { 0, "", 0, 0, 0 };
+		if (mapping.field.empty ()) {
+			if (!parseCode (mapping.type, radial["other"], radial_where + ".other", dz.other_code))
+				return false;
+		}
+		else if (radial["other"].isString ())
+			dz.other_field = radial["other"].asString ();
+		else {
+			Log::error () << radial_where << ".other must be a field name." << std::endl;
+			return false;
+		}
+		for (auto &setting: std::initializer_list<std::pair<const char *, int32_t Profile::RadialDeadzone::*>> {
+				{ "center", &Profile::RadialDeadzone::center },
+				{ "size", &Profile::RadialDeadzone::size },
+				{ "range", &Profile::RadialDeadzone::range } })
+			if (radial.isMember (setting.first) &&
+					!parseInt (radial[setting.first], radial_where + "." + setting.first, dz.*setting.second))
+				return false;
+		mapping.radial_deadzone = dz;
+	}
+	if (value.isMember ("lookup")) {
+		const Json::Value &lookup = value["lookup"];
+		std::string lookup_where = where + ".lookup";
+		Profile::Lookup table;
+		if (!lookup.isObject () || !lookup.isMember ("min") || !lookup.isMember ("max") || !lookup.isMember ("values")) {
+			Log::error () << lookup_where << " must be an object with \"min\", \"max\" and \"values\" properties." << std::endl;
+			return false;
+		}
+		if (!parseInt (lookup["min"], lookup_where + ".min", table.min) ||
+				!parseInt (lookup["max"], lookup_where + ".max", table.max) ||
+				!parseIntArray (lookup["values"], lookup_where + ".values", 0, table.values))
+			return false;
+		mapping.lookup = std::move (table);
+	}
+	if (value.isMember ("curve") && !parseIntArray (value["curve"], where + ".curve", 0, mapping.curve))
+		return false;
+	if (value.isMember ("threshold")) {
+		std::vector<int32_t> threshold;
+		if (!parseIntArray (value["threshold"], where + ".threshold", 2, threshold))
+			return false;
+		mapping.threshold = std::make_pair (threshold[0], threshold[1]);
+	}
+	if (value.isMember ("default")) {
+		int32_t default_value;
+		if (!parseInt (value["default"], where + ".default", default_value))
+			return false;
+		mapping.default_value = default_value;
+	}
+	return true;
+}
+
+static bool declaresAbs (const Profile &profile, uint16_t code)
+{
+	return std::any_of (profile.abs.begin (), profile.abs.end (), [code] (const Profile::AbsAxis &abs) {
+		return abs.code == code;
+	});
+}
+
+std::shared_ptr<const Profile> Profile::parse (const Json::Value &json, const std::string &where)
+{
+	Json::Value value;
+	if (json.isString ()) {
+		std::string filename;
+		try {
+			filename = Config::getConfigFilePath (json.asString ());
+		}
+		catch (std::exception &e) {
+			Log::error () << where << ": cannot find " << json.asString () << std::endl;
+			return nullptr;
+		}
+		std::ifstream file (filename);
+		Json::Reader reader;
+		if (!reader.parse (file, value)) {
+			Log::error () << "Cannot parse " << filename << ": "
+				      << reader.getFormattedErrorMessages () << std::endl;
+			return nullptr;
+		}
+	}
+	else
+		value = json;
+	if (!value.isObject ()) {
+		Log::error () << where << " must be an object or a file name." << std::endl;
+		return nullptr;
+	}
+
+	auto profile = std::make_shared<Profile> ();
+	for (const auto &key: value.getMemberNames ()) {
+		const Json::Value &setting = value[key];
+		std::string setting_where = where + "." + key;
+		if (key == "name") {
+			if (!setting.isString ()) {
+				Log::error () << setting_where << " must be a string." << std::endl;
+				return nullptr;
+			}
+			profile->name = setting.asString ();
+		}
+		else if (key == "bustype" || key == "vendor" || key == "product" || key == "version") {
+			if (!setting.isUInt () || setting.asUInt () > UINT16_MAX) {
+				Log::error () << setting_where << " must be a 16 bits unsigned integer." << std::endl;
+				return nullptr;
+			}
+			auto &id = key == "bustype" ? profile->bustype :
+				   key == "vendor" ? profile->vendor :
+				   key == "product" ? profile->product :
+				   profile->version;
+			id = setting.asUInt ();
+		}
+		else if (key == "copy_capabilities" || key == "grab" || key == "passthrough") {
+			if (!setting.isBool ()) {
+				Log::error () << setting_where << " must be a boolean." << std::endl;
+				return nullptr;
+			}
+			auto &flag = key == "copy_capabilities" ? profile->copy_capabilities :
+				     key == "grab" ? profile->grab :
+				     profile->passthrough;
+			flag = setting.asBool ();
+		}
+		else if (key == "keys" || key == "rels") {
+			uint16_t type = key == "keys" ? EV_KEY : EV_REL;
+			if (!setting.isArray ()) {
+				Log::error () << setting_where << " must be an array." << std::endl;
+				return nullptr;
+			}
+			for (unsigned int i = 0; i < setting.size (); ++i) {
+				uint16_t code;
+				if (!parseCode (type, setting[i], setting_where + "[" + std::to_string (i) + "]", code))
+					return nullptr;
+				profile->events.emplace_back (type, code);
+			}
+		}
+		else if (key == "abs") {
+			if (!setting.isArray ()) {
+				Log::error () << setting_where << " must be an array." << std::endl;
+				return nullptr;
+			}
+			for (unsigned int i = 0; i < setting.size (); ++i) {
+				const Json::Value &axis = setting[i];
+				std::string axis_where = setting_where + "[" + std::to_string (i) + "]";
+				AbsAxis abs = { 0, 0, 0, 0, 0 };
+				if (!axis.isObject () || !axis.isMember ("code") || !axis.isMember ("min") || !axis.isMember ("max")) {
+					Log::error () << axis_where << " must be an object with \"code\", \"min\" and \"max\" properties." << std::endl;
+					return nullptr;
+				}
+				if (!parseCode (EV_ABS, axis["code"], axis_where + ".code", abs.code) ||
+						!parseInt (axis["min"], axis_where + ".min", abs.min) ||
+						!parseInt (axis["max"], axis_where + ".max", abs.max) ||
+						(axis.isMember ("fuzz") && !parseInt (axis["fuzz"], axis_where + ".fuzz", abs.fuzz)) ||
+						(axis.isMember ("flat") && !parseInt (axis["flat"], axis_where + ".flat", abs.flat)))
+					return nullptr;
+				profile->abs.push_back (abs);
+			}
+		}
+		else if (key == "exclude") {
+			if (!setting.isArray ()) {
+				Log::error () << setting_where << " must be an array." << std::endl;
+				return nullptr;
+			}
+			for (unsigned int i = 0; i < setting.size (); ++i) {
+				const Json::Value &ev = setting[i];
+				std::string ev_where = setting_where + "[" + std::to_string (i) + "]";
+				uint16_t type, code;
+				if (ev.isArray () && ev.size () == 1) {
+					if (!parseType (ev[0], ev_where + "[0]", type))
+						return nullptr;
+					profile->exclude.emplace_back (type, -1);
+				}
+				else {
+					if (!parseEvent (ev, ev_where, type, code))
+						return nullptr;
+					profile->exclude.emplace_back (type, code);
+				}
+			}
+		}
+		else if (key == "mappings") {
+			if (!setting.isArray ()) {
+				Log::error () << setting_where << " must be an array." << std::endl;
+				return nullptr;
+			}
+			profile->mappings.resize (setting.size ());
+			for (unsigned int i = 0; i < setting.size (); ++i)
+				if (!parseMapping (setting[i], setting_where + "[" + std::to_string (i) + "]", profile->mappings[i]))
+					return nullptr;
+		}
+		else {
+			Log::warning () << "Unknown profile setting: " << setting_where << std::endl;
+		}
+	}
+	// Mapping outputs are enabled on the uinput device, axes must be
+	// declared in "abs" unless they can be copied from the source axis.
+	for (unsigned int i = 0; i < profile->mappings.size (); ++i) {
+		const auto &mapping = profile->mappings[i];
+		std::string mapping_where = where + ".mappings[" + std::to_string (i) + "]";
+		auto output = mapping.output.value_or (std::make_pair (mapping.type, mapping.code));
+		switch (output.first) {
+		case EV_KEY: case EV_REL: case EV_MSC: case EV_SW: case EV_LED: case EV_SND:
+			break;
+		case EV_ABS: {
+			bool declared = declaresAbs (*profile, output.second);
+			bool copyable = mapping.field.empty () && mapping.type == EV_ABS &&
+					!mapping.transform && !mapping.lookup && mapping.curve.empty () && !mapping.threshold;
+			if (!declared && !copyable) {
+				Log::error () << mapping_where << " output axis must be declared in " << where << ".abs." << std::endl;
+				return nullptr;
+			}
+			break;
+		}
+		default:
+			Log::error () << mapping_where << " output type is not supported." << std::endl;
+			return nullptr;
+		}
+	}
+	return profile;
+}
+
+Profile::Instance::Instance (std::shared_ptr<const Profile> profile, InputDevice *device):
+	_profile (profile),
+	_device (device),
+	_uinput (std::make_unique<UInput> ())
+{
+	EventDevice *event_device = dynamic_cast<EventDevice *> (device);
+	if (profile->passthrough || profile->copy_capabilities) {
+		if (!event_device)
+			throw std::invalid_argument ("Passthrough and copy_capabilities need an event device");
+		_passthrough = std::make_unique<Passthrough> (device, _uinput.get ());
+		if (profile->copy_capabilities)
+			_passthrough->copyCapabilities ();
+	}
+
+	// uinput device
+	if (!profile->name.empty ())
+		_uinput->setName (profile->name);
+	if (profile->bustype)
+		_uinput->setBusType (*profile->bustype);
+	if (profile->vendor)
+		_uinput->setVendor (*profile->vendor);
+	if (profile->product)
+		_uinput->setProduct (*profile->product);
+	if (profile->version)
+		_uinput->setVersion (*profile->version);
+	for (const auto &ev: profile->events)
+		_uinput->setEvent (ev.first, ev.second);
+	for (const auto &abs: profile->abs)
+		_uinput->setAbs (abs.code, abs.min, abs.max, abs.fuzz, abs.flat);
+	for (const auto &mapping: profile->mappings) {
+		auto output = mapping.output.value_or (std::make_pair (mapping.type, mapping.code));
+		if (output.first != EV_ABS) {
+			_uinput->setEvent (output.first, output.second);
+			continue;
+		}
+		if (declaresAbs (*profile, output.second))
+			continue;
+		// Undeclared axes keep the range of their source axis (see parse)
+		const struct input_absinfo *abs = event_device
+			? libevdev_get_abs_info (event_device->evdev (), mapping.code)
+			: nullptr;
+		if (!abs)
+			throw std::invalid_argument ("Mapped axis needs an \"abs\" declaration for this device");
+		_uinput->setAbs (output.second, abs->minimum, abs->maximum, abs->fuzz, abs->flat);
+		_uinput->setAbsResolution (output.second, abs->resolution);
+	}
+	_uinput->create ();
+
+	// Remapping rules
+	if (!profile->mappings.empty ()) {
+		_remapper = std::make_unique<Remapper> (device, _uinput.get ());
+		for (const auto &mapping: profile->mappings) {
+			Remapper::mapped_event *ev;
+			if (mapping.field.empty ()) {
+				ev = _remapper->addEvent (mapping.type, mapping.code);
+				if (_passthrough)
+					_passthrough->exclude (mapping.type, mapping.code);
+			}
+			else
+				ev = _remapper->addComplexEvent (mapping.type, mapping.code, mapping.field);
+			if (mapping.output)
+				ev->setEvent (mapping.output->first, mapping.output->second);
+			for (const auto &mod: mapping.modifiers)
+				ev->addModifier (mod.type, mod.code, mod.min, mod.max);
+			if (mapping.transform)
+				ev->setTransform ((*mapping.transform)[0], (*mapping.transform)[1], (*mapping.transform)[2]);
+			if (mapping.deadzone)
+				ev->setDeadzone ((*mapping.deadzone)[0], (*mapping.deadzone)[1], (*mapping.deadzone)[2]);
+			if (mapping.radial_deadzone) {
+				const auto &dz = *mapping.radial_deadzone;
+				if (mapping.field.empty ())
+					ev->setRadialDeadzone (dz.other_code, dz.center, dz.size, dz.range);
+				else
+					ev->setRadialDeadzoneField (dz.other_field, dz.center, dz.size, dz.range);
+			}
+			if (mapping.lookup)
+				ev->setLookupTable (mapping.lookup->min, mapping.lookup->max, mapping.lookup->values);
+			if (!mapping.curve.empty ())
+				ev->setCurve (mapping.curve);
+			if (mapping.threshold)
+				ev->setThreshold (mapping.threshold->first, mapping.threshold->second);
+			if (mapping.default_value)
+				ev->setDefaultValue (*mapping.default_value);
+		}
+		// The passthrough terminates the frames of remapped events
+		if (_passthrough && profile->passthrough)
+			_passthrough->setSyncExcluded (true);
+		else
+			_remapper->addEvent (EV_SYN, SYN_REPORT);
+		_remapper->connect ();
+	}
+
+	if (_passthrough && profile->passthrough) {
+		for (const auto &ev: profile->exclude) {
+			if (ev.second < 0)
+				_passthrough->excludeType (ev.first);
+			else
+				_passthrough->exclude (ev.first, ev.second);
+		}
+		_passthrough->connect ();
+	}
+
+	if (event_device && profile->grab)
+		event_device->grab (true);
+
+	_error = device->error.connect ([device] () {
+		Log::error () << "Profile device "
+			      << device->driver () << "/"
+			      << device->name () << "/"
+			      << device->serial () << " failed." << std::endl;
+	});
+	device->start ();
+}
+
+Profile::Instance::~Instance ()
+{
+	_device->stop ();
+	_error.disconnect ();
+	// Stop sending events before destroying the uinput device
+	_remapper.reset ();
+	_passthrough.reset ();
+	if (_profile->grab)
+		if (EventDevice *event_device = dynamic_cast<EventDevice *> (_device))
+			event_device->grab (false);
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright 2017 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <optional>
+#include <array>
+#include <sigc++/connection.h>
+
+namespace Json { class Value; }
+
+class InputDevice;
+class UInput;
+class Remapper;
+class Passthrough;
+
+/**
+ * Declarative mapping profile.
+ *
+ * A profile describes a uinput device, remapping rules and a passthrough
+ * of the remaining events. Devices using a profile are handled entirely in
+ * C++, without any JS runtime or script thread.
+ *
+ * Profiles are parsed from the configuration with parse() and applied to
+ * devices by creating an Instance.
+ */
+class Profile
+{
+public:
+	struct AbsAxis
+	{
+		uint16_t code;
+		int32_t min, max, fuzz, flat;
+	};
+
+	struct Modifier
+	{
+		uint16_t type, code;
+		int32_t min, max;
+	};
+
+	struct RadialDeadzone
+	{
+		uint16_t other_code;
+		std::string other_field; // for complex events
+		int32_t center, size, range;
+	};
+
+	struct Lookup
+	{
+		int32_t min, max;
+		std::vector<int32_t> values;
+	};
+
+	/**
+	 * Remapper rule, optional settings keep the Remapper defaults.
+	 */
+	struct Mapping
+	{
+		uint16_t type, code;
+		std::string field; // complex event field, empty for simple events
+		std::optional<std::pair<uint16_t, uint16_t>> output;
+		std::vector<Modifier> modifiers;
+		std::optional<std::array<int32_t, 3>> transform;
+		std::optional<std::array<int32_t, 3>> deadzone;
+		std::optional<RadialDeadzone> radial_deadzone;
+		std::optional<Lookup> lookup;
+		std::vector<int32_t> curve;
+		std::optional<std::pair<int32_t, int32_t>> threshold;
+		std::optional<int32_t> default_value;
+	};
+
+	// uinput device
+	std::string name;
+	std::optional<uint16_t> bustype, vendor, product, version;
+	bool copy_capabilities = false;
+	std::vector<std::pair<uint16_t, uint16_t>> events; // EV_KEY, EV_REL, ...
+	std::vector<AbsAxis> abs;
+	// event device settings
+	bool grab = false;
+	// forward events that are not remapped (event devices only)
+	bool passthrough = false;
+	// excluded from the passthrough, code -1 excludes the whole type
+	std::vector<std::pair<uint16_t, int>> exclude;
+	std::vector<Mapping> mappings;
+
+	/**
+	 * Parse a profile from a JSON object, or from the JSON file named by
+	 * a string.
+	 *
+	 * Errors are logged with \p where as the setting name.
+	 *
+	 * \returns nullptr if the profile is invalid.
+	 */
+	static std::shared_ptr<const Profile> parse (const Json::Value &value, const std::string &where);
+
+	/**
+	 * A profile applied to an input device.
+	 *
+	 * The uinput device is created and the device is started by the
+	 * constructor, the destructor stops the device.
+	 */
+	class Instance
+	{
+	public:
+		Instance (std::shared_ptr<const Profile> profile, InputDevice *device);
+		Instance (const Instance &) = delete;
+		~Instance ();
+
+	private:
+		std::shared_ptr<const Profile> _profile;
+		InputDevice *_device;
+		std::unique_ptr<UInput> _uinput;
+		std::unique_ptr<Remapper> _remapper;
+		std::unique_ptr<Passthrough> _passthrough;
+		sigc::connection _error;
+	};
+};
+
+#endif // PROFILE_H
@@ -25,6 +25,7 @@
 
 #include "Log.h"
 #include "Config.h"
+#include "InputGroup.h"
 
 #include "System.h"
 
@@ -33,44 +34,85 @@ extern "C" {
 }
 
 using com::github::cvuchener::InputScripts::Script_adaptor;
+using com::github::cvuchener::InputScripts::Metrics_adaptor;
 
 Script::Script (DBus::Connection &dbus_connection, std::string path, InputDevice *device):
 	DBus::ObjectAdaptor (dbus_connection, path),
-	_device (device)
+	_device (device),
+	_group (nullptr)
 {
-	for (const auto &script: Config::config.default_scripts) {
-		bool match = true;
-		for (const auto &rule: script.rules) {
-			if (rule.first == "driver") {
-				if (rule.second != device->driver ()) {
-					match = false;
-					break;
-				}
-			}
-			else if (rule.first == "name") {
-				if (rule.second != device->name ()) {
-					match = false;
-					break;
-				}
-			}
-			else if (rule.first == "serial") {
-				if (rule.second != device->serial ()) {
-					match =false;
-					break;
-				}
-			}
-		}
-		if (match) {
-			_filename = script.script_file;
-			Log::info () << "Default script is " << _filename << std::endl;
-			break;
-		}
-	}
+	auto config = Config::get ();
+	const Config::ScriptRule *script = config->findDefaultScript (
+		device->driver (), device->name (), device->serial ());
+	if (script)
+		applyRule (*script);
 
 	Script_adaptor::driver = device->driver ();
 	Script_adaptor::name = device->name ();
 	Script_adaptor::serial = device->serial ();
 	Script_adaptor::file = _filename;
+
+	Metrics_adaptor::heap_bytes = 0;
+	Metrics_adaptor::gc_count = 0;
+	Metrics_adaptor::gc_pause_total = 0;
+	Metrics_adaptor::gc_pause_max = 0;
+	Metrics_adaptor::budget_overruns = 0;
+	Metrics_adaptor::dropped_events = 0;
+	Metrics_adaptor::coalesced_events = 0;
+	Metrics_adaptor::queue_depth = 0;
+	Metrics_adaptor::script_thread = "";
+	Metrics_adaptor::reader_thread = "";
+	registerGetAll ();
+}
+
+Script::Script (DBus::Connection &dbus_connection, std::string path, InputGroup *group, const Config::ScriptRule &rule):
+	DBus::ObjectAdaptor (dbus_connection, path),
+	_device (nullptr),
+	_group (group)
+{
+	applyRule (rule);
+
+	Script_adaptor::driver = "group";
+	Script_adaptor::name = group->name ();
+	Script_adaptor::serial = "";
+	Script_adaptor::file = _filename;
+
+	Metrics_adaptor::heap_bytes = 0;
+	Metrics_adaptor::gc_count = 0;
+	Metrics_adaptor::gc_pause_total = 0;
+	Metrics_adaptor::gc_pause_max = 0;
+	Metrics_adaptor::budget_overruns = 0;
+	Metrics_adaptor::dropped_events = 0;
+	Metrics_adaptor::coalesced_events = 0;
+	Metrics_adaptor::queue_depth = 0;
+	Metrics_adaptor::script_thread = "";
+	Metrics_adaptor::reader_thread = "";
+	registerGetAll ();
+}
+
+void Script::applyRule (const Config::ScriptRule &script)
+{
+	_filename = script.script_file;
+	Log::info () << "Default script is " << _filename << std::endl;
+	RuntimeOptions options;
+	if (script.heap_size)
+		options.max_bytes = script.heap_size;
+	if (script.nursery_size)
+		options.nursery_bytes = script.nursery_size;
+	options.idle_gc_delay = script.idle_gc_delay;
+	if (script.gc_slice_budget)
+		options.gc_slice_budget = script.gc_slice_budget;
+	options.recycle_objects = script.recycle_events;
+	options.thread_policy = script.script_thread;
+	options.task_budget = script.task_budget;
+	options.max_queued_events = script.max_queued_events;
+	options.overload_policy = script.overload_policy;
+	options.coalesce_threshold = script.coalesce_threshold;
+	options.coalesced_types = script.coalesced_types;
+	options.coalesce_sensors = script.coalesce_sensors;
+	setRuntimeOptions (options);
+	if (_device)
+		_device->setReaderThreadPolicy (script.reader_thread);
 }
 
 Script::~Script ()
@@ -265,10 +307,18 @@ void Script::run (JSContext *cx)
 		}
 	}
 
-	// Create InputEvent JS object
-	JS::RootedObject input_object (cx);
-	input_object = _device->makeJsObject (this);
-	JS_DefineProperty (cx, global, "input", input_object, JSPROP_ENUMERATE);
+	if (_group) {
+		// Create InputGroup JS object
+		JS::RootedValue group_value (cx);
+		jstpl::setJSValue (cx, &group_value, _group);
+		JS_DefineProperty (cx, global, "group", group_value, JSPROP_ENUMERATE);
+	}
+	else {
+		// Create InputEvent JS object
+		JS::RootedObject input_object (cx);
+		input_object = _device->makeJsObject (this);
+		JS_DefineProperty (cx, global, "input", input_object, JSPROP_ENUMERATE);
+	}
 
 	// Execute user script and retrieve the prototype
 	JS::RootedObject script_proto (cx);
@@ -292,18 +342,28 @@ void Script::run (JSContext *cx)
 		throw std::runtime_error ("init function failed");
 
 	// Start reading inputs
-	auto error = _device->error.connect ([this] () {
-		_stopping = true;
-		execOnJsThreadAsync ([] () {}); // Wake up the script thread
-	});
-	_device->start ();
+	sigc::connection error;
+	if (_group) {
+		// A failing member does not stop the other devices
+		_group->start ();
+	}
+	else {
+		error = _device->error.connect ([this] () {
+			_stopping = true;
+			execOnJsThreadAsync ([] () {}); // Wake up the script thread
+		});
+		_device->start ();
+	}
 
 	// Perform tasks
 	exec ();
 	error.disconnect ();
 
 	// Stop inputs
-	_device->stop ();
+	if (_group)
+		_group->stop ();
+	else
+		_device->stop ();
 
 	// disconnect all remaining signals
 	for (auto &p: _signal_connections)
@@ -315,12 +375,93 @@ void Script::run (JSContext *cx)
 		throw std::runtime_error ("finalize function failed");
 }
 
-void Script::on_set_property (DBus::InterfaceAdaptor &interface, const std::string &property, const DBus::Variant &value)
+void Script::registerGetAll ()
+{
+	PropertiesAdaptor::_methods["GetAll"] = new DBus::Callback<Script, DBus::Message, const DBus::CallMessage &> (this, &Script::GetAll);
+}
+
+DBus::Message Script::GetAll (const DBus::CallMessage &call)
 {
-	if (property == "file") {
-		stop ();
-		_filename = value.operator std::string ();
-		Log::info () << "Script set to " << _filename << std::endl;
-		start ();
+	DBus::MessageIter ri = call.reader ();
+	std::string interface_name;
+	ri >> interface_name;
+
+	const DBus::IntrospectedInterface *introspected;
+	DBus::InterfaceAdaptor *interface;
+	if (interface_name == Script_adaptor::introspect ()->name) {
+		introspected = Script_adaptor::introspect ();
+		interface = static_cast<Script_adaptor *> (this);
 	}
+	else if (interface_name == Metrics_adaptor::introspect ()->name) {
+		introspected = Metrics_adaptor::introspect ();
+		interface = static_cast<Metrics_adaptor *> (this);
+		// Same snapshot for every property of the reply
+		updateMetrics ();
+	}
+	else
+		throw DBus::ErrorFailed ("requested interface not found");
+
+	std::map<std::string, DBus::Variant> properties;
+	for (const auto *property = introspected->properties; property->name; ++property) {
+		const DBus::Variant *value = interface->get_property (property->name);
+		if (value)
+			properties.emplace (property->name, *value);
+	}
+
+	DBus::ReturnMessage reply (call);
+	DBus::MessageIter wi = reply.writer ();
+	wi << properties;
+	return reply;
+}
+
+void Script::updateMetrics ()
+{
+	auto stats = statistics ();
+	Metrics_adaptor::heap_bytes = stats.heap_bytes;
+	Metrics_adaptor::gc_count = stats.gc_count;
+	Metrics_adaptor::gc_pause_total = stats.gc_pause_total;
+	Metrics_adaptor::gc_pause_max = stats.gc_pause_max;
+	Metrics_adaptor::budget_overruns = stats.budget_overruns;
+	Metrics_adaptor::dropped_events = stats.dropped_events;
+	Metrics_adaptor::coalesced_events = stats.coalesced_events;
+	Metrics_adaptor::queue_depth = stats.queue_depth;
+	Metrics_adaptor::script_thread = threadPolicy ();
+	Metrics_adaptor::reader_thread = _device ? _device->readerThreadPolicy () : std::string ();
+}
+
+void Script::on_get_property (DBus::InterfaceAdaptor &interface, const std::string &property, DBus::Variant &value)
+{
+	// value refers to the adaptor property, update all of them at once
+	if (interface.name () == Metrics_adaptor::introspect ()->name)
+		updateMetrics ();
+}
+
+void Script::on_set_property (DBus::InterfaceAdaptor &interface, const std::string &property, const DBus::Variant &value)
+{
+	if (property == "file")
+		setFile (value.operator std::string ());
+}
+
+void Script::setFile (const std::string &filename)
+{
+	stop ();
+	_filename = filename;
+	Log::info () << "Script set to " << _filename << std::endl;
+	start ();
+
+	Script_adaptor::file = _filename;
+	DBus::Variant value;
+	DBus::MessageIter wi = value.writer ();
+	wi << _filename;
+	std::string interface = Script_adaptor::introspect ()->name;
+	emitPropertiesChanged (interface, { { "file", value } });
+	propertyChanged.emit (interface, "file", value);
+}
+
+void Script::emitPropertiesChanged (const std::string &interface, const std::map<std::string, DBus::Variant> &changed)
+{
+	DBus::SignalMessage signal ("PropertiesChanged");
+	DBus::MessageIter wi = signal.writer ();
+	wi << interface << changed << std::vector<std::string> ();
+	PropertiesAdaptor::emit_signal (signal);
 }
@@ -21,27 +21,64 @@
 
 #include "jstpl/Thread.h"
 #include "dbus/ScriptInterfaceAdaptor.h"
+#include "dbus/MetricsInterfaceAdaptor.h"
 
 #include <string>
+#include <sigc++/signal.h>
 #include "InputDevice.h"
+#include "Config.h"
+
+class InputGroup;
 
 
 class Script:
 	public jstpl::Thread,
 	public com::github::cvuchener::InputScripts::Script_adaptor,
+	public com::github::cvuchener::InputScripts::Metrics_adaptor,
 	public DBus::IntrospectableAdaptor,
 	public DBus::PropertiesAdaptor,
 	public DBus::ObjectAdaptor
 {
 public:
 	Script (DBus::Connection &dbus_connection, std::string path, InputDevice *device);
+	/**
+	 * Create a script for a device group using the settings from \p rule.
+	 *
+	 * The script has a "group" global instead of "input".
+	 */
+	Script (DBus::Connection &dbus_connection, std::string path, InputGroup *group, const Config::ScriptRule &rule);
 	virtual ~Script ();
 
+	/**
+	 * Restart the script with a new file.
+	 */
+	void setFile (const std::string &filename);
+
+	/**
+	 * Emitted after a property changed, with interface name, property
+	 * name and new value.
+	 */
+	sigc::signal<void (const std::string &, const std::string &, const DBus::Variant &)> propertyChanged;
+
 protected:
 	virtual void run (JSContext *cx);
+	virtual void on_get_property (DBus::InterfaceAdaptor &interface, const std::string &property, DBus::Variant &value);
 	virtual void on_set_property (DBus::InterfaceAdaptor &interface, const std::string &property, const DBus::Variant &value);
 
 private:
+	void applyRule (const Config::ScriptRule &rule);
+	/**
+	 * Register GetAll on the properties interface, dbus-c++ only
+	 * implements Get and Set.
+	 */
+	void registerGetAll ();
+	DBus::Message GetAll (const DBus::CallMessage &call);
+	/**
+	 * Copy the current statistics to the Metrics properties.
+	 */
+	void updateMetrics ();
+	void emitPropertiesChanged (const std::string &interface, const std::map<std::string, DBus::Variant> &changed);
+
 	static bool connectSignalWrapper (JSContext *cx, unsigned int argc, JS::Value *vp);
 	bool connectSignal (JSContext *cx, unsigned int argc, JS::Value *vp);
 	static bool disconnectSignalWrapper (JSContext *cx, unsigned int argc, JS::Value *vp);
@@ -49,6 +86,7 @@ private:
 
 	std::string _filename;
 	InputDevice *_device;
+	InputGroup *_group;
 
 	std::map<int, sigc::connection> _signal_connections;
 	int _next_signal_connection_index;
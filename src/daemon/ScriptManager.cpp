@@ -21,7 +21,21 @@
 #include "Driver.h"
 #include "InputDevice.h"
 #include "Script.h"
+#include "InputGroup.h"
+#include "Config.h"
+#include "Profile.h"
 #include "Log.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+extern "C" {
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+}
 
 constexpr char ScriptManager::DBusObjectPath[];
 
@@ -29,7 +43,8 @@ using com::github::cvuchener::InputScripts::Script_adaptor;
 
 ScriptManager::ScriptManager (DBus::Connection &dbus_connection):
 	DBus::ObjectAdaptor (dbus_connection, DBusObjectPath),
-	_dbus_connection (dbus_connection)
+	_dbus_connection (dbus_connection),
+	_trace_fd (-1)
 {
 	for (auto it = Driver::begin (); it != Driver::end (); ++it) {
 		Driver *driver = it->second.get ();
@@ -47,6 +62,10 @@ ScriptManager::~ScriptManager ()
 	}
 	for (auto &pair: _scripts)
 		pair.second->stop ();
+	for (auto &pair: _groups)
+		pair.second.script->stop ();
+	_profiles.clear ();
+	closeTrace ();
 }
 
 static std::map<std::string, std::map<std::string, DBus::Variant>> getScriptProperties (Script *script)
@@ -64,9 +83,79 @@ static std::map<std::string, std::map<std::string, DBus::Variant>> getScriptProp
 	return object_properties;
 }
 
+void ScriptManager::publishScript (Script *script)
+{
+	std::string path = script->path ();
+	auto &properties = _objects[path] = getScriptProperties (script);
+	script->propertyChanged.connect ([this, path] (const std::string &interface, const std::string &property, const DBus::Variant &value) {
+		std::unique_lock<std::recursive_mutex> lock (_mutex);
+		auto it = _objects.find (path);
+		if (it != _objects.end ())
+			it->second[interface][property] = value;
+	});
+	InterfacesAdded (path, properties);
+}
+
+void ScriptManager::unpublishScript (const DBus::Path &path, const std::string &interface_name)
+{
+	_objects.erase (path);
+	InterfacesRemoved (path, { interface_name });
+}
+
 void ScriptManager::addDevice (InputDevice *device)
 {
-	std::unique_lock<std::mutex> lock (_mutex);
+	std::unique_lock<std::recursive_mutex> lock (_mutex);
+
+	auto config = Config::get ();
+	const Config::ScriptRule *rule = config->findDefaultScript (
+		device->driver (), device->name (), device->serial ());
+	if (rule && rule->profile) {
+		Log::info () << "Apply profile to "
+			     << device->driver () << "/"
+			     << device->name () << "/"
+			     << device->serial () << std::endl;
+		device->setReaderThreadPolicy (rule->reader_thread);
+		try {
+			_profiles.emplace (device, std::make_unique<Profile::Instance> (rule->profile, device));
+		}
+		catch (std::exception &e) {
+			Log::error () << "Failed to apply profile: " << e.what () << std::endl;
+		}
+		return;
+	}
+	if (rule && !rule->group.empty ()) {
+		auto it = _groups.find (rule->group);
+		if (it == _groups.end ()) {
+			static int next_group = 0;
+			std::stringstream path;
+			path << DBusObjectPath << "/Group" << (next_group++);
+			Log::info () << "Add new group script " << path.str ()
+				     << " for " << rule->group << std::endl;
+			Group group;
+			group.group = std::make_unique<InputGroup> (rule->group);
+			group.script = std::make_unique<Script> (
+				_dbus_connection,
+				path.str (),
+				group.group.get (),
+				*rule
+			);
+			group.group->setThread (group.script.get ());
+			it = _groups.emplace (rule->group, std::move (group)).first;
+			publishScript (it->second.script.get ());
+			it->second.script->start ();
+		}
+		device->setReaderThreadPolicy (rule->reader_thread);
+		unsigned int id = it->second.group->addDevice (device);
+		_group_members.emplace (device, rule->group);
+		Log::info () << "Add device "
+			     << device->driver () << "/"
+			     << device->name () << "/"
+			     << device->serial ()
+			     << " to group " << rule->group
+			     << " with id " << id << std::endl;
+		return;
+	}
+
 	static int next_device = 0;
 	std::stringstream name;
 	name << "Device" << (next_device++);
@@ -89,18 +178,43 @@ void ScriptManager::addDevice (InputDevice *device)
 	}
 
 	Script *script = ret.first->second.get ();
-	InterfacesAdded (path.str (), getScriptProperties (script));
+	publishScript (script);
 	script->start ();
 }
 
 void ScriptManager::removeDevice (InputDevice *device)
 {
-	std::unique_lock<std::mutex> lock (_mutex);
+	std::unique_lock<std::recursive_mutex> lock (_mutex);
 	Log::info () << "Remove device script for "
 		     << device->driver () << "/"
 		     << device->name () << "/"
 		     << device->serial () << std::endl;
 
+	auto profile = _profiles.find (device);
+	if (profile != _profiles.end ()) {
+		_profiles.erase (profile);
+		return;
+	}
+
+	auto member = _group_members.find (device);
+	if (member != _group_members.end ()) {
+		auto it = _groups.find (member->second);
+		_group_members.erase (member);
+		if (it == _groups.end ())
+			return;
+		it->second.group->removeDevice (device);
+		if (!it->second.group->empty ())
+			return;
+		// Last member removed, terminate the group script
+		Script *script = it->second.script.get ();
+		DBus::Path path = script->path ();
+		std::string interface_name = script->Script_adaptor::introspect ()->name;
+		script->stop ();
+		_groups.erase (it);
+		unpublishScript (path, interface_name);
+		return;
+	}
+
 	auto it = _scripts.find (device);
 	if (it == _scripts.end ()) {
 		Log::error () << "Failed to remove unknown device." << std::endl;
@@ -113,17 +227,123 @@ void ScriptManager::removeDevice (InputDevice *device)
 
 	script->stop ();
 	_scripts.erase (it);
-
-	InterfacesRemoved (path, { interface_name });
+	unpublishScript (path, interface_name);
 }
 
 std::map<DBus::Path, std::map<std::string, std::map<std::string, DBus::Variant>>> ScriptManager::GetManagedObjects ()
 {
-	std::map<DBus::Path, std::map<std::string, std::map<std::string, DBus::Variant>>> objects;
+	std::unique_lock<std::recursive_mutex> lock (_mutex);
+	return _objects;
+}
+
+std::vector<DBus::Path> ScriptManager::SetFiles (const std::map<std::string, std::string> &match, const std::string &file)
+{
+	for (const auto &rule: match)
+		if (rule.first != "driver" && rule.first != "name" && rule.first != "serial")
+			throw DBus::ErrorInvalidArgs (("Unknown match key: " + rule.first).c_str ());
+
+	auto matches = [&match] (const std::string &driver, const std::string &name, const std::string &serial) {
+		for (const auto &rule: match) {
+			const std::string &value = rule.first == "driver" ? driver :
+						   rule.first == "name" ? name :
+						   serial;
+			if (rule.second != value)
+				return false;
+		}
+		return true;
+	};
+
+	std::unique_lock<std::recursive_mutex> lock (_mutex);
+	std::vector<DBus::Path> paths;
 	for (const auto &pair: _scripts) {
+		InputDevice *device = pair.first;
+		if (!matches (device->driver (), device->name (), device->serial ()))
+			continue;
 		Script *script = pair.second.get ();
-		objects.emplace (script->path (), getScriptProperties (script));
+		script->setFile (file);
+		paths.push_back (script->path ());
+	}
+	for (const auto &pair: _groups) {
+		// Group scripts use the same properties as their D-Bus objects
+		if (!matches ("group", pair.first, ""))
+			continue;
+		Script *script = pair.second.script.get ();
+		script->setFile (file);
+		paths.push_back (script->path ());
+	}
+	return paths;
+}
+
+void ScriptManager::StartTracing ()
+{
+	Log::info () << "Start tracing" << std::endl;
+	closeTrace ();
+	Trace::start ();
+}
+
+/**
+ * Directory for temporary files only readable by the daemon.
+ */
+static std::string privateTempDirectory ()
+{
+	for (const char *var: { "RUNTIME_DIRECTORY", "XDG_RUNTIME_DIR" }) {
+		const char *dir = getenv (var);
+		if (dir && dir[0] == '/')
+			return dir;
 	}
-	return objects;
+	return P_tmpdir;
 }
 
+uint64_t ScriptManager::StopTracing ()
+{
+	Log::info () << "Stop tracing" << std::endl;
+	closeTrace ();
+	// Traces can be larger than the maximum D-Bus message size, they are
+	// written to a private file that is unlinked at once and read back
+	// with ReadTrace.
+	std::string path = privateTempDirectory () + "/input-scripts-trace-XXXXXX";
+	int fd = mkstemp (&path[0]);
+	if (fd == -1) {
+		std::ostream null (nullptr);
+		Trace::stop (null);
+		throw DBus::ErrorFailed ("Cannot create trace file");
+	}
+	std::ofstream file (path);
+	unlink (path.c_str ());
+	Trace::stop (file);
+	file.close ();
+	struct stat st;
+	if (!file || -1 == fstat (fd, &st)) {
+		close (fd);
+		throw DBus::ErrorFailed ("Cannot write trace file");
+	}
+	_trace_fd = fd;
+	return st.st_size;
+}
+
+std::vector<uint8_t> ScriptManager::ReadTrace (const uint64_t &offset, const uint32_t &length)
+{
+	// Keep replies well below the D-Bus message size limit
+	static constexpr uint32_t MaxChunkSize = 1 << 20;
+	if (_trace_fd == -1)
+		throw DBus::ErrorFailed ("No trace to read");
+	std::vector<uint8_t> data (std::min (length, MaxChunkSize));
+	ssize_t ret = pread (_trace_fd, data.data (), data.size (), offset);
+	if (ret == -1) {
+		closeTrace ();
+		throw DBus::ErrorFailed ("Cannot read trace file");
+	}
+	data.resize (ret);
+	// Reading past the end means the client is done
+	if (data.empty ())
+		closeTrace ();
+	return data;
+}
+
+void ScriptManager::closeTrace ()
+{
+	if (_trace_fd != -1) {
+		close (_trace_fd);
+		_trace_fd = -1;
+	}
+}
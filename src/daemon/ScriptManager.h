@@ -23,12 +23,16 @@
 #include <memory>
 #include <condition_variable>
 #include "dbus/ObjectManagerInterfaceAdaptor.h"
+#include "dbus/ScriptManagerInterfaceAdaptor.h"
+#include "Profile.h"
 
 class InputDevice;
+class InputGroup;
 class Script;
 
 class ScriptManager:
 	public org::freedesktop::DBus::ObjectManager_adaptor,
+	public com::github::cvuchener::InputScripts::ScriptManager_adaptor,
 	public DBus::IntrospectableAdaptor,
 	public DBus::ObjectAdaptor
 {
@@ -40,12 +44,36 @@ public:
 	void removeDevice (InputDevice *);
 
 	virtual std::map<DBus::Path, std::map<std::string, std::map<std::string, DBus::Variant>>> GetManagedObjects ();
+	virtual std::vector<DBus::Path> SetFiles (const std::map<std::string, std::string> &match, const std::string &file);
+	virtual void StartTracing ();
+	virtual uint64_t StopTracing ();
+	virtual std::vector<uint8_t> ReadTrace (const uint64_t &offset, const uint32_t &length);
 	static constexpr char DBusObjectPath[] = "/com/github/cvuchener/InputScripts/ScriptManager";
 
 private:
+	void publishScript (Script *script);
+	void unpublishScript (const DBus::Path &path, const std::string &interface_name);
+	void closeTrace ();
+
 	DBus::Connection &_dbus_connection;
-	std::mutex _mutex;
+	// Recursive since changing script files updates the property snapshots
+	std::recursive_mutex _mutex;
 	std::map<InputDevice *, std::unique_ptr<Script>> _scripts;
+	// Devices handled by native profiles, without script
+	std::map<InputDevice *, std::unique_ptr<Profile::Instance>> _profiles;
+	struct Group
+	{
+		std::unique_ptr<InputGroup> group;
+		std::unique_ptr<Script> script; // destroyed before the group
+	};
+	// Group scripts by group name
+	std::map<std::string, Group> _groups;
+	std::map<InputDevice *, std::string> _group_members;
+	// Properties of managed objects, updated when scripts are added,
+	// removed or change their properties
+	std::map<DBus::Path, std::map<std::string, std::map<std::string, DBus::Variant>>> _objects;
+	// Unlinked file containing the last stopped trace, until it is read
+	int _trace_fd;
 };
 
 #endif
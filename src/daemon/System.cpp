@@ -19,6 +19,7 @@
 #include "System.h"
 
 #include "Log.h"
+#include "Trace.h"
 #include "jstpl/Thread.h"
 
 extern "C" {
@@ -44,7 +45,10 @@ void System::setTimeout (std::function<void ()> callback, unsigned int delay)
 	lock.unlock ();
 
 	it->start ([this, callback, it] () {
-		callback ();
+		{
+			Trace::Span span ("timer", "timer fire");
+			callback ();
+		}
 		// The timer must be deleted asynchronously since the
 		// destructor will wait for this call to end. And it must
 		// be deleted on the JS thread since it may contains some
@@ -152,7 +156,7 @@ bool System::print (JSContext *cx, JS::CallArgs &args)
 	Log log = Log::info ();
 	for (unsigned int i = 0; i < args.length (); ++i) {
 		if (i != 0)
-			Log::info () << ", ";
+			log << ", ";
 		log << toString (cx, args.get (i));
 	}
 	log << std::endl;
@@ -217,7 +221,7 @@ bool System::print_r (JSContext *cx, JS::CallArgs &args)
 {
 	Log log = Log::info ();
 	for (unsigned int i = 0; i < args.length (); ++i) {
-		print_r_impl (log, cx, args.get (i));
+		print_r_impl (log.stream (), cx, args.get (i));
 		log << std::endl;
 	}
 	args.rval ().setNull ();
@@ -0,0 +1,140 @@
+/*
+ * Copyright 2017 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ThreadPolicy.h"
+
+#include <sstream>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include "Log.h"
+
+extern "C" {
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+}
+
+std::string ThreadPolicy::apply (const char *name) const
+{
+	int ret;
+	pthread_t self = pthread_self ();
+
+	std::string short_name (name, 0, 15);
+	if (0 != (ret = pthread_setname_np (self, short_name.c_str ())))
+		Log::warning () << "Failed to set thread name " << short_name
+				<< ": " << strerror (ret) << std::endl;
+
+	if (!cpus.empty ()) {
+		cpu_set_t set;
+		CPU_ZERO (&set);
+		for (int cpu: cpus)
+			if (cpu >= 0 && cpu < CPU_SETSIZE)
+				CPU_SET (cpu, &set);
+		if (0 != (ret = pthread_setaffinity_np (self, sizeof (set), &set)))
+			Log::warning () << "Failed to set CPU affinity of " << name
+					<< ": " << strerror (ret) << std::endl;
+	}
+
+	if (scheduler != Inherit) {
+		int policy;
+		sched_param param = { 0 };
+		switch (scheduler) {
+		case FIFO:
+			policy = SCHED_FIFO;
+			param.sched_priority = priority;
+			break;
+		case RR:
+			policy = SCHED_RR;
+			param.sched_priority = priority;
+			break;
+		default:
+			policy = SCHED_OTHER;
+		}
+		if (0 != (ret = pthread_setschedparam (self, policy, &param)))
+			Log::warning () << "Failed to set scheduler of " << name
+					<< ": " << strerror (ret) << std::endl;
+	}
+
+	if (has_nice) {
+		// On Linux, nice values are per-thread when using the thread id
+		pid_t tid = syscall (SYS_gettid);
+		if (-1 == setpriority (PRIO_PROCESS, tid, nice))
+			Log::warning () << "Failed to set nice value of " << name
+					<< ": " << strerror (errno) << std::endl;
+	}
+
+	return describeCurrent ();
+}
+
+ThreadPolicy::Scheduler ThreadPolicy::parseScheduler (const std::string &name)
+{
+	if (name == "other")
+		return Other;
+	if (name == "fifo")
+		return FIFO;
+	if (name == "rr")
+		return RR;
+	throw std::invalid_argument ("unknown scheduler " + name);
+}
+
+std::string ThreadPolicy::describeCurrent ()
+{
+	std::stringstream ss;
+	pthread_t self = pthread_self ();
+
+	char name[16];
+	if (0 == pthread_getname_np (self, name, sizeof (name)))
+		ss << name << ": ";
+
+	int policy;
+	sched_param param;
+	if (0 == pthread_getschedparam (self, &policy, &param)) {
+		switch (policy) {
+		case SCHED_FIFO:
+			ss << "fifo:" << param.sched_priority;
+			break;
+		case SCHED_RR:
+			ss << "rr:" << param.sched_priority;
+			break;
+		default:
+			ss << "other";
+		}
+	}
+
+	errno = 0;
+	int nice = getpriority (PRIO_PROCESS, syscall (SYS_gettid));
+	if (errno == 0)
+		ss << " nice:" << nice;
+
+	cpu_set_t set;
+	if (0 == pthread_getaffinity_np (self, sizeof (set), &set)) {
+		ss << " cpus:";
+		bool first = true;
+		for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+			if (CPU_ISSET (cpu, &set)) {
+				if (!first)
+					ss << ",";
+				ss << cpu;
+				first = false;
+			}
+	}
+	return ss.str ();
+}
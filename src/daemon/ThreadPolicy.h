@@ -0,0 +1,73 @@
+/*
+ * Copyright 2017 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef THREAD_POLICY_H
+#define THREAD_POLICY_H
+
+#include <string>
+#include <vector>
+
+/**
+ * Scheduling settings for a thread: CPU affinity, scheduling policy
+ * and nice value.
+ *
+ * Default values leave the thread as created.
+ */
+struct ThreadPolicy
+{
+	enum Scheduler {
+		Inherit,
+		Other,
+		FIFO,
+		RR,
+	};
+
+	/** CPUs the thread may run on (any CPU when empty). */
+	std::vector<int> cpus;
+	Scheduler scheduler = Inherit;
+	/** Real-time priority for FIFO and RR schedulers. */
+	int priority = 0;
+	bool has_nice = false;
+	int nice = 0;
+
+	/**
+	 * Apply the settings to the calling thread and name it \p name
+	 * (truncated to 15 characters).
+	 *
+	 * Failures (e.g. missing CAP_SYS_NICE for real-time schedulers)
+	 * are logged and the remaining settings are still applied.
+	 *
+	 * \returns the description of the resulting thread state.
+	 */
+	std::string apply (const char *name) const;
+
+	/**
+	 * Parse scheduler names: "other", "fifo" or "rr".
+	 *
+	 * \throws std::invalid_argument for unknown names.
+	 */
+	static Scheduler parseScheduler (const std::string &name);
+
+	/**
+	 * Describe the actual affinity, scheduler and nice value of
+	 * the calling thread.
+	 */
+	static std::string describeCurrent ();
+};
+
+#endif
@@ -0,0 +1,152 @@
+/*
+ * Copyright 2017 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "Trace.h"
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <iomanip>
+
+extern "C" {
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+}
+
+namespace
+{
+
+struct TraceEvent
+{
+	const char *category;
+	const char *name;
+	Trace::clock::time_point begin, end;
+};
+
+struct ThreadBuffer
+{
+	pid_t tid;
+	std::string thread_name;
+	std::mutex mutex;
+	std::vector<TraceEvent> events;
+};
+
+// Limit memory used by a forgotten trace
+constexpr std::size_t MaxEventsPerThread = 1 << 20;
+
+std::mutex buffers_mutex;
+std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+Trace::clock::time_point trace_start;
+
+std::shared_ptr<ThreadBuffer> addThreadBuffer ()
+{
+	auto buffer = std::make_shared<ThreadBuffer> ();
+	buffer->tid = syscall (SYS_gettid);
+	char name[16];
+	if (0 == pthread_getname_np (pthread_self (), name, sizeof (name)))
+		buffer->thread_name = name;
+	std::unique_lock<std::mutex> lock (buffers_mutex);
+	buffers.push_back (buffer);
+	return buffer;
+}
+
+void writeString (std::ostream &out, const std::string &str)
+{
+	out << '"';
+	for (char c: str) {
+		if (c == '"' || c == '\\')
+			out << '\\' << c;
+		else if (static_cast<unsigned char> (c) < 0x20)
+			out << "\\u" << std::hex << std::setw (4) << std::setfill ('0')
+			    << static_cast<unsigned int> (c) << std::dec;
+		else
+			out << c;
+	}
+	out << '"';
+}
+
+}
+
+std::atomic<bool> Trace::_enabled (false);
+
+void Trace::start ()
+{
+	std::unique_lock<std::mutex> lock (buffers_mutex);
+	for (auto &buffer: buffers) {
+		std::unique_lock<std::mutex> buffer_lock (buffer->mutex);
+		buffer->events.clear ();
+	}
+	trace_start = clock::now ();
+	_enabled = true;
+}
+
+void Trace::stop (std::ostream &out)
+{
+	_enabled = false;
+
+	out << std::fixed << std::setprecision (3);
+	out << "{\"traceEvents\":[";
+	bool first = true;
+	auto separator = [&out, &first] () {
+		if (!first)
+			out << ",";
+		first = false;
+	};
+	pid_t pid = getpid ();
+	std::unique_lock<std::mutex> lock (buffers_mutex);
+	for (auto &buffer: buffers) {
+		std::unique_lock<std::mutex> buffer_lock (buffer->mutex);
+		if (buffer->events.empty ())
+			continue;
+		separator ();
+		out << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":" << pid
+		    << ",\"tid\":" << buffer->tid << ",\"args\":{\"name\":";
+		writeString (out, buffer->thread_name);
+		out << "}}";
+		for (const auto &event: buffer->events) {
+			using us = std::chrono::duration<double, std::micro>;
+			separator ();
+			out << "{\"ph\":\"X\",\"cat\":\"" << event.category
+			    << "\",\"name\":\"" << event.name
+			    << "\",\"pid\":" << pid
+			    << ",\"tid\":" << buffer->tid
+			    << ",\"ts\":" << us (event.begin - trace_start).count ()
+			    << ",\"dur\":" << us (event.end - event.begin).count ()
+			    << "}";
+		}
+		buffer->events.clear ();
+		buffer->events.shrink_to_fit ();
+	}
+	// Forget terminated threads
+	buffers.erase (std::remove_if (buffers.begin (), buffers.end (), [] (const auto &buffer) {
+		return buffer.use_count () == 1;
+	}), buffers.end ());
+	out << "],\"displayTimeUnit\":\"ms\"}";
+}
+
+void Trace::record (const char *category, const char *name, clock::time_point begin, clock::time_point end)
+{
+	thread_local std::shared_ptr<ThreadBuffer> buffer = addThreadBuffer ();
+	std::unique_lock<std::mutex> lock (buffer->mutex);
+	if (buffer->events.size () >= MaxEventsPerThread)
+		return;
+	buffer->events.push_back ({ category, name, begin, end });
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright 2017 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <ostream>
+
+/**
+ * Timeline tracing of the event pipeline.
+ *
+ * When tracing is started, spans are recorded in per-thread buffers.
+ * Stopping writes them in the Trace Event JSON format that can be loaded
+ * in chrome://tracing or Perfetto UI.
+ *
+ * When tracing is disabled, a span costs a single relaxed atomic load.
+ */
+class Trace
+{
+public:
+	typedef std::chrono::steady_clock clock;
+
+	static inline bool enabled ()
+	{
+		return _enabled.load (std::memory_order_relaxed);
+	}
+
+	/**
+	 * Clear previous records and start tracing.
+	 */
+	static void start ();
+	/**
+	 * Stop tracing and write the recorded events as trace event JSON
+	 * to \p out.
+	 */
+	static void stop (std::ostream &out);
+
+	/**
+	 * Record a span from \p begin to \p end on the current thread.
+	 *
+	 * \p category and \p name must be static strings.
+	 */
+	static void record (const char *category, const char *name, clock::time_point begin, clock::time_point end);
+
+	/**
+	 * Record a span for the lifetime of this object.
+	 */
+	class Span
+	{
+	public:
+		inline Span (const char *category, const char *name):
+			_name (enabled () ? name : nullptr)
+		{
+			if (_name) {
+				_category = category;
+				_begin = clock::now ();
+			}
+		}
+
+		inline ~Span ()
+		{
+			if (_name)
+				record (_category, _name, _begin, clock::now ());
+		}
+
+		Span (const Span &) = delete;
+
+	private:
+		const char *_name;
+		const char *_category;
+		clock::time_point _begin;
+	};
+
+private:
+	static std::atomic<bool> _enabled;
+};
+
+#endif
@@ -19,37 +19,98 @@
 #include "DBusProxy.h"
 
 #include "../DBusConnections.h"
+#include "../Log.h"
+#include "../Trace.h"
+
+#include <cstring>
+
+#include <dbus/dbus.h>
+
+/*
+ * The filter only keeps a weak reference to the state, so that the filter
+ * slot stored in the state does not keep it alive.
+ */
+class DBusProxy::SignalFilter: public DBus::Callback_Base<bool, const DBus::Message &>
+{
+public:
+	SignalFilter (const std::shared_ptr<AsyncState> &state):
+		_state (state)
+	{
+	}
+
+	bool call (const DBus::Message &message) const
+	{
+		std::shared_ptr<AsyncState> state = _state.lock ();
+		if (!state)
+			return false;
+		return filterSignal (state, message);
+	}
+
+private:
+	std::weak_ptr<AsyncState> _state;
+};
 
 DBusProxy::DBusProxy (int bus, std::string service, std::string path, std::string interface):
 	DBus::InterfaceProxy (interface),
-	DBus::ObjectProxy (DBusConnections::getBus (static_cast<DBusConnections::Bus> (bus)), path, service.c_str ())
+	DBus::ObjectProxy (DBusConnections::getBus (static_cast<DBusConnections::Bus> (bus)), path, service.c_str ()),
+	_async (std::make_shared<AsyncState> ()),
+	_next_call_id (0),
+	_filter_added (false)
 {
+	_async->thread = nullptr;
+	_async->proxy = this;
+	_async->service = service;
+	_async->path = path;
+	_async->filter = new SignalFilter (_async);
 }
 
 DBusProxy::~DBusProxy ()
 {
+	if (_filter_added) {
+		conn ().remove_filter (_async->filter);
+		if (service ()[0] != ':')
+			conn ().remove_match (ownerMatchRule (service ()).c_str (), false);
+	}
+	for (const auto &p: _signals)
+		conn ().remove_match (matchRule (service (), path (), p.first.first, p.first.second).c_str (), false);
+	std::map<unsigned int, DBus::PendingCall> calls;
+	{
+		std::unique_lock<std::mutex> lock (_async->mutex);
+		_async->thread = nullptr;
+		_async->proxy = nullptr;
+		calls.swap (_async->calls);
+	}
+	for (auto &p: calls)
+		p.second.cancel ();
 }
 
-static const char *getSignatureEnd (const char *signature)
+const char *DBusProxy::compileSignature (const char *signature, Signature &compiled)
 {
+	const char *end;
+	compiled.type = signature[0];
+	compiled.children.clear ();
 	switch (signature[0]) {
 	case '(': {
 		const char *current = signature+1;
 		while (*current != ')') {
 			if (*current == '\0')
 				throw std::invalid_argument ("Missing matching ) in signature");
-			current = getSignatureEnd (current);
+			compiled.children.emplace_back ();
+			current = compileSignature (current, compiled.children.back ());
 		}
-		return current+1;
+		end = current+1;
+		break;
 	}
 
 	case '{': {
 		const char *current = signature+1;
+		compiled.children.resize (2);
 		for (unsigned int i = 0; i < 2; ++i)
-			current = getSignatureEnd (current);
+			current = compileSignature (current, compiled.children[i]);
 		if (*current != '}')
 			throw std::invalid_argument ("Missing matching } in signature");
-		return current+1;
+		end = current+1;
+		break;
 	}
 
 	case 'y':
@@ -66,14 +127,32 @@ static const char *getSignatureEnd (const char *signature)
 	case 'o':
 	case 'g':
 	case 'v':
-		return signature+1;
+		end = signature+1;
+		break;
 
 	case 'a':
-		return getSignatureEnd (signature+1);
+		compiled.children.resize (1);
+		end = compileSignature (signature+1, compiled.children[0]);
+		break;
 
 	default:
 		throw std::invalid_argument ("Type signature not supported");
 	}
+	compiled.signature.assign (signature, end);
+	return end;
+}
+
+std::shared_ptr<const DBusProxy::Signature> DBusProxy::getVariantSignature (const std::string &signature)
+{
+	auto it = _variant_signatures.find (signature);
+	if (it != _variant_signatures.end ())
+		return it->second;
+	auto compiled = std::make_shared<Signature> ();
+	if (*compileSignature (signature.c_str (), *compiled) != '\0')
+		throw std::invalid_argument ("Variant signature contains more than one type");
+	if (_variant_signatures.size () >= MaxCachedSignatures)
+		_variant_signatures.clear ();
+	return _variant_signatures.emplace (signature, std::move (compiled)).first->second;
 }
 
 template <typename T, typename T2 = T>
@@ -84,72 +163,75 @@ static inline void writeBasicType (JSContext *cx, DBus::MessageIter &iter, JS::H
 	iter << static_cast<T2> (var);
 }
 
-static const char *writeValue (JSContext *cx, DBus::MessageIter &iter, const char *signature, JS::HandleValue value)
+void DBusProxy::writeValue (JSContext *cx, DBus::MessageIter &iter, const Signature &signature, JS::HandleValue value)
 {
 	using jstpl::readJSValue;
 
-	switch (signature[0]) {
+	switch (signature.type) {
 	case 'y':
 		writeBasicType<uint8_t> (cx, iter, value);
-		return signature+1;
+		return;
 	case 'b':
 		writeBasicType<bool> (cx, iter, value);
-		return signature+1;
+		return;
 	case 'n':
 		writeBasicType<int16_t> (cx, iter, value);
-		return signature+1;
+		return;
 	case 'q':
 		writeBasicType<uint16_t> (cx, iter, value);
-		return signature+1;
+		return;
 	case 'i':
 		writeBasicType<int32_t> (cx, iter, value);
-		return signature+1;
+		return;
 	case 'u':
 		writeBasicType<uint32_t> (cx, iter, value);
-		return signature+1;
+		return;
 	case 'x':
 		writeBasicType<int64_t> (cx, iter, value);
-		return signature+1;
+		return;
 	case 't':
 		writeBasicType<uint64_t> (cx, iter, value);
-		return signature+1;
+		return;
 	case 'd':
 		writeBasicType<double> (cx, iter, value);
-		return signature+1;
+		return;
 	case 'h':
 		throw std::invalid_argument ("Unix file descriptor not supported");
 	case 's':
 		writeBasicType<std::string> (cx, iter, value);
-		return signature+1;
+		return;
 	case 'o':
 		writeBasicType<std::string, DBus::Path> (cx, iter, value);
-		return signature+1;
+		return;
 	case 'g':
 		writeBasicType<std::string, DBus::Signature> (cx, iter, value);
-		return signature+1;
+		return;
 	case 'a': {
-		const char *end = getSignatureEnd (signature+1);
-		std::string sig = std::string (signature+1, end);
-		DBus::MessageIter array_iter = iter.new_array (sig.c_str ());
-		if (signature[1] == '{') {
+		const Signature &element = signature.children[0];
+		DBus::MessageIter array_iter = iter.new_array (element.signature.c_str ());
+		if (element.type == '{') {
 			// Dictionary
-			std::string key_sig = std::string (signature+2, signature+3);
-			std::string value_sig = std::string (signature+3, end-1);
 			if (!value.isObject ())
 				throw std::invalid_argument ("Dict signature expects an object");
 			JS::RootedObject obj (cx, value.toObjectOrNull ());
 			JSIdArray *ids = JS_Enumerate (cx, obj);
 			unsigned int len = JS_IdArrayLength (cx, ids);
-			for (unsigned int i = 0; i < len; ++i) {
-				JS::RootedId id (cx, JS_IdArrayGet (cx, ids, i));
-				JS::RootedValue key (cx);
-				JS_IdToValue (cx, id, &key);
-				JS::RootedValue prop (cx);
-				JS_GetPropertyById (cx, obj, id, &prop);
-				DBus::MessageIter dict_entry = array_iter.new_dict_entry ();
-				writeValue (cx, dict_entry, key_sig.c_str (), key);
-				writeValue (cx, dict_entry, value_sig.c_str (), prop);
-				array_iter.close_container (dict_entry);
+			JS::RootedId id (cx);
+			JS::RootedValue key (cx), prop (cx);
+			try {
+				for (unsigned int i = 0; i < len; ++i) {
+					id = JS_IdArrayGet (cx, ids, i);
+					JS_IdToValue (cx, id, &key);
+					JS_GetPropertyById (cx, obj, id, &prop);
+					DBus::MessageIter dict_entry = array_iter.new_dict_entry ();
+					writeValue (cx, dict_entry, element.children[0], key);
+					writeValue (cx, dict_entry, element.children[1], prop);
+					array_iter.close_container (dict_entry);
+				}
+			}
+			catch (...) {
+				JS_DestroyIdArray (cx, ids);
+				throw;
 			}
 			JS_DestroyIdArray (cx, ids);
 		}
@@ -160,37 +242,32 @@ static const char *writeValue (JSContext *cx, DBus::MessageIter &iter, const cha
 			JS::RootedObject array (cx, value.toObjectOrNull ());
 			unsigned int len;
 			JS_GetArrayLength (cx, array, &len);
+			JS::RootedValue elem (cx);
 			for (unsigned int i = 0; i < len; ++i) {
-				JS::RootedValue elem (cx);
 				JS_GetElement (cx, array, i, &elem);
-				writeValue (cx, array_iter, signature+1, elem);
+				writeValue (cx, array_iter, element, elem);
 			}
 		}
 		iter.close_container (array_iter);
-		return end;
+		return;
 	}
 	case '(': {
 		// Struct
-		const char *current = signature+1;
-		unsigned int i = 0;
 		if (!JS_IsArrayObject (cx, value))
 			throw std::invalid_argument ("Struct signature expects an array");
 		JS::RootedObject array (cx, value.toObjectOrNull ());
 		unsigned int len;
 		JS_GetArrayLength (cx, array, &len);
+		if (len < signature.children.size ())
+			throw std::invalid_argument ("Array too short");
 		DBus::MessageIter struct_iter = iter.new_struct ();
-		while (*current != ')') {
-			if (*current == '\0')
-				throw std::invalid_argument ("Missing matching ) in signature");
-			if (i >= len)
-				throw std::invalid_argument ("Array too short");
-			JS::RootedValue elem (cx);
+		JS::RootedValue elem (cx);
+		for (unsigned int i = 0; i < signature.children.size (); ++i) {
 			JS_GetElement (cx, array, i, &elem);
-			current = writeValue (cx, struct_iter, current, elem);
-			++i;
+			writeValue (cx, struct_iter, signature.children[i], elem);
 		}
 		iter.close_container (struct_iter);
-		return current+1;
+		return;
 	}
 	case 'v': {
 		// Variant
@@ -206,10 +283,12 @@ static const char *writeValue (JSContext *cx, DBus::MessageIter &iter, const cha
 		JS_GetElement (cx, array, 1, &variant_value);
 		std::string sig;
 		readJSValue (cx, sig, sig_value);
-		DBus::MessageIter variant_iter = iter.new_variant (sig.c_str ());
-		writeValue (cx, variant_iter, sig.c_str (), variant_value);
+		// Nested variants may clear the cache, keep a reference
+		std::shared_ptr<const Signature> variant_sig = getVariantSignature (sig);
+		DBus::MessageIter variant_iter = iter.new_variant (variant_sig->signature.c_str ());
+		writeValue (cx, variant_iter, *variant_sig, variant_value);
 		iter.close_container (variant_iter);
-		return signature+1;
+		return;
 	}
 
 	default:
@@ -218,117 +297,101 @@ static const char *writeValue (JSContext *cx, DBus::MessageIter &iter, const cha
 }
 
 template <typename T, typename T2 = T>
-static inline void readBasicType (JSContext *cx, JS::MutableHandleValue value, DBus::MessageIter &iter)
+static inline void readBasicType (std::variant<int32_t, double, std::string> &value, DBus::MessageIter &iter)
 {
-	using jstpl::setJSValue;
-
 	T var;
 	iter >> var;
-	setJSValue (cx, value, static_cast<T2> (var));
+	value = static_cast<T2> (var);
 }
 
-static void readValue (JSContext *cx, JS::MutableHandleValue value, DBus::MessageIter &iter)
+void DBusProxy::decodeValue (DBus::MessageIter &iter, Value &value)
 {
-	using jstpl::setJSValue;
-
 	const char *signature = iter.signature ();
+	value.kind = Value::Basic;
 	switch (signature[0]) {
+	// Integers are converted as JS int32 values, as setJSValue does
 	case 'y':
-		readBasicType<uint8_t> (cx, value, iter);
+		readBasicType<uint8_t, int32_t> (value.basic, iter);
 		return;
 	case 'b':
-		readBasicType<bool> (cx, value, iter);
+		readBasicType<bool, int32_t> (value.basic, iter);
 		return;
 	case 'n':
-		readBasicType<int16_t> (cx, value, iter);
+		readBasicType<int16_t, int32_t> (value.basic, iter);
 		return;
 	case 'q':
-		readBasicType<uint16_t> (cx, value, iter);
+		readBasicType<uint16_t, int32_t> (value.basic, iter);
 		return;
 	case 'i':
-		readBasicType<int32_t> (cx, value, iter);
+		readBasicType<int32_t> (value.basic, iter);
 		return;
 	case 'u':
-		readBasicType<uint32_t> (cx, value, iter);
+		readBasicType<uint32_t, int32_t> (value.basic, iter);
 		return;
 	case 'x':
-		readBasicType<int64_t> (cx, value, iter);
+		readBasicType<int64_t, int32_t> (value.basic, iter);
 		return;
 	case 't':
-		readBasicType<uint64_t> (cx, value, iter);
+		readBasicType<uint64_t, int32_t> (value.basic, iter);
 		return;
 	case 'd':
-		readBasicType<double> (cx, value, iter);
+		readBasicType<double> (value.basic, iter);
 		return;
 	case 'h':
 		throw std::invalid_argument ("Unix file descriptor not supported");
 	case 's':
-		readBasicType<std::string> (cx, value, iter);
+		readBasicType<std::string> (value.basic, iter);
 		return;
 	case 'o':
-		readBasicType<DBus::Path, std::string> (cx, value, iter);
+		readBasicType<DBus::Path, std::string> (value.basic, iter);
 		return;
 	case 'g':
-		readBasicType<DBus::Signature, std::string> (cx, value, iter);
+		readBasicType<DBus::Signature, std::string> (value.basic, iter);
 		return;
 	case 'a': {
 		DBus::MessageIter array_iter = iter.recurse ();
 		if (signature[1] == '{') {
 			// Dictionary
-			JS::RootedObject obj (cx, JS_NewObject (cx, nullptr));
+			value.kind = Value::Dict;
 			while (!array_iter.at_end ()) {
 				DBus::MessageIter dict_entry = array_iter.recurse ();
-				JS::RootedValue value (cx);
-				std::string key;
-				dict_entry >> key;
-				readValue (cx, &value, dict_entry);
-				JS_SetProperty (cx, obj, key.c_str (), value);
+				value.children.emplace_back ();
+				readBasicType<std::string> (value.children.back ().basic, dict_entry);
+				value.children.emplace_back ();
+				decodeValue (dict_entry, value.children.back ());
 				++array_iter;
 			}
-			value.setObject (*obj);
-
 		}
 		else {
 			// Array
-			JS::RootedObject array (cx, JS_NewArrayObject (cx, 0));
-			unsigned int i = 0;
+			value.kind = Value::Array;
 			while (!array_iter.at_end ()) {
-				JS::RootedValue elem (cx);
-				readValue (cx, &elem, array_iter);
-				JS_SetElement (cx, array, i, elem);
-				++i;
+				value.children.emplace_back ();
+				decodeValue (array_iter, value.children.back ());
 				++array_iter;
 			}
-			value.setObject (*array);
 		}
 		return;
 	}
 	case '(': {
 		// Struct
-		JS::RootedObject array (cx, JS_NewArrayObject (cx, 0));
-		unsigned int i = 0;
+		value.kind = Value::Array;
 		DBus::MessageIter struct_iter = iter.recurse ();
 		while (!struct_iter.at_end ()) {
-			JS::RootedValue elem (cx);
-			readValue (cx, &elem, struct_iter);
-			JS_SetElement (cx, array, i, elem);
-			++i;
+			value.children.emplace_back ();
+			decodeValue (struct_iter, value.children.back ());
 			++struct_iter;
 		}
-		value.setObject (*array);
 		return;
 	}
 	case 'v': {
 		// Variant
-		JS::RootedObject array (cx, JS_NewArrayObject (cx, 0));
+		value.kind = Value::Array;
 		DBus::MessageIter variant_iter = iter.recurse ();
-		JS::RootedValue sig_value (cx), variant_value (cx);
-		std::string sig = variant_iter.signature ();
-		setJSValue (cx, &sig_value, sig);
-		readValue (cx, &variant_value, variant_iter);
-		JS_SetElement (cx, array, 0, sig_value);
-		JS_SetElement (cx, array, 1, variant_value);
-		value.setObject (*array);
+		value.children.resize (2);
+		value.children[0].kind = Value::Basic;
+		value.children[0].basic = std::string (variant_iter.signature ());
+		decodeValue (variant_iter, value.children[1]);
 		return;
 	}
 
@@ -337,51 +400,143 @@ static void readValue (JSContext *cx, JS::MutableHandleValue value, DBus::Messag
 	}
 }
 
-bool DBusProxy::call (JSContext *cx, JS::CallArgs &args)
+void DBusProxy::decodeMessage (const DBus::Message &message, std::vector<Value> &values)
+{
+	DBus::MessageIter ri = message.reader ();
+	while (!ri.at_end ()) {
+		values.emplace_back ();
+		try {
+			decodeValue (ri, values.back ());
+		}
+		catch (std::invalid_argument e) {
+			Log::warning () << "Error while reading DBus argument " << values.size ()-1 << ": " << e.what () << std::endl;
+			values.back ().kind = Value::Undefined;
+			values.back ().children.clear ();
+		}
+		++ri;
+	}
+}
+
+void DBusProxy::toJSValue (JSContext *cx, JS::MutableHandleValue var, const Value &value)
+{
+	switch (value.kind) {
+	case Value::Undefined:
+		var.setUndefined ();
+		return;
+	case Value::Basic:
+		std::visit ([cx, var] (const auto &basic) {
+			jstpl::setJSValue (cx, var, basic);
+		}, value.basic);
+		return;
+	case Value::Array: {
+		JS::RootedObject array (cx, JS_NewArrayObject (cx, value.children.size ()));
+		JS::RootedValue elem (cx);
+		for (unsigned int i = 0; i < value.children.size (); ++i) {
+			toJSValue (cx, &elem, value.children[i]);
+			JS_SetElement (cx, array, i, elem);
+		}
+		var.setObject (*array);
+		return;
+	}
+	case Value::Dict: {
+		JS::RootedObject obj (cx, JS_NewObject (cx, nullptr));
+		JS::RootedValue prop (cx);
+		for (unsigned int i = 0; i+1 < value.children.size (); i += 2) {
+			const std::string &key = std::get<std::string> (value.children[i].basic);
+			toJSValue (cx, &prop, value.children[i+1]);
+			JS_SetProperty (cx, obj, key.c_str (), prop);
+		}
+		var.setObject (*obj);
+		return;
+	}
+	}
+}
+
+bool DBusProxy::writeArguments (JSContext *cx, JS::CallArgs &args, unsigned int first, DBus::CallMessage &m)
 {
 	using jstpl::readJSValue;
 
 	std::string interface, method;
 	try {
-		readJSValue (cx, interface, args[0]);
+		readJSValue (cx, interface, args[first]);
 	}
 	catch (std::invalid_argument e) {
 		JS_ReportError (cx, "Invalid interface argument: %s", e.what ());
 		return false;
 	}
 	try {
-		readJSValue (cx, method, args[1]);
+		readJSValue (cx, method, args[first+1]);
 	}
 	catch (std::invalid_argument e) {
 		JS_ReportError (cx, "Invalid method argument: %s", e.what ());
 		return false;
 	}
 
-	DBus::CallMessage m;
-	m.interface (interface.c_str ());
-	m.member (method.c_str ());
-	DBus::MessageIter wi = m.writer ();
-	for (unsigned int i = 2; i < args.length (); i+=2) {
-		if (i+1 >= args.length ())
+	unsigned int argc = 0;
+	if (args.length () > first+2) {
+		if ((args.length ()-first) % 2 != 0)
 			throw std::invalid_argument ("Missing value");
-		std::string sig;
-		try {
-			readJSValue (cx, sig, args[i]);
-			if (*getSignatureEnd (sig.c_str ()) != '\0')
-				throw std::invalid_argument ("Signature contains more than one type");
+		argc = (args.length ()-first-2)/2;
+	}
+	auto key = std::make_pair (std::move (interface), std::move (method));
+	auto it = _call_signatures.find (key);
+	// Scripts usually pass the same signatures for a method, compare
+	// them with the cached strings without converting them.
+	bool cached = it != _call_signatures.end () && it->second.strings.size () == argc;
+	for (unsigned int i = 0; cached && i < argc; ++i) {
+		const JS::Value &sig = args[first+2+2*i];
+		bool match;
+		if (!sig.isString () ||
+		    !JS_StringEqualsAscii (cx, sig.toString (), it->second.strings[i].c_str (), &match))
+			cached = false;
+		else
+			cached = match;
+	}
+	if (!cached) {
+		MethodSignatures signatures;
+		signatures.strings.resize (argc);
+		signatures.compiled.resize (argc);
+		for (unsigned int i = 0; i < argc; ++i) {
+			try {
+				readJSValue (cx, signatures.strings[i], args[first+2+2*i]);
+				if (*compileSignature (signatures.strings[i].c_str (), signatures.compiled[i]) != '\0')
+					throw std::invalid_argument ("Signature contains more than one type");
+			}
+			catch (std::invalid_argument e) {
+				JS_ReportError (cx, "Invalid signature for argument %d: %s", i, e.what ());
+				return false;
+			}
 		}
-		catch (std::invalid_argument e) {
-			JS_ReportError (cx, "Invalid signature for argument %d: %s", (i-2)/2, e.what ());
-			return false;
+		if (it != _call_signatures.end ())
+			it->second = std::move (signatures);
+		else {
+			if (_call_signatures.size () >= MaxCachedSignatures)
+				_call_signatures.clear ();
+			it = _call_signatures.emplace (std::move (key), std::move (signatures)).first;
 		}
+	}
+	const MethodSignatures &signatures = it->second;
+
+	m.interface (it->first.first.c_str ());
+	m.member (it->first.second.c_str ());
+	DBus::MessageIter wi = m.writer ();
+	for (unsigned int i = 0; i < argc; ++i) {
 		try {
-			writeValue (cx, wi, sig.c_str (), args[i+1]);
+			writeValue (cx, wi, signatures.compiled[i], args[first+2+2*i+1]);
 		}
 		catch (std::invalid_argument e) {
-			JS_ReportError (cx, "Cannot convert argument %d with signature %s: %s", (i-2)/2, sig.c_str (), e.what ());
+			JS_ReportError (cx, "Cannot convert argument %d with signature %s: %s", i, signatures.strings[i].c_str (), e.what ());
 			return false;
 		}
 	}
+	return true;
+}
+
+bool DBusProxy::call (JSContext *cx, JS::CallArgs &args)
+{
+	DBus::CallMessage m;
+	if (!writeArguments (cx, args, 0, m))
+		return false;
 	std::unique_ptr<DBus::Message> ret;
 	try {
 		ret.reset (new DBus::Message (invoke_method (m)));
@@ -390,25 +545,292 @@ bool DBusProxy::call (JSContext *cx, JS::CallArgs &args)
 		JS_ReportError (cx, "Exception during DBus call: %s", e.what ());
 		return false;
 	}
+	std::vector<Value> values;
+	decodeMessage (*ret, values);
+	toJSValue (cx, args.rval (), Value {Value::Array, 0, std::move (values)});
+	return true;
+}
+
+bool DBusProxy::callAsync (JSContext *cx, JS::CallArgs &args)
+{
+	using jstpl::readJSValue;
+
+	if (args.length () < 4) {
+		JS_ReportError (cx, "callAsync expects at least 4 arguments");
+		return false;
+	}
+	if (!args[0].isObject () || !JS::IsCallable (&args[0].toObject ())) {
+		JS_ReportError (cx, "Invalid callback argument: must be a function");
+		return false;
+	}
+	int timeout;
+	try {
+		readJSValue (cx, timeout, args[1]);
+	}
+	catch (std::invalid_argument e) {
+		JS_ReportError (cx, "Invalid timeout argument: %s", e.what ());
+		return false;
+	}
+	if (_pending_calls.size () >= MaxPendingCalls) {
+		JS_ReportError (cx, "Too many pending DBus calls");
+		return false;
+	}
+
+	DBus::CallMessage m;
+	if (!writeArguments (cx, args, 2, m))
+		return false;
+	m.path (path ().c_str ());
+	m.destination (service ().c_str ());
+
+	unsigned int id = _next_call_id++;
+	_pending_calls.emplace (id, std::make_unique<JS::PersistentRootedValue> (cx, args[0]));
+
+	DBus::PendingCall pending (nullptr);
+	try {
+		std::unique_lock<std::mutex> lock (_async->mutex);
+		_async->thread = static_cast<jstpl::Thread *> (JS_GetContextPrivate (cx));
+		pending = conn ().send_async (m, timeout < 0 ? -1 : timeout);
+		// The callback owns a reference to the state, it stays valid
+		// even if the proxy is destroyed while the reply is handled.
+		pending.slot () = new AsyncCallback (_async, id);
+		_async->calls.emplace (id, pending);
+	}
+	catch (std::exception &e) {
+		_pending_calls.erase (id);
+		JS_ReportError (cx, "Exception during DBus call: %s", e.what ());
+		return false;
+	}
+	// The reply may have arrived before the slot was set
+	if (pending.completed ())
+		asyncReply (_async, id, pending);
+	args.rval ().setUndefined ();
+	return true;
+}
+
+class DBusProxy::AsyncCallback: public DBus::Callback_Base<void, DBus::PendingCall &>
+{
+public:
+	AsyncCallback (const std::shared_ptr<AsyncState> &state, unsigned int id):
+		_state (state),
+		_id (id)
 	{
-		JS::RootedObject array (cx, JS_NewArrayObject (cx, 0));
-		DBus::MessageIter ri = ret->reader ();
-		unsigned int i = 0;
-		while (!ri.at_end ()) {
-			JS::RootedValue elem (cx);
-			try {
-				readValue (cx, &elem, ri);
-				JS_SetElement (cx, array, i, elem);
-			}
-			catch (std::invalid_argument e) {
-				JS_ReportWarning (cx, "Error while reading out argument %d: %s", i, e.what ());
-			}
-			++i;
-			++ri;
+	}
+
+	void call (DBus::PendingCall &pending) const
+	{
+		asyncReply (_state, _id, pending);
+	}
+
+private:
+	std::shared_ptr<AsyncState> _state;
+	unsigned int _id;
+};
+
+void DBusProxy::asyncReply (const std::shared_ptr<AsyncState> &state, unsigned int id, DBus::PendingCall &pending)
+{
+	// Called on the DBus dispatcher thread, or on the JS thread if the
+	// reply was received before the slot was set.
+	{
+		std::unique_lock<std::mutex> lock (state->mutex);
+		// Already handled or cancelled
+		if (state->calls.erase (id) == 0)
+			return;
+	}
+	std::vector<Value> reply;
+	std::string error;
+	DBus::Message message = pending.steal_reply ();
+	if (message.is_error ()) {
+		error = reinterpret_cast<const DBus::ErrorMessage &> (message).name ();
+		DBus::MessageIter ri = message.reader ();
+		if (!ri.at_end () && ri.type () == DBUS_TYPE_STRING)
+			error.append (": ").append (ri.get_string ());
+	}
+	else
+		decodeMessage (message, reply);
+	std::unique_lock<std::mutex> lock (state->mutex);
+	if (state->thread)
+		state->thread->execOnJsThreadAsync ([state, id, error, reply] () {
+			if (state->proxy)
+				state->proxy->completeCall (id, error, reply);
+		});
+}
+
+void DBusProxy::completeCall (unsigned int id, const std::string &error, const std::vector<Value> &reply)
+{
+	auto it = _pending_calls.find (id);
+	if (it == _pending_calls.end ())
+		return;
+	std::unique_ptr<JS::PersistentRootedValue> callback = std::move (it->second);
+	_pending_calls.erase (it);
+
+	JSContext *cx = _async->thread->getContext ();
+	JS::AutoValueVector jsargs (cx);
+	jsargs.resize (2);
+	if (error.empty ()) {
+		jsargs[0].setNull ();
+		toJSValue (cx, jsargs[1], Value {Value::Array, 0, reply});
+	}
+	else {
+		jstpl::setJSValue (cx, jsargs[0], error);
+		jsargs[1].setUndefined ();
+	}
+	JS::RootedValue rval (cx);
+	Trace::Span span ("js", "JS callback");
+	JS_CallFunctionValue (cx, JS::NullPtr (), *callback, jsargs, &rval);
+}
+
+std::string DBusProxy::matchRule (const std::string &service, const std::string &path, const std::string &interface, const std::string &member)
+{
+	return "type='signal',sender='" + service +
+		"',path='" + path +
+		"',interface='" + interface +
+		"',member='" + member + "'";
+}
+
+std::string DBusProxy::ownerMatchRule (const std::string &service)
+{
+	return "type='signal',sender='" DBUS_SERVICE_DBUS
+		"',path='" DBUS_PATH_DBUS
+		"',interface='" DBUS_INTERFACE_DBUS
+		"',member='NameOwnerChanged',arg0='" + service + "'";
+}
+
+std::string DBusProxy::getNameOwner (DBus::Connection &conn, const std::string &name)
+{
+	if (name[0] == ':')
+		return name;
+	DBus::CallMessage m (DBUS_SERVICE_DBUS, DBUS_PATH_DBUS, DBUS_INTERFACE_DBUS, "GetNameOwner");
+	DBus::MessageIter wi = m.writer ();
+	wi << name;
+	try {
+		DBus::Message reply = conn.send_blocking (m);
+		DBus::MessageIter ri = reply.reader ();
+		return ri.get_string ();
+	}
+	catch (DBus::Error &e) {
+		// The service is not running yet, NameOwnerChanged will tell
+		// when it starts.
+		return std::string ();
+	}
+}
+
+sigc::connection DBusProxy::connectSignal (JSContext *cx, JS::HandleValue obj, const std::string &name, JS::HandleValue callback)
+{
+	DBusProxy *proxy;
+	jstpl::readJSValue (cx, proxy, obj);
+	if (!callback.isObject () || !JS::IsCallable (&callback.toObject ()))
+		throw std::invalid_argument ("Callback must be a function");
+
+	// "Member" uses the proxy interface, "some.interface.Member" another one
+	std::string interface, member;
+	auto dot = name.rfind ('.');
+	if (dot == std::string::npos) {
+		interface = proxy->DBus::InterfaceProxy::name ();
+		member = name;
+	}
+	else {
+		interface = name.substr (0, dot);
+		member = name.substr (dot+1);
+	}
+	if (interface.empty () || member.empty ())
+		throw std::invalid_argument ("Invalid DBus signal name");
+
+	auto key = std::make_pair (interface, member);
+	auto it = proxy->_signals.find (key);
+	if (it == proxy->_signals.end ()) {
+		proxy->conn ().add_match (matchRule (proxy->service (), proxy->path (), interface, member).c_str ());
+		it = proxy->_signals.emplace (key, sigc::signal<void (const std::vector<Value> &)> ()).first;
+		std::unique_lock<std::mutex> lock (proxy->_async->mutex);
+		proxy->_async->thread = static_cast<jstpl::Thread *> (JS_GetContextPrivate (cx));
+		proxy->_async->subscriptions.insert (key);
+	}
+	if (!proxy->_filter_added) {
+		// Follow the owner of the service before resolving it, so that
+		// no change is missed.
+		if (proxy->service ()[0] != ':')
+			proxy->conn ().add_match (ownerMatchRule (proxy->service ()).c_str ());
+		proxy->conn ().add_filter (proxy->_async->filter);
+		proxy->_filter_added = true;
+		std::string owner = getNameOwner (proxy->conn (), proxy->service ());
+		std::unique_lock<std::mutex> lock (proxy->_async->mutex);
+		proxy->_async->owner = owner;
+	}
+
+	auto fun = std::make_shared<JS::PersistentRootedValue> (cx, callback);
+	// Signals are emitted on the JS thread, the callback is called directly
+	return it->second.connect ([cx, fun] (const std::vector<Value> &args) {
+		JS::AutoValueVector jsargs (cx);
+		jsargs.resize (args.size ());
+		for (unsigned int i = 0; i < args.size (); ++i)
+			toJSValue (cx, jsargs[i], args[i]);
+		JS::RootedValue rval (cx);
+		Trace::Span span ("js", "JS callback");
+		JS_CallFunctionValue (cx, JS::NullPtr (), *fun, jsargs, &rval);
+	});
+}
+
+bool DBusProxy::filterSignal (const std::shared_ptr<AsyncState> &state, const DBus::Message &message)
+{
+	// Called on the DBus dispatcher thread
+	if (message.type () != DBUS_MESSAGE_TYPE_SIGNAL)
+		return false;
+	const DBus::SignalMessage &signal = reinterpret_cast<const DBus::SignalMessage &> (message);
+	const char *sender = signal.sender ();
+	const char *path = signal.path ();
+	const char *interface = signal.interface ();
+	const char *member = signal.member ();
+	if (!sender || !path || !interface || !member)
+		return false;
+	if (strcmp (sender, DBUS_SERVICE_DBUS) == 0 &&
+	    strcmp (interface, DBUS_INTERFACE_DBUS) == 0 &&
+	    strcmp (member, "NameOwnerChanged") == 0) {
+		std::string name, old_owner, new_owner;
+		DBus::MessageIter ri = message.reader ();
+		ri >> name >> old_owner >> new_owner;
+		std::unique_lock<std::mutex> lock (state->mutex);
+		if (name == state->service)
+			state->owner = new_owner;
+		return false;
+	}
+	auto key = std::make_pair (std::string (interface), std::string (member));
+	{
+		std::unique_lock<std::mutex> lock (state->mutex);
+		if (path != state->path || sender != state->owner)
+			return false;
+		if (state->subscriptions.find (key) == state->subscriptions.end ())
+			return false;
+	}
+	std::vector<Value> args;
+	{
+		Trace::Span span ("dbus", "DBus signal decode");
+		decodeMessage (message, args);
+	}
+	std::unique_lock<std::mutex> lock (state->mutex);
+	if (state->thread)
+		state->thread->execOnJsThreadAsync ([state, key, args] () {
+			if (state->proxy)
+				state->proxy->emitSignal (key.first, key.second, args);
+		});
+	// Let other proxies see the signal too
+	return false;
+}
+
+void DBusProxy::emitSignal (const std::string &interface, const std::string &member, const std::vector<Value> &args)
+{
+	auto it = _signals.find (std::make_pair (interface, member));
+	if (it == _signals.end ())
+		return;
+	if (it->second.empty ()) {
+		// Every script connection was disconnected
+		conn ().remove_match (matchRule (service (), path (), interface, member).c_str (), false);
+		{
+			std::unique_lock<std::mutex> lock (_async->mutex);
+			_async->subscriptions.erase (it->first);
 		}
-		args.rval ().setObject (*array);
+		_signals.erase (it);
+		return;
 	}
-	return true;
+	it->second.emit (args);
 }
 
 const JSClass DBusProxy::js_class = jstpl::make_class<DBusProxy> ("DBusProxy");
@@ -419,6 +841,11 @@ const JSFunctionSpec DBusProxy::js_fs[] = {
 		&jstpl::LLMethodWrapper<DBusProxy, &DBusProxy::call>,
 		0, 0
 	},
+	{
+		"callAsync",
+		&jstpl::LLMethodWrapper<DBusProxy, &DBusProxy::callAsync>,
+		0, 0
+	},
 	JS_FS_END
 };
 
@@ -429,4 +856,6 @@ const std::pair<std::string, int> DBusProxy::js_int_const[] = {
 	{ "", 0 }
 };
 
+const jstpl::DynamicSignalConnector DBusProxy::js_dynamic_signal = &DBusProxy::connectSignal;
+
 bool DBusProxy::_registered = jstpl::ClassManager::registerClass<DBusProxy::JsClass> ();
@@ -20,6 +20,13 @@
 #define DBUS_PROXY_H
 
 #include <dbus-c++/dbus.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <set>
+#include <variant>
+#include <sigc++/signal.h>
 #include "../jstpl/jstpl.h"
 
 class DBusProxy:
@@ -31,13 +38,122 @@ public:
 	~DBusProxy ();
 
 	bool call (JSContext *cx, JS::CallArgs &args);
+	/**
+	 * Call a method without blocking the script.
+	 *
+	 * JS arguments are: callback, timeout (in milliseconds, negative
+	 * for the default timeout), interface, method and then pairs of
+	 * signature and value as in call(). The reply is received by the
+	 * DBus dispatcher and \c callback(error, results) is called on the
+	 * script thread, \c error being null on success.
+	 */
+	bool callAsync (JSContext *cx, JS::CallArgs &args);
 
 	static const JSClass js_class;
 	static const JSFunctionSpec js_fs[];
 	static const std::pair<std::string, int> js_int_const[];
+	static const jstpl::DynamicSignalConnector js_dynamic_signal;
 	typedef jstpl::Class<DBusProxy, int, std::string, std::string, std::string> JsClass;
 
 private:
+	/**
+	 * Value decoded from a message, independently of any JS context.
+	 *
+	 * Structs and variants are both converted to arrays (a variant has
+	 * its signature as first element). Dicts use alternating keys and
+	 * values as children.
+	 */
+	struct Value
+	{
+		enum Kind {
+			Undefined,
+			Basic,
+			Array,
+			Dict,
+		} kind;
+		std::variant<int32_t, double, std::string> basic;
+		std::vector<Value> children;
+	};
+	static void decodeValue (DBus::MessageIter &iter, Value &value);
+	static void decodeMessage (const DBus::Message &message, std::vector<Value> &values);
+	static void toJSValue (JSContext *cx, JS::MutableHandleValue var, const Value &value);
+
+	/**
+	 * Signature compiled to a tree of types.
+	 *
+	 * \p signature is the complete signature of this single type, as
+	 * needed when opening array or variant containers. Arrays have their
+	 * element type as only child, dict entries their key and value types
+	 * and structs their member types.
+	 */
+	struct Signature
+	{
+		char type;
+		std::string signature;
+		std::vector<Signature> children;
+	};
+	static const char *compileSignature (const char *signature, Signature &compiled);
+	std::shared_ptr<const Signature> getVariantSignature (const std::string &signature);
+	void writeValue (JSContext *cx, DBus::MessageIter &iter, const Signature &signature, JS::HandleValue value);
+	bool writeArguments (JSContext *cx, JS::CallArgs &args, unsigned int first, DBus::CallMessage &m);
+	void completeCall (unsigned int id, const std::string &error, const std::vector<Value> &reply);
+
+	static sigc::connection connectSignal (JSContext *cx, JS::HandleValue obj, const std::string &name, JS::HandleValue callback);
+	void emitSignal (const std::string &interface, const std::string &member, const std::vector<Value> &args);
+	static std::string matchRule (const std::string &service, const std::string &path, const std::string &interface, const std::string &member);
+	static std::string ownerMatchRule (const std::string &service);
+	static std::string getNameOwner (DBus::Connection &conn, const std::string &name);
+
+	/**
+	 * State shared with the pending calls and the signal filter on the
+	 * DBus dispatcher thread.
+	 *
+	 * \p thread and \p proxy are reset when the proxy is destroyed,
+	 * replies and signals arriving after that are dropped.
+	 */
+	struct AsyncState
+	{
+		std::mutex mutex;
+		jstpl::Thread *thread;
+		DBusProxy *proxy;
+		// Calls waiting for their reply, a call is completed by the
+		// first one removing it
+		std::map<unsigned int, DBus::PendingCall> calls;
+		// Subscribed interface and member names, read by the signal filter
+		std::set<std::pair<std::string, std::string>> subscriptions;
+		// Copied from the proxy for the signal filter, \p owner is the
+		// unique name of the current owner of \p service.
+		std::string service, path, owner;
+		DBus::MessageSlot filter;
+	};
+	class SignalFilter;
+	static bool filterSignal (const std::shared_ptr<AsyncState> &state, const DBus::Message &message);
+
+	class AsyncCallback;
+	static void asyncReply (const std::shared_ptr<AsyncState> &state, unsigned int id, DBus::PendingCall &pending);
+
+	static constexpr std::size_t MaxPendingCalls = 64;
+	std::shared_ptr<AsyncState> _async;
+	unsigned int _next_call_id;
+	std::map<unsigned int, std::unique_ptr<JS::PersistentRootedValue>> _pending_calls;
+	// Script side of the signal subscriptions, indexed by interface and member
+	std::map<std::pair<std::string, std::string>, sigc::signal<void (const std::vector<Value> &)>> _signals;
+	bool _filter_added;
+
+	/**
+	 * Compiled argument signatures for the last call of a method.
+	 */
+	struct MethodSignatures
+	{
+		std::vector<std::string> strings;
+		std::vector<Signature> compiled;
+	};
+	static constexpr std::size_t MaxCachedSignatures = 64;
+	// Indexed by interface and member names
+	std::map<std::pair<std::string, std::string>, MethodSignatures> _call_signatures;
+	// Shared so that writeValue can keep its signature while the cache is cleared
+	std::map<std::string, std::shared_ptr<const Signature>> _variant_signatures;
+
 	static bool _registered;
 };
 
@@ -83,12 +83,12 @@ void EventFilter::connect ()
 		return;
 	}
 
-	_simple_conn = _input->simpleEvent.connect ([this] (uint16_t type, uint16_t code, int32_t value) {
-		processSimpleEvent (type, code, value);
+	_simple_conn = _input->simpleEvent.connect ([this] (uint16_t type, uint16_t code, int32_t value, double time) {
+		processSimpleEvent (type, code, value, time);
 	});
 	if (!_simple_only) {
-		_all_conn = _input->event.connect ([this] (const InputDevice::Event &event) {
-			processEvent (event);
+		_all_conn = _input->event.connect ([this] (const InputDevice::Event &event, double time) {
+			processEvent (event, time);
 		});
 	}
 }
@@ -151,16 +151,16 @@ bool EventFilter::testSimpleEvent (uint16_t type, uint16_t code)
 	return false;
 }
 
-void EventFilter::processEvent (const InputDevice::Event &ev)
+void EventFilter::processEvent (const InputDevice::Event &ev, double time)
 {
 	if (testEvent (ev) != _inverted)
-		event.emit (ev);
+		event.emit (ev, time);
 }
 
-void EventFilter::processSimpleEvent (uint16_t type, uint16_t code, int32_t value)
+void EventFilter::processSimpleEvent (uint16_t type, uint16_t code, int32_t value, double time)
 {
 	if (testSimpleEvent (type, code) != _inverted)
-		simpleEvent.emit (type, code, value);
+		simpleEvent.emit (type, code, value, time);
 }
 
 const JSClass EventFilter::js_class = jstpl::make_class<EventFilter> ("EventFilter");
@@ -183,8 +183,8 @@ const JSPropertySpec EventFilter::js_ps[] = {
 };
 
 const jstpl::SignalMap EventFilter::js_signals = {
-	{ "event", jstpl::make_signal_connector (&EventFilter::event) },
-	{ "simpleEvent", jstpl::make_signal_connector (&EventFilter::simpleEvent) },
+	{ "event", jstpl::make_keyed_signal_connector (&EventFilter::event, jstpl::NoEventKey ()) },
+	{ "simpleEvent", jstpl::make_keyed_signal_connector (&EventFilter::simpleEvent, jstpl::NoEventKey ()) },
 };
 
 bool EventFilter::_registered = jstpl::ClassManager::registerClass<EventFilter::JsClass> ();
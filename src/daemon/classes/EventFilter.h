@@ -98,11 +98,11 @@ public:
 	 *
 	 * The signal is not emitted when `simple_only` is \c true.
 	 */
-	sigc::signal<void (InputDevice::Event)> event;
+	sigc::signal<void (InputDevice::Event, double)> event;
 	/**
 	 * Filtered simple events.
 	 */
-	sigc::signal<void (uint16_t, uint16_t, int32_t)> simpleEvent;
+	sigc::signal<void (uint16_t, uint16_t, int32_t, double)> simpleEvent;
 
 	static const JSClass js_class;
 	static const JSFunctionSpec js_fs[];
@@ -113,8 +113,8 @@ public:
 private:
 	bool testEvent (const InputDevice::Event &event);
 	bool testSimpleEvent (uint16_t type, uint16_t code);
-	void processEvent (const InputDevice::Event &event);
-	void processSimpleEvent (uint16_t type, uint16_t code, int32_t value);
+	void processEvent (const InputDevice::Event &event, double time);
+	void processSimpleEvent (uint16_t type, uint16_t code, int32_t value, double time);
 
 	InputDevice *_input;
 	bool _simple_only;
@@ -0,0 +1,145 @@
+/*
+ * Copyright 2017 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "Passthrough.h"
+
+#include "../Log.h"
+
+#include <stdexcept>
+
+Passthrough::Passthrough (InputDevice *device, UInput *uinput):
+	_device (dynamic_cast<EventDevice *> (device)),
+	_uinput (uinput),
+	_sync_excluded (false)
+{
+	if (!_device)
+		throw std::invalid_argument ("Passthrough requires an event device");
+}
+
+Passthrough::~Passthrough ()
+{
+	_conn.disconnect ();
+}
+
+void Passthrough::copyCapabilities ()
+{
+	const struct libevdev *dev = _device->evdev ();
+	_uinput->setName (libevdev_get_name (dev));
+	_uinput->setBusType (libevdev_get_id_bustype (dev));
+	_uinput->setVendor (libevdev_get_id_vendor (dev));
+	_uinput->setProduct (libevdev_get_id_product (dev));
+	_uinput->setVersion (libevdev_get_id_version (dev));
+	for (unsigned int prop = 0; prop <= INPUT_PROP_MAX; ++prop)
+		if (libevdev_has_property (dev, prop))
+			_uinput->setProp (prop);
+	if (libevdev_has_event_type (dev, EV_REP)) {
+		int delay = 0, period = 0;
+		libevdev_get_repeat (dev, &delay, &period);
+		_uinput->setRepeat (delay, period);
+	}
+	for (unsigned int type: { EV_KEY, EV_REL, EV_ABS, EV_MSC, EV_SW, EV_LED, EV_SND }) {
+		if (!libevdev_has_event_type (dev, type))
+			continue;
+		int max = libevdev_event_type_get_max (type);
+		for (int code = 0; code <= max; ++code) {
+			if (!libevdev_has_event_code (dev, type, code))
+				continue;
+			if (type == EV_ABS) {
+				const struct input_absinfo *abs = libevdev_get_abs_info (dev, code);
+				_uinput->setAbs (code, abs->minimum, abs->maximum, abs->fuzz, abs->flat);
+				_uinput->setAbsResolution (code, abs->resolution);
+			}
+			else
+				_uinput->setEvent (type, code);
+		}
+	}
+}
+
+void Passthrough::exclude (uint16_t type, uint16_t code)
+{
+	if (type >= EV_CNT || code >= KEY_CNT)
+		throw std::invalid_argument ("Invalid event type or code");
+	_excluded[type].set (code);
+}
+
+void Passthrough::excludeType (uint16_t type)
+{
+	if (type >= EV_CNT)
+		throw std::invalid_argument ("Invalid event type");
+	_excluded[type].set ();
+}
+
+void Passthrough::setSyncExcluded (bool sync_excluded)
+{
+	_sync_excluded = sync_excluded;
+}
+
+void Passthrough::connect ()
+{
+	if (_conn.connected ())
+		return;
+	_conn = _device->frame.connect ([this] (const InputDevice::EventFrame &frame, double) {
+		forward (frame);
+	});
+}
+
+void Passthrough::disconnect ()
+{
+	_conn.disconnect ();
+}
+
+void Passthrough::forward (const InputDevice::EventFrame &frame)
+{
+	_buffer.clear ();
+	for (std::size_t i = 0; i+2 < frame.size (); i += 3) {
+		uint16_t type = frame[i], code = frame[i+1];
+		if (type < EV_CNT && code < KEY_CNT && _excluded[type][code])
+			continue;
+		struct input_event ev = {};
+		ev.type = type;
+		ev.code = code;
+		ev.value = frame[i+2];
+		_buffer.push_back (ev);
+	}
+	if (_buffer.empty () && (frame.empty () || !_sync_excluded))
+		return;
+	struct input_event syn = {};
+	syn.type = EV_SYN;
+	syn.code = SYN_REPORT;
+	_buffer.push_back (syn);
+	try {
+		_uinput->sendEvents (_buffer.data (), _buffer.size ());
+	}
+	catch (std::exception &e) {
+		Log::error () << "Passthrough failed: " << e.what () << std::endl;
+	}
+}
+
+const JSClass Passthrough::js_class = jstpl::make_class<Passthrough> ("Passthrough");
+
+const JSFunctionSpec Passthrough::js_fs[] = {
+	jstpl::make_method<&Passthrough::copyCapabilities> ("copyCapabilities"),
+	jstpl::make_method<&Passthrough::exclude> ("exclude"),
+	jstpl::make_method<&Passthrough::excludeType> ("excludeType"),
+	jstpl::make_method<&Passthrough::setSyncExcluded> ("setSyncExcluded"),
+	jstpl::make_method<&Passthrough::connect> ("connect"),
+	jstpl::make_method<&Passthrough::disconnect> ("disconnect"),
+	JS_FS_END
+};
+
+bool Passthrough::_registered = jstpl::ClassManager::registerClass<Passthrough::JsClass> ();
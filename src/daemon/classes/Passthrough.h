@@ -0,0 +1,102 @@
+/*
+ * Copyright 2017 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef PASSTHROUGH_H
+#define PASSTHROUGH_H
+
+#include <array>
+#include <bitset>
+#include <vector>
+#include "../event/EventDevice.h"
+#include "UInput.h"
+#include "../jstpl/jstpl.h"
+
+/**
+ * Forward the events of an event device to a uinput device without any
+ * JS callback.
+ *
+ * Whole frames are written to uinput with a single write from the device
+ * reader thread. Events handled elsewhere (e.g. by a Remapper or a
+ * script) can be excluded.
+ *
+ * Exclusions must be set before calling connect.
+ */
+class Passthrough
+{
+public:
+	/**
+	 * Create a passthrough from \p device (must be an event device)
+	 * to \p uinput.
+	 */
+	Passthrough (InputDevice *device, UInput *uinput);
+	Passthrough (const Passthrough &) = delete;
+	~Passthrough ();
+
+	/**
+	 * Copy the name, ids and event codes of the input device to the
+	 * uinput device.
+	 *
+	 * Must be called before the uinput device is created.
+	 */
+	void copyCapabilities ();
+
+	/**
+	 * Do not forward events with type \p type and code \p code.
+	 */
+	void exclude (uint16_t type, uint16_t code);
+	/**
+	 * Do not forward any event with type \p type.
+	 */
+	void excludeType (uint16_t type);
+	/**
+	 * Also send SYN_REPORT for frames whose events were all excluded.
+	 *
+	 * Useful when the excluded events are remapped synchronously on
+	 * the reader thread (e.g. by a Remapper without a SYN_REPORT rule),
+	 * so their output is terminated by the passthrough frame.
+	 */
+	void setSyncExcluded (bool sync_excluded);
+
+	/**
+	 * Start forwarding events.
+	 */
+	void connect ();
+	/**
+	 * Stop forwarding events.
+	 */
+	void disconnect ();
+
+	static const JSClass js_class;
+	static const JSFunctionSpec js_fs[];
+
+	using JsClass = jstpl::Class<Passthrough, InputDevice *, UInput *>;
+
+private:
+	void forward (const InputDevice::EventFrame &frame);
+
+	EventDevice *_device;
+	UInput *_uinput;
+	sigc::connection _conn;
+	std::array<std::bitset<KEY_CNT>, EV_CNT> _excluded;
+	std::vector<struct input_event> _buffer;
+	bool _sync_excluded;
+
+	static bool _registered;
+};
+
+#endif // PASSTHROUGH_H
@@ -18,8 +18,12 @@
 
 #include "Remapper.h"
 
-Remapper::mapped_event::mapped_event (Remapper *parent, const event_id &event):
+#include <cmath>
+
+Remapper::mapped_event::mapped_event (Remapper *parent, const event_id &event, int field):
 	_parent (parent),
+	_source (event),
+	_field (field),
 	_event (event)
 {
 }
@@ -77,6 +81,88 @@ Remapper::mapped_event *Remapper::mapped_event::setTransform (int mult, int div,
 	return this;
 }
 
+Remapper::mapped_event *Remapper::mapped_event::setDeadzone (int32_t center, int32_t size, int32_t range)
+{
+	if (size < 0 || range <= size)
+		throw std::invalid_argument ("Deadzone size must be positive and smaller than range.");
+	if (_deadzone.mode == Deadzone::Radial && _field < 0)
+		_parent->removeLinkedEvent (this, _deadzone.other);
+	_deadzone.mode = Deadzone::Axial;
+	_deadzone.center = center;
+	_deadzone.size = size;
+	_deadzone.range = range;
+	return this;
+}
+
+Remapper::mapped_event *Remapper::mapped_event::setRadialDeadzone (uint16_t other_code, int32_t center, int32_t size, int32_t range)
+{
+	if (size < 0 || range <= size)
+		throw std::invalid_argument ("Deadzone size must be positive and smaller than range.");
+	if (_field >= 0)
+		throw std::invalid_argument ("Use setRadialDeadzoneField for complex events.");
+	event_id other = { _source.type, other_code };
+	bool linked = _deadzone.mode == Deadzone::Radial;
+	if (!linked || _deadzone.other.type != other.type || _deadzone.other.code != other.code) {
+		if (linked)
+			_parent->removeLinkedEvent (this, _deadzone.other);
+		_parent->addLinkedEvent (this, other);
+	}
+	_deadzone.mode = Deadzone::Radial;
+	_deadzone.other = other;
+	_deadzone.center = center;
+	_deadzone.size = size;
+	_deadzone.range = range;
+	return this;
+}
+
+Remapper::mapped_event *Remapper::mapped_event::setRadialDeadzoneField (const std::string &other_field, int32_t center, int32_t size, int32_t range)
+{
+	if (_field < 0)
+		throw std::invalid_argument ("setRadialDeadzoneField is only for complex events.");
+	if (size < 0 || range <= size)
+		throw std::invalid_argument ("Deadzone size must be positive and smaller than range.");
+	_deadzone.mode = Deadzone::Radial;
+	_deadzone.other_field = _parent->inputDevice ()->complexEventField (_source.type, other_field);
+	_deadzone.center = center;
+	_deadzone.size = size;
+	_deadzone.range = range;
+	return this;
+}
+
+Remapper::mapped_event *Remapper::mapped_event::setLookupTable (int32_t min, int32_t max, const std::vector<int32_t> &table)
+{
+	if (table.size () < 2 || max <= min)
+		throw std::invalid_argument ("Lookup table needs at least two values and a non-empty range.");
+	_curve.mode = Curve::Table;
+	_curve.min = min;
+	_curve.max = max;
+	_curve.values = table;
+	return this;
+}
+
+Remapper::mapped_event *Remapper::mapped_event::setCurve (const std::vector<int32_t> &points)
+{
+	if (points.size () < 4 || points.size () % 2 != 0)
+		throw std::invalid_argument ("Curve needs at least two (input, output) pairs.");
+	for (std::size_t i = 2; i < points.size (); i += 2)
+		if (points[i] <= points[i-2])
+			throw std::invalid_argument ("Curve inputs must be increasing.");
+	_curve.mode = Curve::Points;
+	_curve.values = points;
+	return this;
+}
+
+Remapper::mapped_event *Remapper::mapped_event::setThreshold (int32_t press, int32_t release)
+{
+	if (press == release)
+		throw std::invalid_argument ("Press and release thresholds must be different.");
+	_threshold.enabled = true;
+	_threshold.press = press;
+	_threshold.release = release;
+	_threshold.pressed = false;
+	return this;
+}
+
 Remapper::mapped_event *Remapper::mapped_event::setDefaultValue (int32_t value)
 {
 	_default_value = value;
@@ -93,14 +179,104 @@ bool Remapper::mapped_event::testModifiers ()
 	return true;
 }
 
+static int32_t interpolate (int64_t x, int64_t x0, int64_t x1, int64_t y0, int64_t y1)
+{
+	return y0 + (y1 - y0) * (x - x0) / (x1 - x0);
+}
+
+int32_t Remapper::mapped_event::applyDeadzone (int32_t value)
+{
+	const auto &dz = _deadzone;
+	switch (dz.mode) {
+	case Deadzone::None:
+		return value;
+	case Deadzone::Axial: {
+		int64_t d = int64_t (value) - dz.center;
+		int64_t abs_d = std::abs (d);
+		if (abs_d <= dz.size)
+			return dz.center;
+		int64_t scaled = std::min<int64_t> (dz.range, (abs_d - dz.size) * dz.range / (dz.range - dz.size));
+		return dz.center + (d < 0 ? -scaled : scaled);
+	}
+	case Deadzone::Radial: {
+		double dx = double (value) - dz.center;
+		int32_t other = dz.other_field >= 0
+			? (*_parent->_complex_values)[dz.other_field]
+			: _parent->inputDevice ()->getSimpleEvent (dz.other.type, dz.other.code);
+		double dy = double (other) - dz.center;
+		double r = std::hypot (dx, dy);
+		if (r <= dz.size)
+			return dz.center;
+		double scale = (r - dz.size) / r * dz.range / (dz.range - dz.size);
+		double scaled = std::max (-double (dz.range), std::min (double (dz.range), dx * scale));
+		return dz.center + int32_t (std::lround (scaled));
+	}
+	}
+	return value;
+}
+
+int32_t Remapper::mapped_event::applyCurve (int32_t value)
+{
+	const auto &c = _curve;
+	switch (c.mode) {
+	case Curve::None:
+		return value;
+	case Curve::Table: {
+		if (value <= c.min)
+			return c.values.front ();
+		if (value >= c.max)
+			return c.values.back ();
+		int64_t n = c.values.size () - 1;
+		int64_t pos = (int64_t (value) - c.min) * n;
+		int64_t span = int64_t (c.max) - c.min;
+		int64_t i = pos / span;
+		int64_t x0 = i * span, x1 = (i + 1) * span;
+		return interpolate (pos, x0, x1, c.values[i], c.values[i+1]);
+	}
+	case Curve::Points: {
+		const auto &p = c.values;
+		if (value <= p.front ())
+			return p[1];
+		if (value >= p[p.size ()-2])
+			return p.back ();
+		std::size_t i = 2;
+		while (p[i] <= value)
+			i += 2;
+		return interpolate (value, p[i-2], p[i], p[i-1], p[i+1]);
+	}
+	}
+	return value;
+}
+
 void Remapper::mapped_event::process (int32_t value)
 {
+	value = applyCurve (applyDeadzone (value));
 	int32_t new_value = (_transform.mult * value) / _transform.div + _transform.offset;
+	if (_threshold.enabled) {
+		bool pressed = _threshold.pressed;
+		if (_threshold.press > _threshold.release) {
+			if (new_value >= _threshold.press)
+				pressed = true;
+			else if (new_value <= _threshold.release)
+				pressed = false;
+		}
+		else {
+			if (new_value <= _threshold.press)
+				pressed = true;
+			else if (new_value >= _threshold.release)
+				pressed = false;
+		}
+		if (pressed == _threshold.pressed)
+			return;
+		_threshold.pressed = pressed;
+		new_value = pressed ? 1 : 0;
+	}
 	_parent->uinput ()->sendEvent (_event.type, _event.code, new_value);
 }
 
 void Remapper::mapped_event::reset ()
 {
+	_threshold.pressed = false;
 	_parent->uinput ()->sendEvent (_event.type, _event.code, _default_value);
 }
 
@@ -113,6 +289,12 @@ const JSFunctionSpec Remapper::mapped_event::js_fs[] = {
 	jstpl::make_method<&Remapper::mapped_event::addModifierMin> ("addModifierMin"),
 	jstpl::make_method<&Remapper::mapped_event::addModifierMax> ("addModifierMax"),
 	jstpl::make_method<&Remapper::mapped_event::setTransform> ("setTransform"),
+	jstpl::make_method<&Remapper::mapped_event::setDeadzone> ("setDeadzone"),
+	jstpl::make_method<&Remapper::mapped_event::setRadialDeadzone> ("setRadialDeadzone"),
+	jstpl::make_method<&Remapper::mapped_event::setRadialDeadzoneField> ("setRadialDeadzoneField"),
+	jstpl::make_method<&Remapper::mapped_event::setLookupTable> ("setLookupTable"),
+	jstpl::make_method<&Remapper::mapped_event::setCurve> ("setCurve"),
+	jstpl::make_method<&Remapper::mapped_event::setThreshold> ("setThreshold"),
 	jstpl::make_method<&Remapper::mapped_event::setDefaultValue> ("setDefaultValue"),
 	JS_FS_END
 };
@@ -121,13 +303,15 @@ bool Remapper::mapped_event::_registered = jstpl::ClassManager::registerClass<Re
 
 Remapper::Remapper (InputDevice *device, UInput *uinput):
 	_device (device),
-	_uinput (uinput)
+	_uinput (uinput),
+	_complex_values (nullptr)
 {
 }
 
 Remapper::~Remapper ()
 {
 	_conn.disconnect ();
+	_complex_conn.disconnect ();
 }
 
 Remapper::mapped_event *Remapper::addEvent (uint16_t old_type, uint16_t old_code)
@@ -137,26 +321,61 @@ Remapper::mapped_event *Remapper::addEvent (uint16_t old_type, uint16_t old_code
 	return &it->second;
 }
 
+Remapper::mapped_event *Remapper::addComplexEvent (uint16_t type, uint16_t code, const std::string &field)
+{
+	event_id ev = { type, code };
+	int index = _device->complexEventField (type, field);
+	auto it = _complex_events.emplace (ev, mapped_event (this, ev, index));
+	if (_conn.connected ())
+		connectComplexEvents ();
+	return &it->second;
+}
+
 void Remapper::connect ()
 {
 	if (_conn.connected ())
 		return;
-	_conn = _device->simpleEvent.connect ([this] (uint16_t code, uint16_t type, int32_t value) {
+	_conn = _device->simpleEvent.connect ([this] (uint16_t code, uint16_t type, int32_t value, double) {
 		event (code, type, value);
 	});
+	connectComplexEvents ();
 }
 
 void Remapper::disconnect ()
 {
 	_conn.disconnect ();
+	_complex_conn.disconnect ();
+}
+
+void Remapper::connectComplexEvents ()
+{
+	// Devices only build the values when the signal is connected
+	if (_complex_conn.connected () || _complex_events.empty ())
+		return;
+	_complex_conn = _device->complexEvent.connect ([this] (uint16_t type, uint16_t code, const InputDevice::ComplexEventValues &values, double) {
+		complexEvent (type, code, values);
+	});
 }
 
 void Remapper::addModifier (mapped_event *ev, const event_id &mod_ev)
 {
-	auto it = std::find_if (_events.begin (), _events.end (),
-				[ev] (const auto &p) { return &p.second == ev; });
-	assert (it != _events.end ());
-	_modifier_events.emplace (mod_ev, it);
+	_modifier_events.emplace (mod_ev, ev);
+}
+
+void Remapper::addLinkedEvent (mapped_event *ev, const event_id &linked_ev)
+{
+	_linked_events.emplace (linked_ev, ev);
+}
+
+void Remapper::removeLinkedEvent (mapped_event *ev, const event_id &linked_ev)
+{
+	auto range = _linked_events.equal_range (linked_ev);
+	for (auto it = range.first; it != range.second; ++it) {
+		if (it->second == ev) {
+			_linked_events.erase (it);
+			return;
+		}
+	}
 }
 
 void Remapper::event (uint16_t code, uint16_t type, int32_t value)
@@ -170,23 +389,47 @@ void Remapper::event (uint16_t code, uint16_t type, int32_t value)
 	}
 	auto mod_range = _modifier_events.equal_range (ev);
 	for (auto it = mod_range.first; it != mod_range.second; ++it) {
-		auto &e = it->second->first;
-		auto &mapped = it->second->second;
+		auto &mapped = *it->second;
+		const auto &e = mapped._source;
 		bool new_state = mapped.testModifiers ();
 		if (mapped._state && !new_state) {
 			mapped.reset ();
 		}
-		if (!mapped._state && new_state) {
+		// Complex events have no stored value, wait for the next one
+		if (!mapped._state && new_state && mapped._field < 0) {
 			mapped.process (_device->getSimpleEvent (e.type, e.code));
 		}
 		mapped._state = new_state;
 	}
+	auto linked_range = _linked_events.equal_range (ev);
+	for (auto it = linked_range.first; it != linked_range.second; ++it) {
+		auto &mapped = *it->second;
+		const auto &e = mapped._source;
+		if (mapped.testModifiers ())
+			mapped.process (_device->getSimpleEvent (e.type, e.code));
+	}
+}
+
+void Remapper::complexEvent (uint16_t type, uint16_t code, const InputDevice::ComplexEventValues &values)
+{
+	event_id ev = { type, code };
+	auto range = _complex_events.equal_range (ev);
+	if (range.first == range.second)
+		return;
+	_complex_values = &values;
+	for (auto it = range.first; it != range.second; ++it) {
+		auto &mapped = it->second;
+		if (std::size_t (mapped._field) < values.size () && mapped.testModifiers ())
+			mapped.process (values[mapped._field]);
+	}
+	_complex_values = nullptr;
 }
 
 const JSClass Remapper::js_class = jstpl::make_class<Remapper> ("Remapper");
 
 const JSFunctionSpec Remapper::js_fs[] = {
 	jstpl::make_method<&Remapper::addEvent> ("addEvent"),
+	jstpl::make_method<&Remapper::addComplexEvent> ("addComplexEvent"),
 	jstpl::make_method<&Remapper::connect> ("connect"),
 	jstpl::make_method<&Remapper::disconnect> ("disconnect"),
 	JS_FS_END
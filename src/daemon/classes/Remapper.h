@@ -19,6 +19,8 @@
 #ifndef REMAPPER_H
 #define REMAPPER_H
 
+#include <vector>
+
 #include "../InputDevice.h"
 #include "UInput.h"
 #include "../jstpl/jstpl.h"
@@ -26,8 +28,11 @@
 /**
  * Remap input events from an input device and send them to a uinput device.
  *
- * Remapper can only remap simple events: events with only a type, a code and a
- * value, and sent through the simpleEvent signal.
+ * Remapper remaps simple events: events with only a type, a code and a
+ * value, and sent through the simpleEvent signal. A single field of complex
+ * events (sent through the complexEvent signal, e.g. touchpad positions or
+ * sensor axes) can also be remapped with addComplexEvent, the field is
+ * resolved to its index when the rule is added.
  *
  * Once configured and remapped, the remapper will pass remapped event from the
  * input device to uinput without need for any callbacks.
@@ -35,6 +40,10 @@
  * Add remapped event with addEvent and configure it with calls to mapped_event
  * setters. An input event that was not added will be ignored.
  *
+ * Values are processed on the input device thread in this order: deadzone
+ * (axial or radial), response curve (lookup table or piecewise-linear),
+ * transform, threshold.
+ *
  * The remapper will process events after connect is called until disconnect is
  * called or the object is destroyed.
  */
@@ -96,6 +105,61 @@ public:
 		 * The new value is: (\p mult * value) / \p div + \p offset.
 		 */
 		mapped_event *setTransform (int mult, int div, int offset);
+		/**
+		 * Apply an axial deadzone.
+		 *
+		 * Values at most \p size away from \p center become \p center,
+		 * other values are rescaled so that \p center ± \p range is
+		 * still reached.
+		 */
+		mapped_event *setDeadzone (int32_t center, int32_t size, int32_t range);
+		/**
+		 * Apply a radial deadzone using the source axis \p other_code
+		 * (with the same type as this source event) as the second
+		 * coordinate.
+		 *
+		 * The vector from (\p center, \p center) is set to zero when
+		 * its length is at most \p size, it is rescaled otherwise and
+		 * each coordinate is clamped to \p center ± \p range. This event
+		 * is also processed again when the other axis changes.
+		 */
+		mapped_event *setRadialDeadzone (uint16_t other_code, int32_t center, int32_t size, int32_t range);
+		/**
+		 * Apply a radial deadzone using the field \p other_field of the
+		 * same complex event as the second coordinate.
+		 *
+		 * Only for events added with addComplexEvent.
+		 *
+		 * \see setRadialDeadzone
+		 */
+		mapped_event *setRadialDeadzoneField (const std::string &other_field, int32_t center, int32_t size, int32_t range);
+		/**
+		 * Use a precomputed response curve.
+		 *
+		 * \p table contains the output values for evenly spaced inputs
+		 * from \p min to \p max (included), values in-between are
+		 * linearly interpolated and values outside are clamped. A table
+		 * with max - min + 1 entries is directly indexed.
+		 */
+		mapped_event *setLookupTable (int32_t min, int32_t max, const std::vector<int32_t> &table);
+		/**
+		 * Use a piecewise-linear response curve.
+		 *
+		 * \p points contains (input, output) pairs, inputs must be
+		 * increasing. Values outside the first and last inputs are
+		 * clamped.
+		 */
+		mapped_event *setCurve (const std::vector<int32_t> &points);
+		/**
+		 * Convert the value to a button state with hysteresis.
+		 *
+		 * If \p press is greater than \p release, the output becomes 1
+		 * when the value reaches at least \p press and 0 when it is at
+		 * most \p release. If \p press is lower than \p release, the
+		 * comparisons are reversed. An event is only sent when the
+		 * state changes.
+		 */
+		mapped_event *setThreshold (int32_t press, int32_t release);
 		/**
 		 * Change the default value.
 		 *
@@ -109,13 +173,17 @@ public:
 		using JsClass = jstpl::AbstractClass<mapped_event>;
 
 	private:
-		mapped_event (Remapper *parent, const event_id &event);
+		mapped_event (Remapper *parent, const event_id &event, int field = -1);
 
 		bool testModifiers ();
+		int32_t applyDeadzone (int32_t value);
+		int32_t applyCurve (int32_t value);
 		void process (int32_t value);
 		void reset ();
 
 		Remapper *_parent;
+		event_id _source;
+		int _field;
 		event_id _event;
 
 		struct modifier_range {
@@ -131,6 +199,39 @@ public:
 			int offset = 0;
 		} _transform;
 
+		enum class Deadzone {
+			None,
+			Axial,
+			Radial,
+		};
+		struct deadzone {
+			Deadzone mode = Deadzone::None;
+			event_id other;
+			int other_field = -1;
+			int32_t center = 0;
+			int32_t size = 0;
+			int32_t range = 0;
+		} _deadzone;
+
+		enum class Curve {
+			None,
+			Table,
+			Points,
+		};
+		struct curve {
+			Curve mode = Curve::None;
+			int32_t min = 0;
+			int32_t max = 0;
+			std::vector<int32_t> values;
+		} _curve;
+
+		struct threshold {
+			bool enabled = false;
+			int32_t press = 0;
+			int32_t release = 0;
+			bool pressed = false;
+		} _threshold;
+
 		bool _state = false;
 		int32_t _default_value = 0;
 
@@ -155,6 +256,18 @@ public:
 	 * and may need to be configured.
 	 */
 	mapped_event *addEvent (uint16_t old_type, uint16_t old_code);
+	/**
+	 * Create a remapped event from the field \p field of complex events
+	 * with type \p type and code \p code (0 if the event has no code).
+	 *
+	 * The output event type and code must be set with
+	 * mapped_event::setEvent. When modifiers become active, the event
+	 * is only sent with the next complex event.
+	 *
+	 * \throws std::invalid_argument if the device does not declare the
+	 * field.
+	 */
+	mapped_event *addComplexEvent (uint16_t type, uint16_t code, const std::string &field);
 
 	/**
 	 * Connect to the input device simple events.
@@ -172,14 +285,23 @@ public:
 
 private:
 	void addModifier (mapped_event *ev, const event_id &mod_ev);
+	void addLinkedEvent (mapped_event *ev, const event_id &linked_ev);
+	void removeLinkedEvent (mapped_event *ev, const event_id &linked_ev);
+	void connectComplexEvents ();
 	void event (uint16_t code, uint16_t type, int32_t value);
+	void complexEvent (uint16_t type, uint16_t code, const InputDevice::ComplexEventValues &values);
 
 	InputDevice *_device;
 	sigc::connection _conn;
+	sigc::connection _complex_conn;
 	UInput *_uinput;
 
 	std::multimap<event_id, mapped_event> _events;
-	std::multimap<event_id, decltype(_events)::iterator> _modifier_events;
+	std::multimap<event_id, mapped_event> _complex_events;
+	std::multimap<event_id, mapped_event *> _modifier_events;
+	std::multimap<event_id, mapped_event *> _linked_events;
+	// Values of the complex event being processed
+	const InputDevice::ComplexEventValues *_complex_values;
 
 	static bool _registered;
 };
@@ -19,11 +19,13 @@
 #include "UInput.h"
 
 #include "../Log.h"
+#include "../Trace.h"
 
 extern "C" {
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
+#include <string.h>
 }
 
 UInput::UInput ():
@@ -31,6 +33,8 @@ UInput::UInput ():
 {
 	int ret;
 	memset (&_uidev, 0, sizeof (struct uinput_user_dev));
+	memset (_absres, 0, sizeof (_absres));
+	memset (_rep, 0, sizeof (_rep));
 	snprintf (_uidev.name, UINPUT_MAX_NAME_SIZE,
 	          "Input script device");
 	_uidev.id.bustype = BUS_VIRTUAL;
@@ -123,6 +127,29 @@ void UInput::setAbs (uint16_t code, int32_t min, int32_t max, int32_t fuzz, int3
 	_uidev.absflat[code] = flat;
 }
 
+void UInput::setAbsResolution (uint16_t code, int32_t resolution)
+{
+	if (code > ABS_MAX)
+		throw std::invalid_argument ("ABS code is hight than ABS_MAX");
+	_absres[code] = resolution;
+}
+
+void UInput::setProp (uint16_t prop)
+{
+	if (prop > INPUT_PROP_MAX)
+		throw std::invalid_argument ("Input property is higher than INPUT_PROP_MAX");
+	if (-1 == ioctl (_fd, UI_SET_PROPBIT, prop))
+		throw std::system_error (errno, std::system_category (), "ioctl UI_SET_PROPBIT");
+}
+
+void UInput::setRepeat (int32_t delay, int32_t period)
+{
+	if (-1 == ioctl (_fd, UI_SET_EVBIT, EV_REP))
+		throw std::system_error (errno, std::system_category (), "ioctl UI_SET_EVBIT");
+	_rep[REP_DELAY] = delay;
+	_rep[REP_PERIOD] = period;
+}
+
 void UInput::setRel (uint16_t code)
 {
 	if (-1 == ioctl (_fd, UI_SET_EVBIT, EV_REL))
@@ -140,6 +167,25 @@ void UInput::setFF (uint16_t code)
 	_use_ff = true;
 }
 
+void UInput::setEvent (uint16_t type, uint16_t code)
+{
+	unsigned long request;
+	switch (type) {
+	case EV_KEY: request = UI_SET_KEYBIT; break;
+	case EV_REL: request = UI_SET_RELBIT; break;
+	case EV_MSC: request = UI_SET_MSCBIT; break;
+	case EV_SW: request = UI_SET_SWBIT; break;
+	case EV_LED: request = UI_SET_LEDBIT; break;
+	case EV_SND: request = UI_SET_SNDBIT; break;
+	default:
+		throw std::invalid_argument ("Unsupported event type for setEvent");
+	}
+	if (-1 == ioctl (_fd, UI_SET_EVBIT, type))
+		throw std::system_error (errno, std::system_category (), "ioctl UI_SET_EVBIT");
+	if (-1 == ioctl (_fd, request, code))
+		throw std::system_error (errno, std::system_category (), "ioctl UI_SET_*BIT");
+}
+
 void UInput::setFFEffectsMax (uint32_t effects_max)
 {
 	_uidev.ff_effects_max = effects_max;
@@ -153,8 +199,32 @@ void UInput::create ()
 	}
 	if (-1 == write (_fd, &_uidev, sizeof (struct uinput_user_dev)))
 		throw std::system_error (errno, std::system_category (), "write");
+	// The legacy setup structure has no resolution field, overwrite the
+	// axes that need one before the device is created.
+	for (unsigned int code = 0; code < ABS_CNT; ++code) {
+		if (_absres[code] == 0)
+			continue;
+#ifdef UI_ABS_SETUP
+		struct uinput_abs_setup abs;
+		memset (&abs, 0, sizeof (struct uinput_abs_setup));
+		abs.code = code;
+		abs.absinfo.minimum = _uidev.absmin[code];
+		abs.absinfo.maximum = _uidev.absmax[code];
+		abs.absinfo.fuzz = _uidev.absfuzz[code];
+		abs.absinfo.flat = _uidev.absflat[code];
+		abs.absinfo.resolution = _absres[code];
+		if (-1 == ioctl (_fd, UI_ABS_SETUP, &abs))
+			Log::warning () << "Cannot set uinput axis resolution: " << strerror (errno) << std::endl;
+#else
+		Log::warning () << "uinput axis resolution is not supported" << std::endl;
+		break;
+#endif
+	}
 	if (-1 == ioctl (_fd, UI_DEV_CREATE))
 		throw std::system_error (errno, std::system_category (), "ioctl UI_DEV_CREATE");
+	for (unsigned int code: { REP_DELAY, REP_PERIOD })
+		if (_rep[code] > 0)
+			sendEvent (EV_REP, code, _rep[code]);
 	_thread = std::thread (&UInput::readEvents, this);
 }
 
@@ -191,6 +261,7 @@ void UInput::sendSyn (uint16_t code)
 
 void UInput::sendEvent (uint16_t type, uint16_t code, int32_t value)
 {
+	Trace::Span span ("uinput", "UInput write");
 	struct input_event ev;
 	memset (&ev, 0, sizeof (struct input_event));
 	ev.type = type;
@@ -200,6 +271,13 @@ void UInput::sendEvent (uint16_t type, uint16_t code, int32_t value)
 		throw std::system_error (errno, std::system_category (), "write");
 }
 
+void UInput::sendEvents (const struct input_event *events, std::size_t count)
+{
+	Trace::Span span ("uinput", "UInput bulk write");
+	if (-1 == write (_fd, events, count * sizeof (struct input_event)))
+		throw std::system_error (errno, std::system_category (), "write");
+}
+
 void UInput::setFFUploadEffect (std::function<void (int, std::map<std::string, int>)> ff_upload_effect)
 {
 	_ff_upload_effect = ff_upload_effect;
@@ -276,7 +354,7 @@ void UInput::readEvents ()
 	int ret;
 	int nfds = std::max (_fd, _pipe[0]) + 1;
 	fd_set fds;
-	Log::debug () << "UInput thread" << std::endl;
+	LOG (Debug) << "UInput thread" << std::endl;
 	while (true) {
 		FD_ZERO (&fds);
 		FD_SET (_fd, &fds);
@@ -300,12 +378,12 @@ void UInput::readEvents ()
 			case EV_FF:
 				switch (ev.code) {
 				case FF_GAIN:
-					Log::debug () << "FF: set gain " << ev.value << std::endl;
+					LOG (Debug) << "FF: set gain " << ev.value << std::endl;
 					_ff_set_gain (ev.value);
 					break;
 
 				default:
-					Log::debug () << "FF: event " << ev.code << ", " << ev.value << std::endl;
+					LOG (Debug) << "FF: event " << ev.code << ", " << ev.value << std::endl;
 					if (ev.value)
 						_ff_start (ev.code);
 					else
@@ -322,7 +400,7 @@ void UInput::readEvents ()
 					ret = ioctl (_fd, UI_BEGIN_FF_UPLOAD, &upload);
 					if (ret == -1)
 						throw std::system_error (errno, std::system_category (), "ioctl UI_BEGIN_FF_UPLOAD");
-					Log::debug () << "Upload effect " << upload.effect.id << ", type: " << upload.effect.type << std::endl;
+					LOG (Debug) << "Upload effect " << upload.effect.id << ", type: " << upload.effect.type << std::endl;
 					effectToMap (properties, &upload.effect);
 					_ff_upload_effect (upload.effect.id, properties);
 					upload.retval = 0;
@@ -355,7 +433,7 @@ void UInput::readEvents ()
 		if (FD_ISSET (_pipe[0], &fds)) {
 			char c;
 			read (_pipe[0], &c, sizeof (char));
-			Log::debug () << "Interrupt uinput read thread" << std::endl;
+			LOG (Debug) << "Interrupt uinput read thread" << std::endl;
 			break;
 		}
 	}
@@ -370,6 +448,10 @@ const JSFunctionSpec UInput::js_fs[] = {
 	jstpl::make_method<&UInput::setAbs> ("setAbs"),
 	jstpl::make_method<&UInput::setRel> ("setRel"),
 	jstpl::make_method<&UInput::setFF> ("setFF"),
+	jstpl::make_method<&UInput::setAbsResolution> ("setAbsResolution"),
+	jstpl::make_method<&UInput::setProp> ("setProp"),
+	jstpl::make_method<&UInput::setRepeat> ("setRepeat"),
+	jstpl::make_method<&UInput::setEvent> ("setEvent"),
 	jstpl::make_method<&UInput::setFFEffectsMax> ("setFFEffectsMax"),
 	jstpl::make_method<&UInput::sendKey> ("sendKey"),
 	jstpl::make_method<&UInput::sendAbs> ("sendAbs"),
@@ -20,6 +20,7 @@
 #define UINPUT_H
 
 #include <cstdint>
+#include <cstddef>
 #include <thread>
 #include <map>
 #include "../jstpl/jstpl.h"
@@ -50,6 +51,24 @@ public:
 	void setAbs (uint16_t code, int32_t min, int32_t max, int32_t fuzz, int32_t flat);
 	void setRel (uint16_t code);
 	void setFF (uint16_t code);
+	/**
+	 * Set the resolution of an absolute axis already enabled with setAbs.
+	 */
+	void setAbsResolution (uint16_t code, int32_t resolution);
+	/**
+	 * Set an input property (INPUT_PROP_*).
+	 */
+	void setProp (uint16_t prop);
+	/**
+	 * Enable kernel autorepeat with the given delay and period (in ms).
+	 * Zero values keep the kernel defaults.
+	 */
+	void setRepeat (int32_t delay, int32_t period);
+	/**
+	 * Enable an event code for types without parameters
+	 * (EV_KEY, EV_REL, EV_MSC, EV_SW, EV_LED, EV_SND).
+	 */
+	void setEvent (uint16_t type, uint16_t code);
 	void setFFEffectsMax (uint32_t effects_max);
 
 	void create ();
@@ -60,6 +79,10 @@ public:
 	void sendRel (uint16_t code, int32_t value);
 	void sendSyn (uint16_t code = 0);
 	void sendEvent (uint16_t type, uint16_t code, int32_t value);
+	/**
+	 * Send several events with a single write.
+	 */
+	void sendEvents (const struct input_event *events, std::size_t count);
 
 	void setFFUploadEffect (std::function<void (int, std::map<std::string, int>)>);
 	void setFFEraseEffect (std::function<void (int)>);
@@ -77,6 +100,8 @@ private:
 	void readEvents ();
 
 	struct uinput_user_dev _uidev;
+	int32_t _absres[ABS_CNT];
+	int32_t _rep[REP_CNT];
 	bool _use_ff;
 	int _fd;
 	int _pipe[2];
@@ -19,10 +19,12 @@
 #include "EventDevice.h"
 
 #include <iostream>
+#include "../Trace.h"
 
 extern "C" {
 #include <unistd.h>
 #include <fcntl.h>
+#include <time.h>
 }
 
 EventDevice::EventDevice (const std::string &path)
@@ -39,6 +41,11 @@ EventDevice::EventDevice (const std::string &path)
 		close (_fd);
 		throw std::runtime_error ("libevdev_new_from_fd failed");
 	}
+	// Timestamps must be comparable with other devices
+	ret = libevdev_set_clock_id (_dev, CLOCK_MONOTONIC);
+	if (ret != 0)
+		Log::warning () << "Failed to use monotonic clock for " << path
+				<< ": " << strerror (-ret) << std::endl;
 	if (-1 == pipe2 (_pipe, O_CLOEXEC)) {
 		libevdev_free (_dev);
 		close (_fd);
@@ -76,6 +83,7 @@ void EventDevice::start ()
 {
 	assert (!_thread.joinable ());
 	_thread = std::thread ([this] () {
+		initReaderThread ("evdev-reader");
 		try {
 			readEvents ();
 		}
@@ -96,11 +104,10 @@ void EventDevice::stop ()
 
 void EventDevice::readEvents ()
 {
-	int ret;
 	fd_set set;
 	int nfds = std::max (_fd, _pipe[0]) + 1;
 
-	do {
+	while (true) {
 		FD_ZERO (&set);
 		FD_SET (_fd, &set);
 		FD_SET (_pipe[0], &set);
@@ -110,28 +117,56 @@ void EventDevice::readEvents ()
 				throw std::system_error (errno, std::system_category (), "select");
 		}
 
+		if (FD_ISSET (_pipe[0], &set)) {
+			char c;
+			read (_pipe[0], &c, sizeof (char));
+			return;
+		}
 		if (FD_ISSET (_fd, &set)) {
+			Trace::Span span ("device", "EventDevice read");
+			// libevdev fills its queue with a single read and keeps
+			// the device state, events are then grouped in frames.
 			struct input_event ev;
+			int ret;
 			do {
 				ret = libevdev_next_event (_dev, LIBEVDEV_READ_FLAG_NORMAL, &ev);
-
-				if (ret == LIBEVDEV_READ_STATUS_SUCCESS) {
-					simpleEventRead (ev.type, ev.code, ev.value);
-				}
-				while (ret == LIBEVDEV_READ_STATUS_SYNC) {
-					simpleEventRead (ev.type, ev.code, ev.value);
-					ret = libevdev_next_event (_dev, LIBEVDEV_READ_FLAG_SYNC, &ev);
-				}
+				if (ret == LIBEVDEV_READ_STATUS_SUCCESS)
+					processEvent (ev);
+				else if (ret == LIBEVDEV_READ_STATUS_SYNC)
+					resync ();
 			} while (ret >= 0);
+			if (ret != -EAGAIN && ret != -EINTR) {
+				Log::error () << "libevdev_next_event: " << strerror (-ret) << std::endl;
+				error.emit ();
+				return;
+			}
 		}
-		if (FD_ISSET (_pipe[0], &set)) {
-			char c;
-			read (_pipe[0], &c, sizeof (char));
-			return;
-		}
-	} while (!(ret < 0 && ret != -EAGAIN));
-	Log::error () << "libevdev_next_event: " << strerror (-ret) << std::endl;
-	error.emit ();
+	}
+}
+
+void EventDevice::processEvent (const struct input_event &ev)
+{
+	setEventTime (monotonicTime (ev.time));
+	simpleEventRead (ev.type, ev.code, ev.value);
+	if (frame.empty ())
+		return;
+	if (ev.type == EV_SYN && ev.code == SYN_REPORT) {
+		frame.emit (_frame, monotonicTime (ev.time));
+		_frame.clear ();
+	}
+	else
+		_frame.insert (_frame.end (), { ev.type, ev.code, ev.value });
+}
+
+void EventDevice::resync ()
+{
+	Log::warning () << "Events dropped on " << name () << ", syncing." << std::endl;
+	// The partial frame is replaced by the sync events, which end
+	// with their own SYN_REPORT.
+	_frame.clear ();
+	struct input_event ev;
+	while (LIBEVDEV_READ_STATUS_SYNC == libevdev_next_event (_dev, LIBEVDEV_READ_FLAG_SYNC, &ev))
+		processEvent (ev);
 }
 
 std::string EventDevice::driver () const
@@ -166,6 +201,11 @@ void EventDevice::grab (bool grab_mode)
 	}
 }
 
+const struct libevdev *EventDevice::evdev () const
+{
+	return _dev;
+}
+
 InputDevice::Event EventDevice::getEvent (InputDevice::Event event)
 {
 	event["value"] = getSimpleEvent (event["type"], event["code"]);
@@ -193,4 +233,9 @@ JSObject *EventDevice::makeJsObject (const jstpl::Thread *thread)
 	return thread->makeJsObject (this);
 }
 
+void EventDevice::releaseJsObject (jstpl::Thread *thread)
+{
+	thread->releaseJsObject (this);
+}
+
 bool EventDevice::_registered = jstpl::ClassManager::registerClass<EventDevice::JsClass> ("InputDevice");
@@ -64,18 +64,27 @@ public:
 	 */
 	void grab (bool grab_mode);
 
+	/**
+	 * libevdev device, for reading the device capabilities.
+	 */
+	const struct libevdev *evdev () const;
+
 	static const JSClass js_class;
 	static const JSFunctionSpec js_fs[];
 	typedef jstpl::AbstractClass<EventDevice> JsClass;
 
 	JSObject *makeJsObject (const jstpl::Thread *thread) override;
+	void releaseJsObject (jstpl::Thread *thread) override;
 
 private:
 	void readEvents ();
+	void processEvent (const struct input_event &ev);
+	void resync ();
 
 	int _fd, _pipe[2];
 	std::thread _thread;
 	struct libevdev *_dev;
+	EventFrame _frame;
 
 	static bool _registered;
 };
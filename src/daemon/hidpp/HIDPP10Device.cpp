@@ -57,6 +57,20 @@ void HIDPP10Device::stop ()
 		evdev.stop ();
 }
 
+void HIDPP10Device::setReaderThreadPolicy (const ThreadPolicy &policy)
+{
+	InputDevice::setReaderThreadPolicy (policy);
+	for (auto &evdev: _evdev)
+		evdev.setReaderThreadPolicy (policy);
+}
+
+std::string HIDPP10Device::readerThreadPolicy () const
+{
+	if (_evdev.empty ())
+		return InputDevice::readerThreadPolicy ();
+	return _evdev.front ().readerThreadPolicy ();
+}
+
 InputDevice::Event HIDPP10Device::getEvent (InputDevice::Event event)
 {
 	throw std::invalid_argument ("invalid event type");
@@ -376,4 +390,11 @@ JSObject *HIDPP10Device::makeJsObject (const jstpl::Thread *thread)
 	return thread->makeJsObject (this);
 }
 
+void HIDPP10Device::releaseJsObject (jstpl::Thread *thread)
+{
+	thread->releaseJsObject (this);
+	for (auto &evdev: _evdev)
+		evdev.releaseJsObject (thread);
+}
+
 bool HIDPP10Device::_registered = jstpl::ClassManager::registerClass<HIDPP10Device::JsClass> ("InputDevice");
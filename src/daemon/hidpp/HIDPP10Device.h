@@ -51,6 +51,13 @@ public:
 	InputDevice::Event getEvent (InputDevice::Event event) override;
 	int32_t getSimpleEvent (uint16_t type, uint16_t code) override;
 
+	/**
+	 * Events are read by the associated event devices, the settings
+	 * are applied to their reader threads.
+	 */
+	void setReaderThreadPolicy (const ThreadPolicy &policy) override;
+	std::string readerThreadPolicy () const override;
+
 	std::string driver () const override;
 	std::string name () const override;
 	std::string serial () const override;
@@ -173,6 +180,7 @@ public:
 	typedef jstpl::AbstractClass<HIDPP10Device> JsClass;
 
 	virtual JSObject *makeJsObject (const jstpl::Thread *thread);
+	virtual void releaseJsObject (jstpl::Thread *thread);
 
 private:
 	bool eventHandler (const HIDPP::Report &report);
@@ -18,12 +18,19 @@
 
 #include "HIDPP20Device.h"
 
+#include "../Trace.h"
+#include "../Log.h"
+#include "HIDPPFeatureCache.h"
+
 #include <hidpp20/IFeatureSet.h>
+#include <hidpp20/IFirmwareInfo.h>
 #include <hidpp20/IMouseButtonSpy.h>
 #include <hidpp20/IOnboardProfiles.h>
 #include <hidpp20/IReprogControlsV4.h>
 #include <hidpp20/UnsupportedFeature.h>
 
+#include <sstream>
+
 struct HIDPP20Device::MouseButtonSpy
 {
 	HIDPP20::IMouseButtonSpy i;
@@ -41,9 +48,13 @@ struct HIDPP20Device::OnboardProfiles
 	HIDPP20::IOnboardProfiles i;
 	HIDPP20::IOnboardProfiles::MemoryType current_profile_mem_type;
 	unsigned int current_profile_page, current_dpi_index;
+	// Reused event storage
+	InputDevice::Event profile_event, dpi_event;
 
 	OnboardProfiles (HIDPP20::Device *device):
-		i (device)
+		i (device),
+		profile_event ({ { "type", EventOnboardProfilesCurrentProfile } }),
+		dpi_event ({ { "type", EventOnboardProfilesCurrentDPIIndex } })
 	{
 		std::tie (current_profile_mem_type,
 			  current_profile_page) = i.getCurrentProfile ();
@@ -55,27 +66,71 @@ struct HIDPP20Device::ReprogControlsV4
 {
 	HIDPP20::IReprogControlsV4 i;
 	std::vector<uint16_t> buttons;
+	// Reused event storage
+	InputDevice::Event button_event;
 
 	ReprogControlsV4 (HIDPP20::Device *device):
-		i (device)
+		i (device),
+		button_event ({ { "type", EventReprogControlsV4Button } })
 	{
 	}
 };
 
+/**
+ * Describe the firmware entities of \p device.
+ *
+ * \returns an empty string if the device does not support IFirmwareInfo.
+ */
+static std::string getFirmwareVersion (HIDPP20::Device *device)
+{
+	try {
+		HIDPP20::IFirmwareInfo fw (device);
+		std::stringstream ss;
+		unsigned int count = fw.getEntityCount ();
+		for (unsigned int i = 0; i < count; ++i) {
+			auto info = fw.getInfo (i);
+			ss << (i > 0 ? " " : "") << info.prefix
+			   << std::hex << info.number << "." << info.revision << "." << info.build;
+		}
+		return ss.str ();
+	}
+	catch (HIDPP20::UnsupportedFeature &) {
+		return std::string ();
+	}
+}
+
 HIDPP20Device::HIDPP20Device (HIDPP::Device &&device):
 	_device (std::move (device)),
 	_send_raw_events (false)
 {
 	HIDPP20::IFeatureSet feature_set (&_device);
 	unsigned int feature_count = feature_set.getCount ();
-	for (unsigned int i = 0; i < feature_count; ++i) {
-		bool hidden;
-		uint16_t id = feature_set.getFeatureID (i, nullptr, &hidden, nullptr);
-		if (hidden)
-			continue;
-		_features_id_index.emplace (id, i);
-		_features_index_id.emplace (i, id);
+	HIDPPFeatureCache::Key cache_key;
+	cache_key.product_id = _device.productID ();
+	std::tie (cache_key.protocol_major, cache_key.protocol_minor) = _device.protocolVersion ();
+	cache_key.name = _device.name ();
+	cache_key.firmware = getFirmwareVersion (&_device);
+	// Only query every feature when the cached table is missing or stale,
+	// devices without firmware version are never cached.
+	std::optional<HIDPPFeatureCache::FeatureTable> cached;
+	if (!cache_key.firmware.empty ())
+		cached = HIDPPFeatureCache::load (cache_key, feature_count);
+	if (cached) {
+		_features_index_id = std::move (*cached);
+	}
+	else {
+		for (unsigned int i = 0; i < feature_count; ++i) {
+			bool hidden;
+			uint16_t id = feature_set.getFeatureID (i, nullptr, &hidden, nullptr);
+			if (hidden)
+				continue;
+			_features_index_id.emplace (i, id);
+		}
+		if (!cache_key.firmware.empty ())
+			HIDPPFeatureCache::store (cache_key, feature_count, _features_index_id);
 	}
+	for (const auto &p: _features_index_id)
+		_features_id_index.emplace (p.second, p.first);
 
 	if (hasFeature (HIDPP20::IMouseButtonSpy::ID))
 		_mbs = std::make_unique<MouseButtonSpy> (&_device);
@@ -83,6 +138,7 @@ HIDPP20Device::HIDPP20Device (HIDPP::Device &&device):
 		_op = std::make_unique<OnboardProfiles> (&_device);
 	if (hasFeature (HIDPP20::IReprogControlsV4::ID))
 		_rc4 = std::make_unique<ReprogControlsV4> (&_device);
+	declareComplexEvent (EventReprogControlsV4RawXY, { "x", "y" });
 }
 
 HIDPP20Device::~HIDPP20Device ()
@@ -99,8 +155,18 @@ void HIDPP20Device::start ()
 	auto event_handler = [this] (const HIDPP::Report &report) {
 		return eventHandler (report);
 	};
-	HIDPP20::IFeatureSet feature_set (&_device);
-	unsigned int feature_count = feature_set.getCount ();
+	// Build the feature index dispatch tables
+	unsigned int table_size = _features_index_id.empty () ? 0 : _features_index_id.rbegin ()->first + 1;
+	_event_handlers.assign (table_size, nullptr);
+	_index_features.assign (table_size, -1);
+	for (const auto &p: _features_index_id)
+		_index_features[p.first] = p.second;
+	if (_mbs)
+		_event_handlers[_mbs->i.index ()] = &HIDPP20Device::mouseButtonSpyEvent;
+	if (_op)
+		_event_handlers[_op->i.index ()] = &HIDPP20Device::onboardProfilesEvent;
+	if (_rc4)
+		_event_handlers[_rc4->i.index ()] = &HIDPP20Device::reprogControlsV4Event;
 	for (const auto &p: _features_id_index) {
 		auto it = dispatcher->registerEventHandler (index, p.second, event_handler);
 		_listener_iterators.push_back (it);
@@ -117,117 +183,129 @@ void HIDPP20Device::stop ()
 
 bool HIDPP20Device::eventHandler (const HIDPP::Report &report)
 {
-	if (_mbs && report.featureIndex () == _mbs->i.index ()) {
-		switch (report.function ()) {
-		case HIDPP20::IMouseButtonSpy::MouseButtonEvent: {
-			uint16_t new_buttons = HIDPP20::IMouseButtonSpy::mouseButtonEvent (report);
-			uint16_t button_changed = _mbs->buttons ^ new_buttons;
-			_mbs->buttons = new_buttons;
-			for (unsigned int i = 0; i < 16; ++i) {
-				if (!(button_changed & (1<<i)))
-					continue;
-				eventRead ({
-					{ "type", EV_KEY },
-					{ "code", BTN_MOUSE + i },
-					{ "value", (new_buttons & (1<<i) ? 1 : 0) },
-				});
-			}
-			break;
-		}
-		default:
-			Log::warning () << "Unsupported event from MouseButtonSpy: " << report.function () << std::endl;
+	Trace::Span span ("driver", "HIDPP20Device::eventHandler");
+	// The dispatcher thread is shared by every device of the node
+	updateReaderThread ("hidpp-dispatch");
+	// HID++ reports have no timestamp, use the dispatch time
+	setEventTime (monotonicTime ());
+	unsigned int index = report.featureIndex ();
+	if (index < _event_handlers.size () && _event_handlers[index])
+		(this->*_event_handlers[index]) (report);
+	if (!rawEvent.empty () || (_send_raw_events && !event.empty ())) {
+		if (index >= _index_features.size () || _index_features[index] < 0) {
+			Log::error () << "Received HID++ report with unknown feature index: " << index << std::endl;
+			return true;
 		}
+		rawEventRead (_index_features[index], report);
 	}
-	else if (_op && report.featureIndex () == _op->i.index ()) {
-		switch (report.function ()) {
-		case HIDPP20::IOnboardProfiles::CurrentProfileChanged:
-			std::tie (_op->current_profile_mem_type,
-				  _op->current_profile_page) = HIDPP20::IOnboardProfiles::currentProfileChanged (report);
-			eventRead ({
-				{ "type", EventOnboardProfilesCurrentProfile },
-				{ "rom", _op->current_profile_mem_type },
-				{ "index", _op->current_profile_page },
-			});
-			break;
-		case HIDPP20::IOnboardProfiles::CurrentDPIIndexChanged:
-			_op->current_dpi_index = HIDPP20::IOnboardProfiles::currentDPIIndexChanged (report);
-			eventRead ({
-				{ "type", EventOnboardProfilesCurrentDPIIndex },
-				{ "index", _op->current_dpi_index },
-			});
-			break;
-		default:
-			Log::warning () << "Unsupported event from OnboardProfiles: " << report.function () << std::endl;
+	return true;
+}
+
+void HIDPP20Device::mouseButtonSpyEvent (const HIDPP::Report &report)
+{
+	switch (report.function ()) {
+	case HIDPP20::IMouseButtonSpy::MouseButtonEvent: {
+		uint16_t new_buttons = HIDPP20::IMouseButtonSpy::mouseButtonEvent (report);
+		uint16_t button_changed = _mbs->buttons ^ new_buttons;
+		_mbs->buttons = new_buttons;
+		for (unsigned int i = 0; i < 16; ++i) {
+			if (!(button_changed & (1<<i)))
+				continue;
+			simpleEventRead (EV_KEY, BTN_MOUSE + i, (new_buttons & (1<<i) ? 1 : 0));
 		}
+		break;
 	}
-	else if (_rc4 && report.featureIndex () == _rc4->i.index ()) {
-		switch (report.function ()) {
-		case HIDPP20::IReprogControlsV4::DivertedButtonEvent: {
-			auto new_buttons = HIDPP20::IReprogControlsV4::divertedButtonEvent (report);
-			unsigned int old_i = 0, new_i = 0;
-			for (; old_i < _rc4->buttons.size (); ++old_i) {
-				if (new_i >= new_buttons.size () ||
-				    _rc4->buttons[old_i] != new_buttons[new_i]) {
-					// An old button is missing, it was released.
-					eventRead ({
-						{ "type", EventReprogControlsV4Button },
-						{ "code", _rc4->buttons[old_i] },
-						{ "value", 0 },
-					});
-				}
-				else {
-					// Same button in both array: no change.
-					++new_i;
-				}
-			}
-			for (; new_i < new_buttons.size (); ++new_i) {
-				// New buttons that were not in the old vector are pressed.
-				eventRead ({
-					{ "type", EventReprogControlsV4Button },
-					{ "code", new_buttons[new_i] },
-					{ "value", 1 },
-				});
-			}
-			_rc4->buttons = std::move (new_buttons);
-			break;
-		}
+	default:
+		Log::warning () << "Unsupported event from MouseButtonSpy: " << report.function () << std::endl;
+	}
+}
 
-		case HIDPP20::IReprogControlsV4::DivertedRawXYEvent: {
-			auto move = HIDPP20::IReprogControlsV4::divertedRawXYEvent (report);
-			eventRead ({
-				{ "type", EventReprogControlsV4RawXY },
-				{ "x", move.x },
-				{ "y", move.y },
-			});
-			break;
+void HIDPP20Device::onboardProfilesEvent (const HIDPP::Report &report)
+{
+	switch (report.function ()) {
+	case HIDPP20::IOnboardProfiles::CurrentProfileChanged:
+		std::tie (_op->current_profile_mem_type,
+			  _op->current_profile_page) = HIDPP20::IOnboardProfiles::currentProfileChanged (report);
+		if (!event.empty ()) {
+			_op->profile_event["rom"] = _op->current_profile_mem_type;
+			_op->profile_event["index"] = _op->current_profile_page;
+			eventRead (_op->profile_event);
 		}
+		break;
+	case HIDPP20::IOnboardProfiles::CurrentDPIIndexChanged:
+		_op->current_dpi_index = HIDPP20::IOnboardProfiles::currentDPIIndexChanged (report);
+		if (!event.empty ()) {
+			_op->dpi_event["index"] = _op->current_dpi_index;
+			eventRead (_op->dpi_event);
 		}
-
+		break;
+	default:
+		Log::warning () << "Unsupported event from OnboardProfiles: " << report.function () << std::endl;
 	}
+}
 
-	if (_send_raw_events) {
-		HIDPP20::IFeatureSet feature_set (&_device);
-		auto feature = _features_index_id.find (report.featureIndex ());
-		if (feature == _features_index_id.end ()) {
-			Log::error () << "Received HID++ report with unknown feature index: " << report.featureIndex () << std::endl;
-			return true;;
+void HIDPP20Device::reprogControlsV4Button (uint16_t control, bool pressed)
+{
+	if (event.empty ())
+		return;
+	_rc4->button_event["code"] = control;
+	_rc4->button_event["value"] = pressed ? 1 : 0;
+	eventRead (_rc4->button_event);
+}
+
+void HIDPP20Device::reprogControlsV4Event (const HIDPP::Report &report)
+{
+	switch (report.function ()) {
+	case HIDPP20::IReprogControlsV4::DivertedButtonEvent: {
+		auto new_buttons = HIDPP20::IReprogControlsV4::divertedButtonEvent (report);
+		unsigned int old_i = 0, new_i = 0;
+		for (; old_i < _rc4->buttons.size (); ++old_i) {
+			if (new_i >= new_buttons.size () ||
+			    _rc4->buttons[old_i] != new_buttons[new_i]) {
+				// An old button is missing, it was released.
+				reprogControlsV4Button (_rc4->buttons[old_i], false);
+			}
+			else {
+				// Same button in both array: no change.
+				++new_i;
+			}
 		}
-		Event event = {
-			{ "type", EventRawHIDPP },
-			{ "feature", feature->second },
-			{ "function", report.function () },
-		};
-		unsigned int i = 0;
-		for (auto it = report.parameterBegin ();
-		     it != report.parameterEnd ();
-		     ++i, ++it) {
-			std::stringstream key;
-			key << "data" << i;
-			event.emplace (key.str (), *it);
+		for (; new_i < new_buttons.size (); ++new_i) {
+			// New buttons that were not in the old vector are pressed.
+			reprogControlsV4Button (new_buttons[new_i], true);
 		}
-		eventRead (event);
+		_rc4->buttons = std::move (new_buttons);
+		break;
 	}
-	return true;
+
+	case HIDPP20::IReprogControlsV4::DivertedRawXYEvent: {
+		auto move = HIDPP20::IReprogControlsV4::divertedRawXYEvent (report);
+		complexEventRead (EventReprogControlsV4RawXY, -1, {
+			move.x,
+			move.y,
+		});
+		break;
+	}
+	}
+}
+
+void HIDPP20Device::rawEventRead (uint16_t feature, const HIDPP::Report &report)
+{
+	_raw_report.assign (report.parameterBegin (), report.parameterEnd ());
+	rawEvent.emit (feature, report.function (), _raw_report, eventTime ());
+	if (!_send_raw_events || event.empty ())
+		return;
+	// Legacy map event, the "dataN" keys are only built once
+	while (_raw_data_keys.size () < _raw_report.size ())
+		_raw_data_keys.push_back ("data" + std::to_string (_raw_data_keys.size ()));
+	Event e = {
+		{ "type", EventRawHIDPP },
+		{ "feature", feature },
+		{ "function", report.function () },
+	};
+	for (unsigned int i = 0; i < _raw_report.size (); ++i)
+		e.emplace (_raw_data_keys[i], _raw_report[i]);
+	eventRead (e);
 }
 
 InputDevice::Event HIDPP20Device::getEvent (InputDevice::Event event)
@@ -517,6 +595,10 @@ const JSFunctionSpec HIDPP20Device::js_fs[] = {
 	#interface_name "_" #enum_name "_" #value_name, \
 	HIDPP20::I##interface_name::enum_name::value_name \
 }
+const jstpl::SignalMap HIDPP20Device::js_signals = {
+	{ "rawEvent", jstpl::make_typed_array_signal_connector (&HIDPP20Device::rawEvent) },
+};
+
 #define DEFINE_CONSTANT(value) { #value, value }
 const std::pair<std::string, int> HIDPP20Device::js_int_const[] = {
 	DEFINE_HIDPP_FEATURE(MouseButtonSpy),
@@ -535,4 +617,9 @@ JSObject *HIDPP20Device::makeJsObject (const jstpl::Thread *thread)
 	return thread->makeJsObject (this);
 }
 
+void HIDPP20Device::releaseJsObject (jstpl::Thread *thread)
+{
+	thread->releaseJsObject (this);
+}
+
 bool HIDPP20Device::_registered = jstpl::ClassManager::registerClass<HIDPP20Device::JsClass> ("InputDevice");
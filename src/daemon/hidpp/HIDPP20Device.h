@@ -38,8 +38,12 @@ class IReprogControlsV4;
 /**
  * Manages devices using Logitech's HID++ 2.0 or later protocol.
  *
- * Events from every device supported feature are received and are sent as
- * \ref EventRawHIDPP events if activated with \ref sendRawEvents.
+ * Events from every device supported feature are received and are sent
+ * through the \ref rawEvent signal, and as \ref EventRawHIDPP events if
+ * activated with \ref sendRawEvents.
+ *
+ * Reports are dispatched to the parsers of the supported features with a
+ * table indexed by feature index, built when the device is started.
  *
  * Features supported by this class are also sent as parsed events. Currently
  * supported features are:
@@ -76,9 +80,25 @@ public:
 
 	/**
 	 * Enables sending raw events for every feature.
+	 *
+	 * Only needed for \ref EventRawHIDPP events, \ref rawEvent is
+	 * always sent.
 	 */
 	void sendRawEvents (bool enable);
 
+	/**
+	 * Parameter bytes of a raw HID++ report.
+	 */
+	typedef std::vector<uint8_t> RawReport;
+	/**
+	 * Signal for every HID++ report received from the device.
+	 *
+	 * Parameters are the feature ID, the function (event) index and the
+	 * report parameters. JS callbacks receive the parameters as an
+	 * Uint8Array that is reused for every call.
+	 */
+	sigc::signal<void (uint16_t, uint8_t, const RawReport &, double)> rawEvent;
+
 	enum EventType {
 		/**
 		 * Raw HID++ events.
@@ -273,12 +293,19 @@ public:
 	static const JSClass js_class;
 	static const JSFunctionSpec js_fs[];
 	static const std::pair<std::string, int> js_int_const[];
+	static const jstpl::SignalMap js_signals;
 	typedef jstpl::AbstractClass<HIDPP20Device> JsClass;
 
 	JSObject *makeJsObject (const jstpl::Thread *thread) override;
+	void releaseJsObject (jstpl::Thread *thread) override;
 
 private:
 	bool eventHandler (const HIDPP::Report &report);
+	void mouseButtonSpyEvent (const HIDPP::Report &report);
+	void onboardProfilesEvent (const HIDPP::Report &report);
+	void reprogControlsV4Event (const HIDPP::Report &report);
+	void reprogControlsV4Button (uint16_t control, bool pressed);
+	void rawEventRead (uint16_t feature, const HIDPP::Report &report);
 
 	HIDPP20::Device _device;
 	std::map<uint16_t, uint8_t> _features_id_index;
@@ -286,6 +313,14 @@ private:
 
 	bool _send_raw_events;
 
+	// Dispatch tables indexed by feature index, built by start ()
+	typedef void (HIDPP20Device::*FeatureEventHandler) (const HIDPP::Report &);
+	std::vector<FeatureEventHandler> _event_handlers;
+	std::vector<int> _index_features; // feature ID or -1
+	// Reused raw event storage
+	RawReport _raw_report;
+	std::vector<std::string> _raw_data_keys;
+
 	struct MouseButtonSpy;
 	std::unique_ptr<MouseButtonSpy> _mbs;
 
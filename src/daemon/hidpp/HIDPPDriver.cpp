@@ -26,6 +26,7 @@
 #include <hidpp10/defs.h>
 
 #include "../Log.h"
+#include "../ThreadPolicy.h"
 
 extern "C" {
 #include <libudev.h>
@@ -181,7 +182,7 @@ void HIDPPDriver::addDevice (Node *node, HIDPP::DeviceIndex index, const std::ve
 		}
 	}
 	catch (std::exception &e) {
-		Log::debug () << "Ignoring HID++ device ("
+		LOG (Debug) << "Ignoring HID++ device ("
 			      << "name = \"" << node->dispatcher->name ()
 			      << "\", index = " << static_cast<int> (index)
 			      << "): " << e.what () << std::endl;
@@ -204,6 +205,9 @@ void HIDPPDriver::removeDevice (Node *node, HIDPP::DeviceIndex index)
 
 void HIDPPDriver::dispatcherRun (Node *node)
 {
+	// Name the thread, HID++ 2.0 devices apply their settings when
+	// handling their events.
+	ThreadPolicy ().apply ("hidpp-dispatch");
 	node->dispatcher->run ();
 	for (auto &p: node->devices)
 		inputDeviceRemoved (p.second.get ());
@@ -0,0 +1,157 @@
+/*
+ * Copyright 2017 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "HIDPPFeatureCache.h"
+
+#include "../Log.h"
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+
+extern "C" {
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+std::optional<HIDPPFeatureCache::FeatureTable> HIDPPFeatureCache::load (const Key &key, unsigned int feature_count)
+{
+	if (_cache_path.empty ())
+		return std::nullopt;
+	std::ifstream file (filename (key));
+	if (!file)
+		return std::nullopt;
+	// First lines: name and firmware, then count and checksum, then "index id" pairs
+	std::string name, firmware;
+	unsigned int count;
+	uint32_t sum;
+	if (!std::getline (file, name) || name != key.name)
+		return std::nullopt;
+	if (!std::getline (file, firmware) || firmware != key.firmware)
+		return std::nullopt;
+	if (!(file >> count >> std::hex >> sum) || count != feature_count)
+		return std::nullopt;
+	FeatureTable table;
+	unsigned int index, id;
+	while (file >> std::dec >> index >> std::hex >> id) {
+		if (index >= feature_count || id > UINT16_MAX)
+			return std::nullopt;
+		table.emplace (index, id);
+	}
+	if (checksum (key, count, table) != sum) {
+		Log::warning () << "Invalid HID++ feature cache for " << key.name << std::endl;
+		return std::nullopt;
+	}
+	return table;
+}
+
+void HIDPPFeatureCache::store (const Key &key, unsigned int feature_count, const FeatureTable &table)
+{
+	if (_cache_path.empty ())
+		return;
+	// Create the cache directory and its parent if needed
+	std::string parent = _cache_path.substr (0, _cache_path.rfind ('/'));
+	for (const auto &dir: { parent, _cache_path }) {
+		if (-1 == mkdir (dir.c_str (), 0700) && errno != EEXIST) {
+			Log::warning () << "Cannot create cache directory " << dir << std::endl;
+			return;
+		}
+	}
+	// Write a temporary file and rename it so readers never see a partial table
+	std::string path = filename (key);
+	std::string tmp_path = path + ".XXXXXX";
+	int fd = mkstemp (&tmp_path[0]);
+	if (fd == -1) {
+		Log::warning () << "Cannot create HID++ feature cache " << tmp_path << std::endl;
+		return;
+	}
+	std::stringstream ss;
+	ss << key.name << "\n"
+	   << key.firmware << "\n"
+	   << feature_count << " " << std::hex << checksum (key, feature_count, table) << "\n";
+	for (const auto &p: table)
+		ss << std::dec << unsigned (p.first) << " " << std::hex << p.second << "\n";
+	std::string content = ss.str ();
+	std::size_t written = 0;
+	while (written < content.size ()) {
+		ssize_t ret = write (fd, content.data () + written, content.size () - written);
+		if (ret == -1 && errno == EINTR)
+			continue;
+		if (ret == -1)
+			break;
+		written += ret;
+	}
+	if (-1 == close (fd) || written < content.size ()) {
+		Log::warning () << "Cannot write HID++ feature cache " << tmp_path << std::endl;
+		unlink (tmp_path.c_str ());
+		return;
+	}
+	if (-1 == std::rename (tmp_path.c_str (), path.c_str ())) {
+		Log::warning () << "Cannot write HID++ feature cache " << path << std::endl;
+		unlink (tmp_path.c_str ());
+	}
+}
+
+std::string HIDPPFeatureCache::filename (const Key &key)
+{
+	std::stringstream ss;
+	ss << _cache_path << "/hidpp20-"
+	   << std::hex << std::setw (4) << std::setfill ('0') << key.product_id
+	   << std::dec << "-" << key.protocol_major << "." << key.protocol_minor;
+	return ss.str ();
+}
+
+uint32_t HIDPPFeatureCache::checksum (const Key &key, unsigned int feature_count, const FeatureTable &table)
+{
+	// FNV-1a
+	uint32_t hash = 2166136261u;
+	auto add = [&hash] (uint8_t byte) {
+		hash = (hash ^ byte) * 16777619u;
+	};
+	for (char c: key.name)
+		add (c);
+	add ('\n');
+	for (char c: key.firmware)
+		add (c);
+	add (feature_count);
+	for (const auto &p: table) {
+		add (p.first);
+		add (p.second >> 8);
+		add (p.second & 0xff);
+	}
+	return hash;
+}
+
+static std::string getCachePath ()
+{
+	const char *xdg_cache_home = std::getenv ("XDG_CACHE_HOME");
+	if (xdg_cache_home && xdg_cache_home[0] == '/')
+		return std::string (xdg_cache_home) + "/input-scripts";
+
+	const char *home = std::getenv ("HOME");
+	if (home)
+		return std::string (home) + "/.cache/input-scripts";
+
+	Log::warning () << "No cache path set." << std::endl;
+	return std::string ();
+}
+
+const std::string HIDPPFeatureCache::_cache_path = getCachePath ();
@@ -0,0 +1,78 @@
+/*
+ * Copyright 2017 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef HIDPP_FEATURE_CACHE_H
+#define HIDPP_FEATURE_CACHE_H
+
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+
+/**
+ * Disk cache of HID++ 2.0 feature tables.
+ *
+ * Reading the feature table of a device takes one round trip per feature,
+ * which is slow over wireless receivers and repeated every time a device
+ * wakes up. Tables are cached in $XDG_CACHE_HOME/input-scripts (or
+ * $HOME/.cache/input-scripts), one file per device model.
+ *
+ * A cached table is only used if the device reports the same firmware
+ * version and feature count and the stored checksum matches the table.
+ */
+class HIDPPFeatureCache
+{
+public:
+	/**
+	 * Visible features: feature ID by feature index.
+	 */
+	typedef std::map<uint8_t, uint16_t> FeatureTable;
+
+	/**
+	 * Identifies a device model and firmware.
+	 */
+	struct Key
+	{
+		uint16_t product_id;
+		unsigned int protocol_major, protocol_minor;
+		std::string name;
+		std::string firmware;
+	};
+
+	/**
+	 * Load the cached table for \p key.
+	 *
+	 * \returns an empty optional if there is no valid cached table for
+	 * a device with \p feature_count features.
+	 */
+	static std::optional<FeatureTable> load (const Key &key, unsigned int feature_count);
+	/**
+	 * Store the table for \p key.
+	 *
+	 * Errors are logged and ignored.
+	 */
+	static void store (const Key &key, unsigned int feature_count, const FeatureTable &table);
+
+private:
+	static std::string filename (const Key &key);
+	static uint32_t checksum (const Key &key, unsigned int feature_count, const FeatureTable &table);
+
+	static const std::string _cache_path;
+};
+
+#endif // HIDPP_FEATURE_CACHE_H
@@ -51,6 +51,13 @@ namespace jstpl
 using IntConstantSpec = std::pair<std::string, int>;
 using SignalConnector = std::function<sigc::connection (JSContext *, JS::HandleValue obj, JS::HandleValue)>;
 using SignalMap = std::map<std::string, SignalConnector>;
+/**
+ * Connector for signals whose names are not known in advance.
+ *
+ * It is used for signal names not found in the class signal map and
+ * receives the requested signal name.
+ */
+using DynamicSignalConnector = std::function<sigc::connection (JSContext *, JS::HandleValue obj, const std::string &, JS::HandleValue)>;
 
 STATIC_ARRAY_POINTER_OR_NULL(const JSPropertySpec, js_ps)
 STATIC_ARRAY_POINTER_OR_NULL(const JSFunctionSpec, js_fs)
@@ -59,6 +66,7 @@ STATIC_ARRAY_POINTER_OR_NULL(const JSFunctionSpec, js_static_fs)
 STATIC_ARRAY_POINTER_OR_NULL(const IntConstantSpec, js_int_const)
 
 STATIC_MEMBER_POINTER_OR_NULL(const SignalMap, js_signals)
+STATIC_MEMBER_POINTER_OR_NULL(const DynamicSignalConnector, js_dynamic_signal)
 
 class BaseClass
 {
@@ -72,9 +80,10 @@ public:
 		_class (&T::js_class),
 		_parent (parent),
 		_proto (cx),
-		_signals (static_member_pointer_or_null_js_signals<T> ())
+		_signals (static_member_pointer_or_null_js_signals<T> ()),
+		_dynamic_signal (static_member_pointer_or_null_js_dynamic_signal<T> ())
 	{
-		Log::debug () << "Initializing class " << T::js_class.name << std::endl;
+		LOG (Debug) << "Initializing class " << T::js_class.name << std::endl;
 		JS::RootedObject parent_proto (cx, parent ? parent->prototype () : JS::NullPtr ());
 		_proto = JS_InitClass (cx, obj, parent_proto, &T::js_class,
 			constructor, nargs,
@@ -101,9 +110,16 @@ public:
 	JSObject *newObjectFromPointer (T *ptr) const
 	{
 		assert (&T::js_class == _class);
-		JSObject *obj = JS_NewObjectWithGivenProto (_cx, &T::js_class, _proto);
+		Thread *thread = static_cast<Thread *> (JS_GetContextPrivate (_cx));
+		JSObject *obj = thread->findWrapper (ptr, &T::js_class);
+		if (obj)
+			return obj;
+		obj = JS_NewObjectWithGivenProto (_cx, &T::js_class, _proto);
+		if (!obj)
+			return nullptr;
 		auto data = new std::pair<bool, T*> (false, ptr);
 		JS_SetPrivate (obj, data);
+		thread->addWrapper (ptr, &T::js_class, obj);
 		return obj;
 	}
 
@@ -124,6 +140,8 @@ public:
 			if (it != _signals->end ())
 				return it->second (_cx, obj, callback);
 		}
+		if (_dynamic_signal)
+			return (*_dynamic_signal) (_cx, obj, signal_name, callback);
 		if (_parent)
 			return _parent->connect (obj, signal_name, callback);
 		else
@@ -136,6 +154,7 @@ private:
 	const BaseClass *_parent;
 	JS::RootedObject _proto;
 	const std::map<std::string, SignalConnector> *_signals;
+	const DynamicSignalConnector *_dynamic_signal;
 };
 
 template<typename T>
@@ -23,6 +23,7 @@
 
 #include <typeinfo>
 #include <tuple>
+#include <utility>
 
 namespace jstpl
 {
@@ -30,85 +31,40 @@ namespace jstpl
 /*
  * Convert JS args to C++ args
  */
-template <typename R, typename... Args>
+template <typename... Args>
 struct ArgConvert
 {
-	template <R (*function) (JSContext *, JS::CallArgs &, Args...), typename... Converted>
-	struct Wrapper
-	{
-		static inline R call (JSContext *cx, JS::CallArgs &jsargs, Converted... args)
-		{
-			constexpr std::size_t n = sizeof...(Converted);
-			typedef typename std::tuple_element<n, std::tuple<Args...>>::type type;
-			typedef typename std::remove_cv<typename std::remove_reference<type>::type>::type base_type;
-			typedef typename ArgConvert<R, Args...>::template Wrapper<function, Converted..., type> wrapper;
-			base_type arg;
-			try {
-				readJSValue (cx, arg, jsargs.get (n));
-			}
-			catch (std::invalid_argument e) {
-				std::string what  = "Argument " + std::to_string (n);
-				throw std::invalid_argument (what + " " + e.what ());
-			}
-			return wrapper::call (cx, jsargs, args..., arg);
-		}
-	};
-
-
-	template <R (*function) (JSContext *, JS::CallArgs &, Args...)>
-	struct Wrapper<function, Args...>
-	{
-		static inline R call (JSContext *cx, JS::CallArgs &jsargs, Args... args)
-		{
-			return function (cx, jsargs, args...);
-		}
-	};
-};
-
-
-/*
- * Template functions for using with ArgConvert::Wrapper
- */
-template <typename R, typename... Args>
-struct functionCall
-{
-	template <R (*function) (Args...)>
-	static R call (JSContext *cx, JS::CallArgs &jsargs, Args... args)
-	{
-		return function (args...);
-	}
-};
+	typedef std::tuple<std::remove_cv_t<std::remove_reference_t<Args>>...> tuple;
 
-template <typename T, typename R, typename... Args>
-struct methodCall
-{
-	template <R (T::*method) (Args...)>
-	static R call (JSContext *cx, JS::CallArgs &jsargs, Args... args)
+	/*
+	 * Convert all arguments into args. On failure, a JS error is
+	 * reported and false is returned.
+	 */
+	static inline bool convert (JSContext *cx, JS::CallArgs &jsargs, tuple &args)
 	{
-		JSObject *obj = jsargs.thisv ().toObjectOrNull ();
-		auto data = static_cast<std::pair<bool, T *> *> (JS_GetPrivate (obj));
-		T *ptr = data->second;
-		return (ptr->*method) (args...);
+		return convert (cx, jsargs, args, std::index_sequence_for<Args...> ());
 	}
-};
 
-template <typename T, typename R, typename... Args>
-struct constMethodCall
-{
-	template <R (T::*method) (Args...) const>
-	static R call (JSContext *cx, JS::CallArgs &jsargs, Args... args)
+private:
+	template <std::size_t... I>
+	static inline bool convert (JSContext *cx, JS::CallArgs &jsargs, tuple &args, std::index_sequence<I...>)
 	{
-		JSObject *obj = jsargs.thisv ().toObjectOrNull ();
-		auto data = static_cast<std::pair<bool, T *> *> (JS_GetPrivate (obj));
-		const T *ptr = data->second;
-		return (ptr->*method) (args...);
+		const char *error = nullptr;
+		unsigned int n = 0;
+		if (((n = I, tryReadJSValue (cx, std::get<I> (args), jsargs.get (I), error)) && ...))
+			return true;
+		JS_ReportError (cx, "Argument %u %s", n, error);
+		return false;
 	}
 };
 
-template <typename T, typename... Args>
-T *constructorCall (JSContext *cx, JS::CallArgs &jsargs, Args... args)
+template <typename T>
+inline T *thisPointer (JS::CallArgs &jsargs)
 {
-	return new T (args...);
+	JSObject *obj = jsargs.thisv ().toObjectOrNull ();
+	auto data = static_cast<std::pair<bool, T *> *> (JS_GetPrivate (obj));
+	// Released objects have no private data
+	return data ? data->second : nullptr;
 }
 
 /*
@@ -130,10 +86,17 @@ struct MethodWrap<R (T::*) (Args...)>
 			JS_ReportError (cx, "Too few arguments (%d required)", sizeof...(Args));
 			return false;
 		}
-		typedef typename ArgConvert<R, Args...>::template Wrapper<methodCall<T, R, Args...>::template call<method>> wrapper;
+		typename ArgConvert<Args...>::tuple args;
+		if (!ArgConvert<Args...>::convert (cx, jsargs, args))
+			return false;
+		T *ptr = thisPointer<T> (jsargs);
+		if (!ptr) {
+			JS_ReportError (cx, "Object was released");
+			return false;
+		}
 		R ret;
 		try {
-			ret = wrapper::call (cx, jsargs);
+			ret = std::apply ([ptr] (auto &... a) { return (ptr->*method) (a...); }, args);
 		}
 		catch (std::exception &e) {
 			JS_ReportError (cx, "C++ exception: %s", e.what ());
@@ -156,9 +119,16 @@ struct MethodWrap<void (T::*) (Args...)>
 			JS_ReportError (cx, "Too few arguments (%d required)", sizeof...(Args));
 			return false;
 		}
-		typedef typename ArgConvert<void, Args...>::template Wrapper<methodCall<T, void, Args...>::template call<method>> wrapper;
+		typename ArgConvert<Args...>::tuple args;
+		if (!ArgConvert<Args...>::convert (cx, jsargs, args))
+			return false;
+		T *ptr = thisPointer<T> (jsargs);
+		if (!ptr) {
+			JS_ReportError (cx, "Object was released");
+			return false;
+		}
 		try {
-			wrapper::call (cx, jsargs);
+			std::apply ([ptr] (auto &... a) { (ptr->*method) (a...); }, args);
 		}
 		catch (std::exception &e) {
 			JS_ReportError (cx, "C++ exception: %s", e.what ());
@@ -181,10 +151,17 @@ struct MethodWrap<R (T::*) (Args...) const>
 			JS_ReportError (cx, "Too few arguments (%d required)", sizeof...(Args));
 			return false;
 		}
-		typedef typename ArgConvert<R, Args...>::template Wrapper<constMethodCall<T, R, Args...>::template call<method>> wrapper;
+		typename ArgConvert<Args...>::tuple args;
+		if (!ArgConvert<Args...>::convert (cx, jsargs, args))
+			return false;
+		const T *ptr = thisPointer<T> (jsargs);
+		if (!ptr) {
+			JS_ReportError (cx, "Object was released");
+			return false;
+		}
 		R ret;
 		try {
-			ret = wrapper::call (cx, jsargs);
+			ret = std::apply ([ptr] (auto &... a) { return (ptr->*method) (a...); }, args);
 		}
 		catch (std::exception &e) {
 			JS_ReportError (cx, "C++ exception: %s", e.what ());
@@ -207,9 +184,16 @@ struct MethodWrap<void (T::*) (Args...) const>
 			JS_ReportError (cx, "Too few arguments (%d required)", sizeof...(Args));
 			return false;
 		}
-		typedef typename ArgConvert<void, Args...>::template Wrapper<constMethodCall<T, void, Args...>::template call<method>> wrapper;
+		typename ArgConvert<Args...>::tuple args;
+		if (!ArgConvert<Args...>::convert (cx, jsargs, args))
+			return false;
+		const T *ptr = thisPointer<T> (jsargs);
+		if (!ptr) {
+			JS_ReportError (cx, "Object was released");
+			return false;
+		}
 		try {
-			wrapper::call (cx, jsargs);
+			std::apply ([ptr] (auto &... a) { (ptr->*method) (a...); }, args);
 		}
 		catch (std::exception &e) {
 			JS_ReportError (cx, "C++ exception: %s", e.what ());
@@ -226,6 +210,10 @@ bool LLMethodWrapper (JSContext *cx, unsigned int argc, JS::Value *vp)
 	JS::CallArgs jsargs = JS::CallArgsFromVp (argc, vp);
 	JSObject *obj = jsargs.thisv ().toObjectOrNull ();
 	auto data = static_cast<std::pair<bool, T *> *> (JS_GetPrivate (obj));
+	if (!data) {
+		JS_ReportError (cx, "Object was released");
+		return false;
+	}
 	T *ptr = data->second;
 	return (ptr->*method) (cx, jsargs);
 }
@@ -245,10 +233,12 @@ bool constructorWrapper (JSContext *cx, unsigned int argc, JS::Value *vp)
 		return false;
 	}
 
-	typedef typename ArgConvert<T *, Args...>::template Wrapper<constructorCall<T, Args...>> wrapper;
+	typename ArgConvert<Args...>::tuple args;
+	if (!ArgConvert<Args...>::convert (cx, jsargs, args))
+		return false;
 	T *ptr;
 	try {
-		ptr = wrapper::call (cx, jsargs);
+		ptr = std::apply ([] (auto &... a) { return new T (a...); }, args);
 	}
 	catch (std::exception &e) {
 		JS_ReportError (cx, "C++ exception: %s", e.what ());
@@ -260,6 +250,8 @@ bool constructorWrapper (JSContext *cx, unsigned int argc, JS::Value *vp)
 	}
 	auto data = new std::pair<bool, T *> (true, ptr);
 	JS_SetPrivate (obj, data);
+	Thread *thread = static_cast<Thread *> (JS_GetContextPrivate (cx));
+	thread->addWrapper (ptr, object_class, obj);
 
 	jsargs.rval ().setObject (*obj);
 	return true;
@@ -20,6 +20,9 @@
 #define JSTPL_SIGNAL_H
 
 #include <sigc++/signal.h>
+#include <jsfriendapi.h>
+#include <algorithm>
+#include <optional>
 
 #include "Types.h"
 #include "Class.h"
@@ -39,6 +42,153 @@ constexpr SignalConnector make_signal_connector (sigc::signal<Ret (Args...)> T::
 	};
 }
 
+/**
+ * Key function for signals whose events must never be coalesced.
+ */
+struct NoEventKey
+{
+	template <typename... Args>
+	std::optional<uint64_t> operator() (const Thread::RuntimeOptions &, const Args &...) const
+	{
+		return std::nullopt;
+	}
+};
+
+/**
+ * Make a signal connector whose queued calls may be coalesced.
+ *
+ * \p key is called with the runtime options of the thread and the
+ * signal arguments. It returns an event id (a pending call to the same
+ * callback with the same id may be replaced by the new one), or
+ * std::nullopt if the call must be kept.
+ *
+ * \see Thread::RuntimeOptions::coalesce_threshold
+ */
+template<typename T, typename KeyFn, typename... Args>
+SignalConnector make_keyed_signal_connector (sigc::signal<void (Args...)> T::*signal, KeyFn key)
+{
+	return [signal, key] (JSContext *cx, JS::HandleValue obj, JS::HandleValue callback) {
+		T *ptr;
+		readJSValue (cx, ptr, obj);
+		if (!callback.isObject () || !JS::IsCallable (&callback.toObject ()))
+			throw std::invalid_argument ("must be a function");
+		auto fun = std::make_shared<JS::PersistentRootedValue> (cx, callback);
+		Thread *thread = static_cast<Thread *> (JS_GetContextPrivate (cx));
+		return (ptr->*signal).connect ([cx, thread, fun, key] (Args... args) {
+			Thread::EventKey event_key;
+			if (thread->queuesEvents ()) {
+				if (auto id = key (thread->runtimeOptions (), args...))
+					event_key = { fun.get (), *id };
+			}
+			detail::dispatchCall<Args...> (cx, thread, fun, event_key, args...);
+		});
+	};
+}
+
+namespace detail {
+	template <typename T>
+	struct TypedArray;
+
+	template <>
+	struct TypedArray<uint8_t>
+	{
+		static JSObject *create (JSContext *cx, uint32_t length) { return JS_NewUint8Array (cx, length); }
+		static uint8_t *data (JSObject *obj, const JS::AutoCheckCannotGC &nogc) { return JS_GetUint8ArrayData (obj, nogc); }
+	};
+
+	template <>
+	struct TypedArray<int32_t>
+	{
+		static JSObject *create (JSContext *cx, uint32_t length) { return JS_NewInt32Array (cx, length); }
+		static int32_t *data (JSObject *obj, const JS::AutoCheckCannotGC &nogc) { return JS_GetInt32ArrayData (obj, nogc); }
+	};
+
+	template <typename T>
+	inline void setReusedJSValue (JSContext *cx, JS::PersistentRootedObject &, JS::MutableHandleValue var, const T &value)
+	{
+		setJSValue (cx, var, value);
+	}
+
+	template <typename T>
+	inline void setReusedJSValue (JSContext *cx, JS::PersistentRootedObject &array, JS::MutableHandleValue var, const std::vector<T> &samples)
+	{
+		if (!array || JS_GetTypedArrayLength (array) != samples.size ())
+			array = TypedArray<T>::create (cx, samples.size ());
+		{
+			JS::AutoCheckCannotGC nogc;
+			std::copy (samples.begin (), samples.end (), TypedArray<T>::data (array, nogc));
+		}
+		var.setObject (*array);
+	}
+
+	template <int n, typename... Args>
+	struct ReusedArgumentVector;
+
+	template <int n, typename First, typename... Rest>
+	struct ReusedArgumentVector<n, First, Rest...>
+	{
+		inline static void pack (JSContext *cx, JS::PersistentRootedObject &array, JS::AutoValueVector &jsargs, First first, Rest... rest)
+		{
+			setReusedJSValue (cx, array, jsargs[n], first);
+			ReusedArgumentVector<n+1, Rest...>::pack (cx, array, jsargs, rest...);
+		}
+	};
+
+	template <int n>
+	struct ReusedArgumentVector<n>
+	{
+		inline static void pack (JSContext *cx, JS::PersistentRootedObject &, JS::AutoValueVector &)
+		{
+		}
+	};
+}
+
+/**
+ * Make a signal connector passing std::vector arguments as typed arrays.
+ *
+ * The typed array is created once per connection and its content is
+ * overwritten at each call (it is only reallocated when the size changes),
+ * so the callback must copy the values it wants to keep.
+ *
+ * \see make_keyed_signal_connector for \p key.
+ */
+template<typename T, typename KeyFn = NoEventKey, typename... Args>
+SignalConnector make_typed_array_signal_connector (sigc::signal<void (Args...)> T::*signal, KeyFn key = KeyFn ())
+{
+	return [signal, key] (JSContext *cx, JS::HandleValue obj, JS::HandleValue callback) {
+		T *ptr;
+		readJSValue (cx, ptr, obj);
+		auto fun = std::make_shared<JS::PersistentRootedValue> (cx, callback);
+		auto array = std::make_shared<JS::PersistentRootedObject> (cx);
+		Thread *thread = static_cast<Thread *> (JS_GetContextPrivate (cx));
+		return (ptr->*signal).connect ([cx, thread, fun, array, key] (Args... args) {
+			auto call = [cx, thread, fun, array] (const std::decay_t<Args> &... args) {
+				JS::AutoValueVector jsargs (cx);
+				jsargs.resize (sizeof... (Args));
+				{
+					Thread::RecycleScope recycle (thread);
+					detail::ReusedArgumentVector<0, Args...>::pack (cx, *array, jsargs, args...);
+				}
+				JS::RootedValue rval (cx);
+				Trace::Span span ("js", "JS callback");
+				JS_CallFunctionValue (cx, JS::NullPtr (), *fun, jsargs, &rval);
+			};
+			if (thread->queuesEvents ()) {
+				Thread::EventKey event_key;
+				if (auto id = key (thread->runtimeOptions (), args...))
+					event_key = { fun.get (), *id };
+				// Queued calls need their own copy of the arguments.
+				thread->postEvent ([call, args...] () { call (args...); }, event_key);
+			}
+			else {
+				// The call is synchronous, arguments can be used by reference.
+				auto bound = [&] () { call (args...); };
+				detail::syncCall (thread, bound);
+			}
+		});
+	};
+}
+
 }
 
 #endif
@@ -20,9 +20,29 @@
 
 #include "Class.h"
 #include "../Log.h"
+#include "../Trace.h"
 
 using namespace jstpl;
 
+Thread::Thread ():
+	_cx (nullptr),
+	_recycling (false),
+	_recycle_generation (0),
+	_gc_bytes_after_last (0),
+	_heap_bytes (0),
+	_gc_count (0),
+	_gc_pause_total (0),
+	_gc_pause_max (0),
+	_budget_overruns (0),
+	_dropped_events (0),
+	_coalesced_events (0),
+	_watchdog_stopping (false),
+	_task_running (false),
+	_task_serial (0),
+	_aborted_task (0)
+{
+}
+
 Thread::~Thread ()
 {
 	stop ();
@@ -31,6 +51,7 @@ Thread::~Thread ()
 void Thread::start ()
 {
 	_stopping = false;
+	_task_queue.resetInterruption ();
 	_thread = std::thread (static_cast<void (Thread::*) ()> (&Thread::run), this);
 }
 
@@ -43,6 +64,36 @@ void Thread::stop ()
 	}
 }
 
+void Thread::setRuntimeOptions (const RuntimeOptions &options)
+{
+	_options = options;
+}
+
+const Thread::RuntimeOptions &Thread::runtimeOptions () const
+{
+	return _options;
+}
+
+Thread::Statistics Thread::statistics () const
+{
+	return Statistics {
+		_heap_bytes,
+		_gc_count,
+		_gc_pause_total,
+		_gc_pause_max,
+		_budget_overruns,
+		_dropped_events,
+		_coalesced_events,
+		static_cast<uint32_t> (_task_queue.size ()),
+	};
+}
+
+std::string Thread::threadPolicy () const
+{
+	std::unique_lock<std::mutex> lock (_thread_policy_mutex);
+	return _thread_policy;
+}
+
 JSContext *Thread::getContext ()
 {
 	return _cx;
@@ -50,7 +101,43 @@ JSContext *Thread::getContext ()
 
 void Thread::execOnJsThreadAsync (std::function<void (void)> f)
 {
-	_task_queue.push (f);
+	if (Trace::enabled ()) {
+		auto queued = Trace::clock::now ();
+		_task_queue.push ([f, queued] () {
+			Trace::record ("js", "queue wait", queued, Trace::clock::now ());
+			Trace::Span span ("js", "task");
+			f ();
+		});
+	}
+	else
+		_task_queue.push (f);
+}
+
+void Thread::postEvent (std::function<void (void)> f, const EventKey &key)
+{
+	// The JS thread must never wait for its own queue
+	if (std::this_thread::get_id () == _thread.get_id ()) {
+		execOnJsThreadAsync (f);
+		return;
+	}
+	std::function<void (void)> task = f;
+	if (Trace::enabled ()) {
+		auto queued = Trace::clock::now ();
+		task = [f, queued] () {
+			Trace::record ("js", "queue wait", queued, Trace::clock::now ());
+			Trace::Span span ("js", "event");
+			f ();
+		};
+	}
+	auto result = _task_queue.push_bounded (task,
+						_options.max_queued_events,
+						_options.overload_policy,
+						key,
+						_options.coalesce_threshold);
+	if (result.coalesced)
+		_coalesced_events += result.dropped;
+	else
+		_dropped_events += result.dropped;
 }
 
 const BaseClass *Thread::getClass (const std::string &name) const
@@ -68,12 +155,186 @@ void Thread::addClasses (std::map<std::string, std::unique_ptr<BaseClass>> &&cla
 		_classes.emplace (p.first, std::move (p.second));
 }
 
+JSObject *Thread::findWrapper (const void *ptr, const JSClass *cls)
+{
+	auto it = _wrappers.find ({ptr, cls});
+	if (it == _wrappers.end ())
+		return nullptr;
+	JSObject *obj = it->second;
+	// The reference is weak, make sure an incremental GC will not collect it
+	JS::ExposeObjectToActiveJS (obj);
+	return obj;
+}
+
+void Thread::addWrapper (const void *ptr, const JSClass *cls, JSObject *obj)
+{
+	_wrappers[{ptr, cls}] = obj;
+}
+
+void Thread::sweepWrappers (JSRuntime *rt, void *data)
+{
+	Thread *thread = static_cast<Thread *> (data);
+	auto it = thread->_wrappers.begin ();
+	while (it != thread->_wrappers.end ()) {
+		JS_UpdateWeakPointerAfterGC (&it->second);
+		if (!it->second)
+			it = thread->_wrappers.erase (it);
+		else
+			++it;
+	}
+}
+
+Thread::ObjectLayout *Thread::addObjectLayout (std::size_t hash, std::vector<std::string> &&names)
+{
+	auto layout = std::make_unique<ObjectLayout> (_cx);
+	layout->ids.reserve (names.size ());
+	for (const auto &name: names) {
+		JSString *str = JS_InternString (_cx, name.c_str ());
+		if (!str)
+			return nullptr;
+		layout->ids.push_back (INTERNED_STRING_TO_JSID (_cx, str));
+	}
+	layout->names = std::move (names);
+	return _layouts.emplace (hash, std::move (layout))->second.get ();
+}
+
+JSObject *Thread::newObjectFromLayout (ObjectLayout &layout)
+{
+	if (!_recycling || layout.recycled_generation == _recycle_generation)
+		return JS_NewObject (_cx, nullptr);
+	layout.recycled_generation = _recycle_generation;
+	if (!layout.recycled)
+		layout.recycled = JS_NewObject (_cx, nullptr);
+	return layout.recycled;
+}
+
 void Thread::exec ()
 {
+	auto idle_gc_delay = std::chrono::milliseconds (_options.idle_gc_delay);
 	while (!_stopping) {
-		auto opt = _task_queue.pop ();
-		if (opt)
+		std::optional<std::function<void (void)>> opt;
+		if (idle_gc_delay.count () > 0) {
+			opt = _task_queue.pop_for (idle_gc_delay);
+			if (!opt) {
+				collectIdleGarbage ();
+				continue;
+			}
+		}
+		else
+			opt = _task_queue.pop ();
+		if (opt) {
+			beginTask ();
 			opt.value () ();
+			endTask ();
+		}
+	}
+}
+
+void Thread::beginTask ()
+{
+	if (!_watchdog.joinable ())
+		return;
+	std::unique_lock<std::mutex> lock (_watchdog_mutex);
+	_task_running = true;
+	++_task_serial;
+	_task_deadline = std::chrono::steady_clock::now ()
+		+ std::chrono::milliseconds (_options.task_budget);
+	lock.unlock ();
+	_watchdog_condvar.notify_one ();
+}
+
+void Thread::endTask ()
+{
+	if (!_watchdog.joinable ())
+		return;
+	std::unique_lock<std::mutex> lock (_watchdog_mutex);
+	_task_running = false;
+}
+
+void Thread::watchdogRun ()
+{
+	ThreadPolicy ().apply ("js-watchdog");
+	JSRuntime *rt = JS_GetRuntime (_cx);
+	std::unique_lock<std::mutex> lock (_watchdog_mutex);
+	while (!_watchdog_stopping) {
+		if (!_task_running) {
+			_watchdog_condvar.wait (lock);
+			continue;
+		}
+		uint64_t serial = _task_serial;
+		auto deadline = _task_deadline;
+		_watchdog_condvar.wait_until (lock, deadline, [this, serial] () {
+			return _watchdog_stopping || !_task_running || _task_serial != serial;
+		});
+		if (_watchdog_stopping)
+			break;
+		if (_task_running && _task_serial == serial) {
+			_aborted_task = serial;
+			JS_RequestInterruptCallback (rt);
+			// Wait for the next task
+			_watchdog_condvar.wait (lock, [this, serial] () {
+				return _watchdog_stopping || (_task_running && _task_serial != serial);
+			});
+		}
+	}
+}
+
+bool Thread::interruptCallback (JSContext *cx)
+{
+	Thread *thread = static_cast<Thread *> (JS_GetContextPrivate (cx));
+	uint64_t serial = thread->_aborted_task.exchange (0);
+	if (serial == 0 || serial != thread->_task_serial)
+		return true; // not a watchdog interruption or the task already ended
+	++thread->_budget_overruns;
+	Log::warning () << "Script exceeded its time budget of "
+			<< thread->_options.task_budget << " ms, aborting." << std::endl;
+	return false;
+}
+
+void Thread::collectIdleGarbage ()
+{
+	JSRuntime *rt = JS_GetRuntime (_cx);
+	uint64_t bytes = JS_GetGCParameter (rt, JSGC_BYTES);
+	_heap_bytes = bytes;
+	if (JS::IsIncrementalGCInProgress (rt)) {
+		JS::PrepareForIncrementalGC (rt);
+		JS::IncrementalGC (rt, JS::gcreason::API, _options.gc_slice_budget);
+	}
+	else if (bytes > _gc_bytes_after_last + IdleGCMinGrowth) {
+		LOG (Debug) << "Starting idle GC (heap size: " << bytes << ")" << std::endl;
+		JS::PrepareForFullGC (rt);
+		JS::IncrementalGC (rt, JS::gcreason::API, _options.gc_slice_budget);
+	}
+}
+
+void Thread::gcSliceCallback (JSRuntime *rt, JS::GCProgress progress, const JS::GCDescription &desc)
+{
+	Thread *thread = static_cast<Thread *> (JS_GetRuntimePrivate (rt));
+	switch (progress) {
+	case JS::GC_SLICE_BEGIN:
+		thread->_gc_slice_start = std::chrono::steady_clock::now ();
+		break;
+
+	case JS::GC_SLICE_END: {
+		auto now = std::chrono::steady_clock::now ();
+		auto pause = std::chrono::duration_cast<std::chrono::microseconds> (
+			now - thread->_gc_slice_start).count ();
+		thread->_gc_pause_total += pause;
+		if (static_cast<uint64_t> (pause) > thread->_gc_pause_max)
+			thread->_gc_pause_max = pause;
+		if (Trace::enabled ())
+			Trace::record ("gc", "GC slice", thread->_gc_slice_start, now);
+		break;
+	}
+
+	case JS::GC_CYCLE_END:
+		thread->_gc_bytes_after_last = JS_GetGCParameter (rt, JSGC_BYTES);
+		thread->_heap_bytes = thread->_gc_bytes_after_last;
+		++thread->_gc_count;
+		break;
+
+	default:
+		break;
 	}
 }
 
@@ -86,19 +347,37 @@ static void errorReporter (JSContext *cx, const char *message, JSErrorReport *re
 
 void Thread::run ()
 {
-	JSRuntime *rt = JS_NewRuntime (RuntimeMaxBytes, JS::DefaultNurseryBytes, _main_rt);
+	std::string policy = _options.thread_policy.apply ("js-script");
+	{
+		std::unique_lock<std::mutex> lock (_thread_policy_mutex);
+		_thread_policy = policy;
+	}
+
+	JSRuntime *rt = JS_NewRuntime (_options.max_bytes, _options.nursery_bytes, _main_rt);
 	if (!rt) {
 		throw std::runtime_error ("JS_NewRuntime failed");
 	}
+	JS_SetRuntimePrivate (rt, this);
+	JS_SetGCParameter (rt, JSGC_MODE, JSGC_MODE_INCREMENTAL);
+	JS_SetGCParameter (rt, JSGC_SLICE_TIME_BUDGET, _options.gc_slice_budget);
+	JS::SetGCSliceCallback (rt, &Thread::gcSliceCallback);
+	JS_AddWeakPointerCallback (rt, &Thread::sweepWrappers, this);
 
 	JSContext *cx = JS_NewContext (rt, 8192);
 	if (!cx) {
 		throw std::runtime_error ("JS_NewContext failed");
 	}
 	JS_SetContextPrivate (cx, this);
+	_cx = cx;
 
 	JS_SetErrorReporter (rt, errorReporter);
 
+	if (_options.task_budget > 0) {
+		JS_SetInterruptCallback (rt, &Thread::interruptCallback);
+		_watchdog_stopping = false;
+		_watchdog = std::thread (&Thread::watchdogRun, this);
+	}
+
 	try {
 		run (cx);
 	}
@@ -106,7 +385,24 @@ void Thread::run ()
 		Log::error () << "Script failed: " << e.what () << std::endl;
 	}
 
+	if (_watchdog.joinable ()) {
+		{
+			std::unique_lock<std::mutex> lock (_watchdog_mutex);
+			_watchdog_stopping = true;
+			_task_running = false;
+		}
+		_watchdog_condvar.notify_one ();
+		_watchdog.join ();
+	}
+	// Release producers blocked by the overload policy and destroy the
+	// remaining tasks while their JS values can still be released.
+	_task_queue.interrupt ();
+	_task_queue.clear ();
+
 	_classes.clear ();
+	_wrappers.clear ();
+	_layouts.clear ();
+	_cx = nullptr;
 	JS_DestroyContext (cx);
 	JS_DestroyRuntime (rt);
 }
@@ -116,7 +412,7 @@ void Thread::init ()
 	if (!JS_Init ())
 		throw std::runtime_error ("JS_Init failed");
 
-	if (!(_main_rt = JS_NewRuntime (RuntimeMaxBytes)))
+	if (!(_main_rt = JS_NewRuntime (DefaultRuntimeMaxBytes)))
 		throw std::runtime_error("Main JS_NewRuntime failed");
 
 	if (!(_main_cx = JS_NewContext (_main_rt, 8192)))
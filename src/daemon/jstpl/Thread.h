@@ -24,8 +24,18 @@
 #include <thread>
 #include <future>
 #include <map>
+#include <unordered_map>
+#include <set>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
 #include "../MTQueue.h"
 #include "../Log.h"
+#include "../ThreadPolicy.h"
 
 namespace jstpl
 {
@@ -35,26 +45,176 @@ class BaseClass;
 class Thread
 {
 public:
+	static constexpr uint32_t DefaultRuntimeMaxBytes = 8ul*1024ul*1024ul;
+
+	/**
+	 * Settings for the JS runtime of this thread.
+	 *
+	 * They are applied when the thread is started.
+	 */
+	struct RuntimeOptions
+	{
+		/** Maximum size of the GC heap (in bytes). */
+		uint32_t max_bytes = DefaultRuntimeMaxBytes;
+		/** Size of the nursery (in bytes). */
+		uint32_t nursery_bytes = JS::DefaultNurseryBytes;
+		/**
+		 * Delay (in milliseconds) without any task before
+		 * running incremental GC slices. 0 disables idle GC.
+		 */
+		unsigned int idle_gc_delay = 0;
+		/** Time budget for each GC slice (in milliseconds). */
+		unsigned int gc_slice_budget = 10;
+		/**
+		 * Reuse the same object for signal parameters converted from
+		 * std::map with the same layout.
+		 */
+		bool recycle_objects = false;
+		/** Scheduling settings for the JS thread. */
+		ThreadPolicy thread_policy;
+		/**
+		 * Maximum time (in milliseconds) a task may run before
+		 * the JS code is aborted. 0 disables the watchdog.
+		 */
+		unsigned int task_budget = 0;
+		/**
+		 * Maximum number of pending event callbacks. When 0, event
+		 * callbacks are called synchronously and the thread emitting
+		 * the signal waits for the callback.
+		 *
+		 * \see postEvent
+		 */
+		unsigned int max_queued_events = 0;
+		/** What to do when max_queued_events is reached. */
+		QueueOverflow overload_policy = QueueOverflow::Block;
+		/**
+		 * Number of pending event callbacks from which a keyed
+		 * event replaces the pending one with the same key.
+		 * 0 disables coalescing (except for the Coalesce overload
+		 * policy).
+		 *
+		 * \see EventKey
+		 */
+		unsigned int coalesce_threshold = 0;
+		/**
+		 * Event types whose callbacks are keyed for coalescing by
+		 * the signal connectors (latest value only).
+		 */
+		std::set<uint16_t> coalesced_types;
+		/** Also key batched sensor events for coalescing. */
+		bool coalesce_sensors = false;
+	};
+
+	/**
+	 * Key identifying event callbacks that can replace each other.
+	 *
+	 * A default key (null callback) is never coalesced.
+	 */
+	struct EventKey
+	{
+		const void *callback = nullptr;
+		uint64_t id = 0;
+
+		bool operator== (const EventKey &other) const
+		{
+			return callback == other.callback && id == other.id;
+		}
+	};
+
+	/**
+	 * Heap and garbage collector statistics.
+	 */
+	struct Statistics
+	{
+		/** Current size of the GC heap (in bytes). */
+		uint64_t heap_bytes;
+		/** Number of finished GC cycles. */
+		uint32_t gc_count;
+		/** Total time spent in GC slices (in microseconds). */
+		uint64_t gc_pause_total;
+		/** Longest GC slice (in microseconds). */
+		uint64_t gc_pause_max;
+		/** Number of tasks aborted for exceeding the time budget. */
+		uint32_t budget_overruns;
+		/** Number of event callbacks dropped by the overload policy. */
+		uint64_t dropped_events;
+		/** Number of event callbacks replaced by a newer call. */
+		uint64_t coalesced_events;
+		/** Current number of pending tasks. */
+		uint32_t queue_depth;
+	};
+
+	Thread ();
 	virtual ~Thread ();
 
+	void setRuntimeOptions (const RuntimeOptions &options);
+	const RuntimeOptions &runtimeOptions () const;
+
+	/**
+	 * Get the statistics from the JS runtime.
+	 *
+	 * This method can be called from any thread.
+	 */
+	Statistics statistics () const;
+	/**
+	 * Description of the scheduling settings applied on the JS thread.
+	 *
+	 * This method can be called from any thread.
+	 */
+	std::string threadPolicy () const;
+
 	void start ();
 	void stop ();
 
 	JSContext *getContext ();
 
+	/**
+	 * Call \p f on the JS thread and wait for its result.
+	 *
+	 * \throws std::future_error if the thread stops before calling \p f.
+	 */
 	template <typename R>
 	R execOnJsThreadSync (std::function<R ()> f)
 	{
-		std::promise<R> promise;
-		std::future<R> future = promise.get_future ();
-		execOnJsThreadAsync ([&promise, &f] () {
-			promise.set_value (f ());
+		// The JS thread must never wait for its own queue
+		if (std::this_thread::get_id () == _thread.get_id ())
+			return f ();
+		// The task owns the promise: it is broken if the task is
+		// dropped or cleared.
+		auto promise = std::make_shared<std::promise<R>> ();
+		std::future<R> future = promise->get_future ();
+		execOnJsThreadAsync ([promise, &f] () {
+			promise->set_value (f ());
 		});
 		return future.get ();
 	}
 
+	/**
+	 * Queue \p f to be called on the JS thread.
+	 *
+	 * Tasks left when the thread stops are destroyed without being
+	 * called, tasks queued while it is stopped are dropped.
+	 */
 	void execOnJsThreadAsync (std::function<void (void)> f);
 
+	/**
+	 * Whether event callbacks are queued with postEvent instead of
+	 * being called synchronously.
+	 */
+	bool queuesEvents () const
+	{
+		return _options.max_queued_events > 0 || _options.coalesce_threshold > 0;
+	}
+
+	/**
+	 * Queue an event callback subject to the overload policy.
+	 *
+	 * Unlike execOnJsThreadAsync, the callback may be dropped when
+	 * max_queued_events callbacks are already pending, or replaced
+	 * by a later call with the same non-default \p key.
+	 */
+	void postEvent (std::function<void (void)> f, const EventKey &key = EventKey ());
+
 	static void init ();
 	static void shutdown ();
 
@@ -73,6 +233,119 @@ public:
 
 	void addClasses (std::map<std::string, std::unique_ptr<BaseClass>> &&classes);
 
+	/**
+	 * Find the JS object previously created for the C++ object \p ptr
+	 * with class \p cls.
+	 *
+	 * \returns the wrapper object or nullptr if there is none.
+	 */
+	JSObject *findWrapper (const void *ptr, const JSClass *cls);
+	/**
+	 * Detach the JS object created for \p ptr, before \p ptr is
+	 * destroyed while the object may still be used by the script.
+	 *
+	 * Later uses of the object from the script fail with an error.
+	 * Must be called on the JS thread.
+	 */
+	template <typename T>
+	void releaseJsObject (T *ptr)
+	{
+		JSObject *obj = findWrapper (ptr, &T::js_class);
+		if (!obj)
+			return;
+		auto data = static_cast<std::pair<bool, T *> *> (JS_GetPrivate (obj));
+		JS_SetPrivate (obj, nullptr);
+		delete data;
+		_wrappers.erase ({ptr, &T::js_class});
+	}
+	/**
+	 * Register \p obj as the wrapper for \p ptr.
+	 *
+	 * The reference is weak: the entry is removed when the object is
+	 * collected.
+	 */
+	void addWrapper (const void *ptr, const JSClass *cls, JSObject *obj);
+
+	/**
+	 * Property ids for objects converted from std::map with the same keys.
+	 *
+	 * Properties are always defined in the same order, so objects with
+	 * the same layout share the same shape.
+	 */
+	struct ObjectLayout
+	{
+		std::vector<std::string> names;
+		std::vector<jsid> ids; // interned atoms do not need rooting
+		JS::PersistentRootedObject recycled;
+		unsigned int recycled_generation;
+
+		ObjectLayout (JSContext *cx):
+			recycled (cx),
+			recycled_generation (0)
+		{
+		}
+	};
+
+	/**
+	 * Get the layout for objects with the keys from \p properties.
+	 *
+	 * \returns the layout or nullptr if there are too many layouts.
+	 */
+	template <typename T>
+	ObjectLayout *getObjectLayout (const std::map<std::string, T> &properties)
+	{
+		std::size_t hash = properties.size ();
+		for (const auto &p: properties)
+			hash = hash * 31 + std::hash<std::string> () (p.first);
+		auto range = _layouts.equal_range (hash);
+		for (auto it = range.first; it != range.second; ++it) {
+			const auto &layout = it->second;
+			if (layout->names.size () == properties.size () &&
+			    std::equal (properties.begin (), properties.end (), layout->names.begin (),
+					[] (const auto &p, const std::string &name) { return p.first == name; }))
+				return layout.get ();
+		}
+		if (_layouts.size () >= MaxObjectLayouts)
+			return nullptr;
+		std::vector<std::string> names;
+		names.reserve (properties.size ());
+		for (const auto &p: properties)
+			names.push_back (p.first);
+		return addObjectLayout (hash, std::move (names));
+	}
+
+	/**
+	 * Create an object for \p layout, or reuse the recycled object if
+	 * recycling is enabled and inside a RecycleScope.
+	 */
+	JSObject *newObjectFromLayout (ObjectLayout &layout);
+
+	/**
+	 * Allow recycling objects while converting signal parameters.
+	 *
+	 * A recycled object is used at most once in each scope.
+	 */
+	class RecycleScope
+	{
+	public:
+		RecycleScope (Thread *thread):
+			_thread (thread),
+			_old (thread->_recycling)
+		{
+			_thread->_recycling = _thread->_options.recycle_objects;
+			++_thread->_recycle_generation;
+		}
+
+		~RecycleScope ()
+		{
+			_thread->_recycling = _old;
+		}
+
+	private:
+		Thread *_thread;
+		bool _old;
+	};
+
 protected:
 	void exec ();
 	virtual void run (JSContext *cx) = 0;
@@ -81,13 +354,52 @@ protected:
 
 private:
 	void run ();
+	void collectIdleGarbage ();
+	static void gcSliceCallback (JSRuntime *rt, JS::GCProgress progress, const JS::GCDescription &desc);
+	static void sweepWrappers (JSRuntime *rt, void *data);
+	ObjectLayout *addObjectLayout (std::size_t hash, std::vector<std::string> &&names);
+	void beginTask ();
+	void endTask ();
+	void watchdogRun ();
+	static bool interruptCallback (JSContext *cx);
 
 	JSContext *_cx;
-	MTQueue<std::function<void (void)>> _task_queue;
+	MTQueue<std::function<void (void)>, EventKey> _task_queue;
 	std::thread _thread;
 	std::map<std::string, std::unique_ptr<BaseClass>> _classes;
+	std::map<std::pair<const void *, const JSClass *>, JS::Heap<JSObject *>> _wrappers;
+	std::unordered_multimap<std::size_t, std::unique_ptr<ObjectLayout>> _layouts; // key is the hash of the names
+	bool _recycling;
+	unsigned int _recycle_generation;
+
+	RuntimeOptions _options;
+	std::chrono::steady_clock::time_point _gc_slice_start;
+	uint64_t _gc_bytes_after_last;
+	std::atomic<uint64_t> _heap_bytes;
+	std::atomic<uint32_t> _gc_count;
+	std::atomic<uint64_t> _gc_pause_total;
+	std::atomic<uint64_t> _gc_pause_max;
+	mutable std::mutex _thread_policy_mutex;
+	std::string _thread_policy;
+	std::atomic<uint32_t> _budget_overruns;
+	std::atomic<uint64_t> _dropped_events;
+	std::atomic<uint64_t> _coalesced_events;
+
+	// Watchdog state, only used when task_budget is not 0
+	std::thread _watchdog;
+	std::mutex _watchdog_mutex;
+	std::condition_variable _watchdog_condvar;
+	bool _watchdog_stopping;
+	bool _task_running;
+	uint64_t _task_serial;
+	std::chrono::steady_clock::time_point _task_deadline;
+	// Serial of the task the interrupt callback must abort
+	std::atomic<uint64_t> _aborted_task;
 
-	static constexpr uint32_t RuntimeMaxBytes = 8ul*1024ul*1024ul;
+	// Idle GC is not started if the heap did not grow more than this since the last GC.
+	static constexpr uint64_t IdleGCMinGrowth = 256ul*1024ul;
+	// Maps with other layouts are converted without the cache.
+	static constexpr std::size_t MaxObjectLayouts = 32;
 	static JSRuntime *_main_rt;
 	static JSContext *_main_cx;
 };
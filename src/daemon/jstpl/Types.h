@@ -30,6 +30,7 @@
 #include "Thread.h"
 
 #include "../Log.h"
+#include "../Trace.h"
 
 namespace jstpl
 {
@@ -52,24 +53,30 @@ template <typename... T>
 inline void setJSValue (JSContext *cx, JS::MutableHandleValue var, const std::variant<T...> &variant);
 
 // Converting JS::Value to C++ types
-inline void readJSValue (JSContext *cx, std::string &var, JS::HandleValue value);
+//
+// tryReadJSValue returns false and sets error to a static message when the
+// value cannot be converted. readJSValue throws std::invalid_argument instead.
+inline bool tryReadJSValue (JSContext *cx, std::string &var, JS::HandleValue value, const char *&error);
 template <typename T, typename = std::enable_if_t<std::is_integral<T>::value>>
-inline void readJSValue (JSContext *cx, T &var, JS::HandleValue value);
-inline void readJSValue (JSContext *cx, double &var, JS::HandleValue value);
-inline void readJSValue (JSContext *cx, bool &var, JS::HandleValue value);
-inline void readJSValue (JSContext *cx, std::vector<bool>::reference var, JS::HandleValue value);
+inline bool tryReadJSValue (JSContext *cx, T &var, JS::HandleValue value, const char *&error);
+inline bool tryReadJSValue (JSContext *cx, double &var, JS::HandleValue value, const char *&error);
+inline bool tryReadJSValue (JSContext *cx, bool &var, JS::HandleValue value, const char *&error);
+inline bool tryReadJSValue (JSContext *cx, std::vector<bool>::reference var, JS::HandleValue value, const char *&error);
 template <typename T>
-inline void readJSValue (JSContext *cx, std::vector<T> &var, JS::HandleValue value);
+inline bool tryReadJSValue (JSContext *cx, std::vector<T> &var, JS::HandleValue value, const char *&error);
 template <typename T>
-inline void readJSValue (JSContext *cx, std::map<std::string, T> &var, JS::HandleValue value);
+inline bool tryReadJSValue (JSContext *cx, std::map<std::string, T> &var, JS::HandleValue value, const char *&error);
 template <typename R, typename... Args>
-inline void readJSValue (JSContext *cx, std::function<R (Args...)> &var, JS::HandleValue value);
+inline bool tryReadJSValue (JSContext *cx, std::function<R (Args...)> &var, JS::HandleValue value, const char *&error);
 template <typename... Args>
-inline void readJSValue (JSContext *cx, std::function<void (Args...)> &var, JS::HandleValue value);
+inline bool tryReadJSValue (JSContext *cx, std::function<void (Args...)> &var, JS::HandleValue value, const char *&error);
 template <typename T, typename = std::enable_if_t<is_detected_exact_v<const JSClass, is_js_class_t, T>>>
-void readJSValue (JSContext *cx, T *&var, JS::HandleValue value);
+inline bool tryReadJSValue (JSContext *cx, T *&var, JS::HandleValue value, const char *&error);
 template <typename... T>
-void readJSValue (JSContext *cx, std::variant<T...> &var, JS::HandleValue value);
+inline bool tryReadJSValue (JSContext *cx, std::variant<T...> &var, JS::HandleValue value, const char *&error);
+
+template <typename T>
+inline void readJSValue (JSContext *cx, T &&var, JS::HandleValue value);
 
 }
 
@@ -99,6 +106,10 @@ inline void setJSValue (JSContext *cx, JS::MutableHandleValue var, double value)
 template <typename T, typename = std::enable_if_t<is_detected_exact_v<const JSClass, is_js_class_t, T>>>
 inline void setJSValue (JSContext *cx, JS::MutableHandleValue var, T *object)
 {
+	if (!object) {
+		var.setNull ();
+		return;
+	}
 	Thread *thread = static_cast<Thread *> (JS_GetContextPrivate (cx));
 	auto p = thread->getClass (T::js_class.name);
 	if (!p)
@@ -121,11 +132,26 @@ inline void setJSValue (JSContext *cx, JS::MutableHandleValue var, const std::ve
 template <typename T>
 inline void setJSValue (JSContext *cx, JS::MutableHandleValue var, const std::map<std::string, T> &properties)
 {
-	JS::RootedObject obj (cx, JS_NewObject (cx, nullptr));
+	Thread *thread = static_cast<Thread *> (JS_GetContextPrivate (cx));
+	auto layout = thread->getObjectLayout (properties);
+	if (!layout) {
+		JS::RootedObject obj (cx, JS_NewObject (cx, nullptr));
+		for (const auto &pair: properties) {
+			JS::RootedValue value (cx);
+			setJSValue (cx, &value, pair.second);
+			JS_DefineProperty (cx, obj, pair.first.c_str (), value, JSPROP_ENUMERATE);
+		}
+		var.setObject (*obj);
+		return;
+	}
+	JS::RootedObject obj (cx, thread->newObjectFromLayout (*layout));
+	JS::RootedId id (cx);
+	JS::RootedValue value (cx);
+	auto id_it = layout->ids.begin ();
 	for (const auto &pair: properties) {
-		JS::RootedValue value (cx);
+		id = *id_it++;
 		setJSValue (cx, &value, pair.second);
-		JS_DefineProperty (cx, obj, pair.first.c_str (), value, JSPROP_ENUMERATE);
+		JS_DefinePropertyById (cx, obj, id, value, JSPROP_ENUMERATE);
 	}
 	var.setObject (*obj);
 }
@@ -137,95 +163,144 @@ inline void setJSValue (JSContext *cx, JS::MutableHandleValue var, const std::va
 }
 
 // Converting JS::Value to C++ types
-inline void readJSValue (JSContext *cx, std::string &var, JS::HandleValue value)
+inline bool tryReadJSValue (JSContext *cx, std::string &var, JS::HandleValue value, const char *&error)
 {
 	if (!value.isString ()) {
-		throw std::invalid_argument ("must be a string");
+		error = "must be a string";
+		return false;
 	}
 	JSString *jsstr = value.toString ();
-	std::vector<char> buffer (JS_GetStringLength (jsstr));
-	JS_EncodeStringToBuffer (cx, jsstr, &buffer[0], buffer.size ());
-	var.assign (buffer.begin (), buffer.end ());
+	var.resize (JS_GetStringLength (jsstr));
+	if (!var.empty ())
+		JS_EncodeStringToBuffer (cx, jsstr, &var[0], var.size ());
+	return true;
 }
 
-template <typename T, typename = std::enable_if_t<std::is_integral<T>::value>>
-inline void readJSValue (JSContext *cx, T &var, JS::HandleValue value)
+template <typename T, typename>
+inline bool tryReadJSValue (JSContext *cx, T &var, JS::HandleValue value, const char *&error)
 {
+	if (value.isInt32 ()) {
+		int32_t v = value.toInt32 ();
+		if (!std::is_signed<T>::value && v < 0) {
+			error = "is out of range";
+			return false;
+		}
+		if (sizeof (T) < sizeof (int32_t) &&
+		    (v < static_cast<int32_t> (std::numeric_limits<T>::min ()) ||
+		     v > static_cast<int32_t> (std::numeric_limits<T>::max ()))) {
+			error = "is out of range";
+			return false;
+		}
+		var = static_cast<T> (v);
+		return true;
+	}
 	if (!value.isNumber ()) {
-		throw std::invalid_argument ("must be a number");
+		error = "must be a number";
+		return false;
 	}
 	double v = value.toNumber ();
 	if (v < std::numeric_limits<T>::min () || v > std::numeric_limits<T>::max ()) {
-		throw std::invalid_argument ("is out of range");
+		error = "is out of range";
+		return false;
 	}
 	var = static_cast<T> (v);
+	return true;
 }
 
-inline void readJSValue (JSContext *cx, double &var, JS::HandleValue value)
+inline bool tryReadJSValue (JSContext *cx, double &var, JS::HandleValue value, const char *&error)
 {
 	if (!value.isNumber ()) {
-		throw std::invalid_argument ("must be a number");
+		error = "must be a number";
+		return false;
 	}
 	var = value.toNumber ();
+	return true;
 }
 
-inline void readJSValue (JSContext *cx, bool &var, JS::HandleValue value)
+inline bool tryReadJSValue (JSContext *cx, bool &var, JS::HandleValue value, const char *&error)
 {
 	if (!value.isBoolean ()) {
-		throw std::invalid_argument ("must be an boolean");
+		error = "must be an boolean";
+		return false;
 	}
 	var = value.toBoolean ();
+	return true;
 }
 
-inline void readJSValue (JSContext *cx, std::vector<bool>::reference var, JS::HandleValue value)
+inline bool tryReadJSValue (JSContext *cx, std::vector<bool>::reference var, JS::HandleValue value, const char *&error)
 {
 	if (!value.isBoolean ()) {
-		throw std::invalid_argument ("must be an boolean");
+		error = "must be an boolean";
+		return false;
 	}
 	var = value.toBoolean ();
+	return true;
 }
 
 template <typename T>
-inline void readJSValue (JSContext *cx, std::vector<T> &var, JS::HandleValue value)
+inline bool tryReadJSValue (JSContext *cx, std::vector<T> &var, JS::HandleValue value, const char *&error)
 {
-	if (!JS_IsArrayObject (cx, value)) {
-		throw std::invalid_argument ("must be an array");
+	if (!value.isObject () || !JS_IsArrayObject (cx, value)) {
+		error = "must be an array";
+		return false;
 	}
-	JS::RootedObject array (cx, value.toObjectOrNull ());
+	JS::RootedObject array (cx, &value.toObject ());
 	uint32_t length;
-	JS_GetArrayLength (cx, array, &length);
+	if (!JS_GetArrayLength (cx, array, &length)) {
+		error = "must be an array";
+		return false;
+	}
 	var.resize (length);
+	JS::RootedValue elem (cx);
 	for (unsigned i = 0; i < length; ++i) {
-		JS::RootedValue elem (cx);
-		JS_GetElement (cx, array, i, &elem);
-		readJSValue (cx, var[i], elem);
+		if (!JS_GetElement (cx, array, i, &elem)) {
+			error = "has an invalid element";
+			return false;
+		}
+		if (!tryReadJSValue (cx, var[i], elem, error))
+			return false;
 	}
+	return true;
 }
 
 template <typename T>
-inline void readJSValue (JSContext *cx, std::map<std::string, T> &var, JS::HandleValue value)
+inline bool tryReadJSValue (JSContext *cx, std::map<std::string, T> &var, JS::HandleValue value, const char *&error)
 {
 	if (!value.isObject ()) {
-		throw std::invalid_argument ("must be an object");
+		error = "must be an object";
+		return false;
 	}
-	JS::RootedObject obj (cx, value.toObjectOrNull ());
+	JS::RootedObject obj (cx, &value.toObject ());
 	JSIdArray *ids = JS_Enumerate (cx, obj);
+	if (!ids) {
+		error = "has invalid properties";
+		return false;
+	}
+	bool ok = true;
 	unsigned int len = JS_IdArrayLength (cx, ids);
-	for (unsigned int i = 0; i < len; ++i) {
-		JS::RootedId id (cx, JS_IdArrayGet (cx, ids, i));
-		JS::RootedValue js_key (cx);
-		JS_IdToValue (cx, id, &js_key);
+	JS::RootedId id (cx);
+	JS::RootedValue js_key (cx), prop (cx);
+	for (unsigned int i = 0; ok && i < len; ++i) {
+		id = JS_IdArrayGet (cx, ids, i);
 		std::string key;
-		readJSValue (cx, key, js_key);
-
-		JS::RootedValue prop (cx);
-		JS_GetPropertyById (cx, obj, id, &prop);
 		T value;
-		readJSValue (cx, value, prop);
-
-		var.emplace (key, value);
+		ok = JS_IdToValue (cx, id, &js_key) &&
+		     JS_GetPropertyById (cx, obj, id, &prop);
+		if (!ok) {
+			error = "has invalid properties";
+			break;
+		}
+		// Keys may be numbers for array-like objects
+		if (js_key.isString ())
+			ok = tryReadJSValue (cx, key, js_key, error);
+		else if (js_key.isInt32 ())
+			key = std::to_string (js_key.toInt32 ());
+		ok = ok && tryReadJSValue (cx, value, prop, error);
+		if (ok)
+			var.emplace (std::move (key), std::move (value));
 	}
 	JS_DestroyIdArray (cx, ids);
+	return ok;
 }
 
 namespace detail {
@@ -252,91 +327,230 @@ namespace detail {
 }
 
 template <typename R, typename... Args>
-inline void readJSValue (JSContext *cx, std::function<R (Args...)> &var, JS::HandleValue value)
+inline bool tryReadJSValue (JSContext *cx, std::function<R (Args...)> &var, JS::HandleValue value, const char *&error)
 {
+	if (!value.isObject () || !JS::IsCallable (&value.toObject ())) {
+		error = "must be a function";
+		return false;
+	}
 	auto fun = std::make_shared<JS::PersistentRootedValue> (cx, value);
 	Thread *thread = static_cast<Thread *> (JS_GetContextPrivate (cx));
 	var = std::function<R (Args...)> ([cx, thread, fun] (Args... args) {
-		return thread->execOnJsThreadSync<R> ([cx, fun, args...] () {
+		return thread->execOnJsThreadSync<R> ([cx, thread, fun, args...] () {
 			JS::AutoValueVector jsargs (cx);
 			jsargs.resize (sizeof... (Args));
-			detail::ArgumentVector<0, Args...>::pack (cx, jsargs, args...);
+			{
+				Thread::RecycleScope recycle (thread);
+				detail::ArgumentVector<0, Args...>::pack (cx, jsargs, args...);
+			}
 			JS::RootedValue rval (cx);
-			JS_CallFunctionValue (cx, JS::NullPtr (), *fun, jsargs, &rval);
+			{
+				Trace::Span span ("js", "JS callback");
+				JS_CallFunctionValue (cx, JS::NullPtr (), *fun, jsargs, &rval);
+			}
 			R ret;
 			readJSValue (cx, ret, rval);
 			return ret;
 		});
 	});
+	return true;
+}
+
+namespace detail {
+	/**
+	 * Make a task calling \p fun with \p args on the JS thread.
+	 */
+	template <typename... Args>
+	inline auto makeCall (JSContext *cx, Thread *thread, const std::shared_ptr<JS::PersistentRootedValue> &fun, Args... args)
+	{
+		return [cx, thread, fun, args...] () {
+			JS::AutoValueVector jsargs (cx);
+			jsargs.resize (sizeof... (Args));
+			{
+				Thread::RecycleScope recycle (thread);
+				ArgumentVector<0, Args...>::pack (cx, jsargs, args...);
+			}
+			JS::RootedValue rval (cx);
+			Trace::Span span ("js", "JS callback");
+			JS_CallFunctionValue (cx, JS::NullPtr (), *fun, jsargs, &rval);
+		};
+	}
+
+	/**
+	 * Call \p call on the JS thread and wait for it to return.
+	 */
+	template <typename F>
+	inline void syncCall (Thread *thread, F &call)
+	{
+		try {
+			thread->execOnJsThreadSync<int> ([&call] () {
+				call ();
+				return 0;
+			});
+		}
+		catch (std::future_error &) {
+			// The script stopped
+		}
+	}
+
+	/**
+	 * Call \p fun with \p args for an input event signal.
+	 *
+	 * The call is posted with \p key, subject to the overload policy,
+	 * if the thread queues events, otherwise it is synchronous.
+	 */
+	template <typename... Args>
+	inline void dispatchCall (JSContext *cx, Thread *thread, const std::shared_ptr<JS::PersistentRootedValue> &fun, const Thread::EventKey &key, Args... args)
+	{
+		auto call = makeCall<Args...> (cx, thread, fun, args...);
+		if (thread->queuesEvents ())
+			thread->postEvent (call, key);
+		else
+			syncCall (thread, call);
+	}
 }
 
 template <typename... Args>
-inline void readJSValue (JSContext *cx, std::function<void (Args...)> &var, JS::HandleValue value)
+inline bool tryReadJSValue (JSContext *cx, std::function<void (Args...)> &var, JS::HandleValue value, const char *&error)
 {
+	if (!value.isObject () || !JS::IsCallable (&value.toObject ())) {
+		error = "must be a function";
+		return false;
+	}
 	auto fun = std::make_shared<JS::PersistentRootedValue> (cx, value);
 	Thread *thread = static_cast<Thread *> (JS_GetContextPrivate (cx));
 	var = std::function<void (Args...)> ([cx, thread, fun] (Args... args) {
-		thread->execOnJsThreadSync<int> ([cx, fun, args...] () {
-			JS::AutoValueVector jsargs (cx);
-			jsargs.resize (sizeof... (Args));
-			detail::ArgumentVector<0, Args...>::pack (cx, jsargs, args...);
-			JS::RootedValue rval (cx);
-			JS_CallFunctionValue (cx, JS::NullPtr (), *fun, jsargs, &rval);
-			return 0;
-		});
+		auto call = detail::makeCall<Args...> (cx, thread, fun, args...);
+		// Only input event signals are subject to the overload policy
+		// (see make_keyed_signal_connector), other callbacks such as
+		// timers or force feedback must never be dropped.
+		if (thread->queuesEvents ())
+			thread->execOnJsThreadAsync (call);
+		else
+			detail::syncCall (thread, call);
 	});
+	return true;
 }
 
 namespace detail {
+	/**
+	 * Kinds of JS values, for choosing a variant alternative.
+	 */
+	enum class ValueKind
+	{
+		Boolean,
+		Number,
+		String,
+		Array,
+		Object,
+		Other, // Any value may be converted, it must be tried
+	};
+
+	template <typename T, typename = void>
+	struct KindOf { static constexpr ValueKind value = ValueKind::Other; };
+	template <>
+	struct KindOf<bool> { static constexpr ValueKind value = ValueKind::Boolean; };
+	template <typename T>
+	struct KindOf<T, std::enable_if_t<std::is_arithmetic<T>::value && !std::is_same<T, bool>::value>> { static constexpr ValueKind value = ValueKind::Number; };
+	template <>
+	struct KindOf<std::string> { static constexpr ValueKind value = ValueKind::String; };
+	template <typename T>
+	struct KindOf<std::vector<T>> { static constexpr ValueKind value = ValueKind::Array; };
+	template <typename T>
+	struct KindOf<std::map<std::string, T>> { static constexpr ValueKind value = ValueKind::Object; };
+	template <typename F>
+	struct KindOf<std::function<F>> { static constexpr ValueKind value = ValueKind::Object; };
+	template <typename T>
+	struct KindOf<T *> { static constexpr ValueKind value = ValueKind::Object; };
+
+	inline ValueKind valueKind (JSContext *cx, JS::HandleValue value)
+	{
+		if (value.isNumber ())
+			return ValueKind::Number;
+		if (value.isBoolean ())
+			return ValueKind::Boolean;
+		if (value.isString ())
+			return ValueKind::String;
+		if (value.isObject ())
+			return JS_IsArrayObject (cx, value) ? ValueKind::Array : ValueKind::Object;
+		return ValueKind::Other;
+	}
+
+	inline bool kindMatches (ValueKind alternative, ValueKind value)
+	{
+		return alternative == value ||
+			alternative == ValueKind::Other ||
+			(alternative == ValueKind::Object && value == ValueKind::Array);
+	}
+
 	template <typename Variant, typename... T>
 	struct VariantAlternative;
 
 	template <typename Variant, typename T, typename... Rest>
 	struct VariantAlternative<Variant, T, Rest...>
 	{
-		inline static Variant readJS (JSContext *cx, JS::HandleValue value)
+		inline static bool readJS (JSContext *cx, Variant &var, JS::HandleValue value, ValueKind kind, const char *&error)
 		{
-			try {
-				T var;
-				readJSValue (cx, var, value);
-				return var;
-			}
-			catch (std::exception &e) {
-				return VariantAlternative<Variant, Rest...>::readJS (cx, value);
+			// Only alternatives accepting this kind of value are tried
+			if (kindMatches (KindOf<T>::value, kind)) {
+				T alternative;
+				if (tryReadJSValue (cx, alternative, value, error)) {
+					var = std::move (alternative);
+					return true;
+				}
 			}
+			return VariantAlternative<Variant, Rest...>::readJS (cx, var, value, kind, error);
 		}
 	};
 
 	template <typename Variant>
 	struct VariantAlternative<Variant>
 	{
-		inline static Variant readJS (JSContext *, JS::HandleValue)
+		inline static bool readJS (JSContext *, Variant &, JS::HandleValue, ValueKind, const char *&error)
 		{
-			throw std::invalid_argument ("not convertible to any variant alternative");
+			if (!error)
+				error = "not convertible to any variant alternative";
+			return false;
 		}
 	};
 }
 
 template <typename... T>
-void readJSValue (JSContext *cx, std::variant<T...> &var, JS::HandleValue value)
+inline bool tryReadJSValue (JSContext *cx, std::variant<T...> &var, JS::HandleValue value, const char *&error)
 {
-	var = detail::VariantAlternative<std::variant<T...>, T...>::readJS (cx, value);
+	error = nullptr;
+	return detail::VariantAlternative<std::variant<T...>, T...>::readJS (cx, var, value, detail::valueKind (cx, value), error);
 }
 
-template <typename T, typename = std::enable_if_t<is_detected_exact_v<const JSClass, is_js_class_t, T>>>
-inline void readJSValue (JSContext *cx, T *&var, JS::HandleValue value)
+template <typename T, typename>
+inline bool tryReadJSValue (JSContext *cx, T *&var, JS::HandleValue value, const char *&error)
 {
 	if (!value.isObject ()) {
-		throw std::invalid_argument ("must be an object");
+		error = "must be an object";
+		return false;
 	}
-	JS::RootedObject obj (cx, value.toObjectOrNull ());
+	JSObject *obj = &value.toObject ();
 	const JSClass *cls = JS_GetClass (obj);
-	if (!ClassManager::inherits (cls->name, T::js_class.name)) {
-		Log::debug () << cls->name << " is not convertible to " << T::js_class.name << std::endl;
-		throw std::runtime_error ("object type mismatch");
+	if (cls != &T::js_class && !ClassManager::inherits (cls->name, T::js_class.name)) {
+		LOG (Debug) << cls->name << " is not convertible to " << T::js_class.name << std::endl;
+		error = "object type mismatch";
+		return false;
 	}
 	auto data = static_cast<std::pair<bool, T *> *> (JS_GetPrivate (obj));
+	if (!data) {
+		error = "object was released";
+		return false;
+	}
 	var = data->second;
+	return true;
+}
+
+template <typename T>
+inline void readJSValue (JSContext *cx, T &&var, JS::HandleValue value)
+{
+	const char *error;
+	if (!tryReadJSValue (cx, std::forward<T> (var), value, error))
+		throw std::invalid_argument (error);
 }
 
 } // namespace jstpl
@@ -19,6 +19,7 @@
 #include <jsapi.h>
 #include <iostream>
 #include <csignal>
+#include <memory>
 #include <dbus-c++/dbus.h>
 
 #include "event/EventDriver.h"
@@ -27,6 +28,7 @@
 #include "Udev.h"
 #include "Log.h"
 #include "Config.h"
+#include "ConfigWatcher.h"
 #include "DBusConnections.h"
 #include "jstpl/Thread.h"
 
@@ -122,7 +124,15 @@ int main (int argc, char *argv[])
 	}
 
 	Log::setLevel (log_level);
-	Config::config.loadConfig (config_file);
+	Log::init ();
+	Config::load (config_file);
+	std::unique_ptr<ConfigWatcher> config_watcher;
+	try {
+		config_watcher = std::make_unique<ConfigWatcher> (Config::getConfigFilePath (config_file));
+	}
+	catch (std::exception &e) {
+		Log::warning () << "Config file will not be watched: " << e.what () << std::endl;
+	}
 
 	jstpl::Thread::init ();
 
@@ -139,13 +149,21 @@ int main (int argc, char *argv[])
 
 		Udev udev;
 		std::thread udev_thread (&Udev::exec, &udev);
+		std::thread config_thread;
+		if (config_watcher)
+			config_thread = std::thread (&ConfigWatcher::exec, config_watcher.get ());
 
 		dispatcher.enter ();
 		udev.interrupt ();
+		if (config_watcher)
+			config_watcher->interrupt ();
 
 		udev_thread.join ();
+		if (config_thread.joinable ())
+			config_thread.join ();
 	}
 
 	jstpl::Thread::shutdown ();
+	Log::shutdown ();
 	return 0;
 }
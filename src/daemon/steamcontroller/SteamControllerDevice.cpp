@@ -24,6 +24,7 @@
 using namespace SteamController;
 
 #include "../Log.h"
+#include "../Trace.h"
 
 extern "C" {
 #include <unistd.h>
@@ -36,6 +37,9 @@ SteamControllerDevice::SteamControllerDevice (SteamControllerReceiver *receiver)
 	_report_linked_axes (false)
 {
 	_serial = querySerial ();
+	declareComplexEvent (EventTouchPad, { "x", "y" });
+	declareComplexEvent (EventSensor, { "x", "y", "z" });
+	declareComplexEvent (EventOrientation, { "w", "x", "y", "z" });
 }
 
 SteamControllerDevice::~SteamControllerDevice ()
@@ -75,6 +79,7 @@ writeLE (uint8_t *buffer, T value) {
 
 void SteamControllerDevice::readEvent (const std::array<uint8_t, 64> &report)
 {
+	Trace::Span span ("driver", "SteamControllerDevice::readEvent");
 	//uint8_t type = report[2];
 	//uint8_t length = report[3];
 	//uint32_t seq = readLE<uint32_t> (&report[4]);
@@ -114,7 +119,7 @@ void SteamControllerDevice::readEvent (const std::array<uint8_t, 64> &report)
 
 	// store events to send them only when the whole report is parsed
 	std::vector<std::tuple<uint16_t, uint16_t, int32_t>> simple_events;
-	std::vector<InputDevice::Event> events;
+	std::vector<uint16_t> touchpad_events;
 
 	// Touchpads (and stick)
 	bool touchpad_changed[2] = { false };
@@ -134,12 +139,7 @@ void SteamControllerDevice::readEvent (const std::array<uint8_t, 64> &report)
 			}
 		}
 		if (touchpad_changed[i] && _report_linked_axes) {
-			events.push_back ({
-				{ "type", EventTouchPad },
-				{ "code", TouchPadCodes[i] },
-				{ "x", _state.touchpad[i][0] },
-				{ "y", _state.touchpad[i][1] }
-			});
+			touchpad_events.push_back (i);
 		}
 	}
 	// Triggers
@@ -161,24 +161,6 @@ void SteamControllerDevice::readEvent (const std::array<uint8_t, 64> &report)
 			gyro_changed = true;
 		}
 	}
-	if (accel_changed) {
-		events.push_back ({
-			{ "type", EventSensor },
-			{ "code", SensorAccel },
-			{ "x", accel[0] },
-			{ "y", accel[1] },
-			{ "z", accel[2] }
-		});
-	}
-	if (gyro_changed) {
-		events.push_back ({
-			{ "type", EventSensor },
-			{ "code", SensorGyro },
-			{ "x", gyro[0] },
-			{ "y", gyro[1] },
-			{ "z", gyro[2] }
-		});
-	}
 	// Orientation quaternion
 	bool q_changed = false;
 	for (unsigned int i = 0; i < 4; ++i) {
@@ -187,15 +169,6 @@ void SteamControllerDevice::readEvent (const std::array<uint8_t, 64> &report)
 			q_changed = true;
 		}
 	}
-	if (q_changed) {
-		events.push_back ({
-			{ "type", EventOrientation },
-			{ "w", quaternion[0] },
-			{ "x", quaternion[1] },
-			{ "y", quaternion[2] },
-			{ "z", quaternion[3] }
-		});
-	}
 	// Buttons
 	uint32_t buttons_diff = buttons ^ _state.buttons;
 	_state.buttons = buttons;
@@ -207,10 +180,33 @@ void SteamControllerDevice::readEvent (const std::array<uint8_t, 64> &report)
 	// send events
 	for (const auto &t: simple_events)
 		simpleEventRead (std::get<0> (t), std::get<1> (t), std::get<2> (t));
-	for (const auto &e: events)
-		eventRead (e);
+	for (auto i: touchpad_events)
+		complexEventRead (EventTouchPad, TouchPadCodes[i], {
+			_state.touchpad[i][0],
+			_state.touchpad[i][1]
+		});
+	if (accel_changed)
+		sensorRead (EventSensor, SensorAccel, {
+			{ "x", accel[0] },
+			{ "y", accel[1] },
+			{ "z", accel[2] }
+		});
+	if (gyro_changed)
+		sensorRead (EventSensor, SensorGyro, {
+			{ "x", gyro[0] },
+			{ "y", gyro[1] },
+			{ "z", gyro[2] }
+		});
+	if (q_changed)
+		sensorRead (EventOrientation, -1, {
+			{ "w", quaternion[0] },
+			{ "x", quaternion[1] },
+			{ "y", quaternion[2] },
+			{ "z", quaternion[3] }
+		});
 	// Send SYN event only when something else was sent
-	if (!simple_events.empty() || !events.empty ()) {
+	if (!simple_events.empty() || !touchpad_events.empty () ||
+	    accel_changed || gyro_changed || q_changed) {
 		simpleEventRead (EV_SYN, SYN_REPORT, 0);
 	}
 }
@@ -477,4 +473,9 @@ JSObject *SteamControllerDevice::makeJsObject (const jstpl::Thread *thread)
 	return thread->makeJsObject (this);
 }
 
+void SteamControllerDevice::releaseJsObject (jstpl::Thread *thread)
+{
+	thread->releaseJsObject (this);
+}
+
 bool SteamControllerDevice::_registered = jstpl::ClassManager::registerClass<SteamControllerDevice::JsClass> ("InputDevice");
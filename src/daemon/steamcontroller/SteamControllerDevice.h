@@ -299,6 +299,7 @@ public:
 	typedef jstpl::AbstractClass<SteamControllerDevice> JsClass;
 
 	JSObject *makeJsObject (const jstpl::Thread *thread) override;
+	void releaseJsObject (jstpl::Thread *thread) override;
 
 private:
 	void readEvent (const std::array<uint8_t, 64> &report);
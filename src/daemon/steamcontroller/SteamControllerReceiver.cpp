@@ -24,6 +24,8 @@
 using namespace SteamController;
 
 #include "../Log.h"
+#include "../Trace.h"
+#include "../ThreadPolicy.h"
 
 extern "C" {
 #include <unistd.h>
@@ -117,6 +119,9 @@ SteamControllerReceiver::~SteamControllerReceiver ()
 
 void SteamControllerReceiver::monitor ()
 {
+	// Name the thread even before any controller is connected
+	ThreadPolicy ().apply ("steam-reader");
+
 	// Send connected signal for already connected devices
 	if (_connected)
 		connected.emit ();
@@ -127,6 +132,8 @@ void SteamControllerReceiver::monitor ()
 	std::array<uint8_t, 64> report;
 	try {
 		while (true) {
+			if (_device)
+				_device->updateReaderThread ("steam-reader");
 			FD_ZERO (&fds);
 			FD_SET (_fd, &fds);
 			FD_SET (_pipe[0], &fds);
@@ -139,7 +146,13 @@ void SteamControllerReceiver::monitor ()
 			}
 
 			if (FD_ISSET (_fd, &fds)) {
-				ret = read (_fd, report.data (), 64);
+				{
+					Trace::Span span ("device", "SteamControllerReceiver read");
+					ret = read (_fd, report.data (), 64);
+				}
+				// hidraw reports have no timestamp
+				if (_device)
+					_device->setEventTime (InputDevice::monotonicTime ());
 				if (ret == -1)
 					throw std::system_error (errno, std::system_category (), "SteamControllerReceiver monitor read");
 				if (ret != 64)
@@ -190,7 +203,7 @@ void SteamControllerReceiver::parseReport (const std::array<uint8_t, 64> &report
 			break;
 
 		case Paired:
-			Log::debug () << "Steam Controller Paired event" << std::endl;
+			LOG (Debug) << "Steam Controller Paired event" << std::endl;
 			break;
 
 		default:
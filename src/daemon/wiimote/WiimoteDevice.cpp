@@ -18,6 +18,8 @@
 
 #include "WiimoteDevice.h"
 
+#include "../Trace.h"
+
 extern "C" {
 #include <unistd.h>
 #include <fcntl.h>
@@ -51,6 +53,8 @@ WiimoteDevice::WiimoteDevice (const std::string &path)
 		xwii_iface_unref (_dev);
 		throw std::system_error (errno, std::system_category (), "pipe2");
 	}
+	declareComplexEvent (XWII_EVENT_ACCEL, { "x", "y", "z" });
+	declareComplexEvent (XWII_EVENT_MOTION_PLUS, { "x", "y", "z" });
 }
 
 WiimoteDevice::~WiimoteDevice ()
@@ -64,6 +68,7 @@ void WiimoteDevice::start ()
 {
 	assert (!_thread.joinable ());
 	_thread = std::thread ([this] () {
+		initReaderThread ("wiimote-reader");
 		try {
 			readEvents ();
 		}
@@ -100,15 +105,17 @@ void WiimoteDevice::readEvents ()
 		}
 
 		if (FD_ISSET (xwii_fd, &set)) {
+			Trace::Span span ("device", "WiimoteDevice dispatch");
 			struct xwii_event ev;
 			while (0 == (ret = xwii_iface_dispatch (_dev, &ev, sizeof (struct xwii_event)))) {
+				// xwiimote timestamps use the realtime clock
+				setEventTime (monotonicTime ());
 				switch (ev.type) {
 				case XWII_EVENT_KEY:
 					simpleEventRead (ev.type, ev.v.key.code, ev.v.key.state);
 					break;
 				case XWII_EVENT_ACCEL:
-					eventRead ({
-						{ "type", ev.type },
+					sensorRead (ev.type, -1, {
 						{ "x", ev.v.abs[0].x },
 						{ "y", ev.v.abs[0].y },
 						{ "z", ev.v.abs[0].z }
@@ -145,8 +152,7 @@ void WiimoteDevice::readEvents ()
 						});
 					break;
 				case XWII_EVENT_MOTION_PLUS:
-					eventRead ({
-						{ "type", ev.type },
+					sensorRead (ev.type, -1, {
 						{ "x", ev.v.abs[0].x },
 						{ "y", ev.v.abs[0].y },
 						{ "z", ev.v.abs[0].z }
@@ -161,11 +167,11 @@ void WiimoteDevice::readEvents ()
 					unsigned int old_available = _available;
 					_opened = xwii_iface_opened (_dev);
 					_available = xwii_iface_available (_dev);
-					Log::debug () << std::hex
+					LOG (Debug) << std::hex
 						      << "Open devices: " << _opened
 						      << " (changed: " << (old_opened^_opened)
 						      << ")" << std::endl;
-					Log::debug () << std::hex
+					LOG (Debug) << std::hex
 						      << "Available devices: " << _available
 						      << " (changed: " << (old_available^_available)
 						      << ")" << std::endl;
@@ -190,7 +196,7 @@ void WiimoteDevice::readEvents ()
 					error.emit ();
 					return;
 				default:
-					Log::debug () << "Unsupported xwiimote event type: " << ev.type << std::endl;
+					LOG (Debug) << "Unsupported xwiimote event type: " << ev.type << std::endl;
 				}
 			}
 			if (ret != -EAGAIN)
@@ -393,4 +399,9 @@ JSObject *WiimoteDevice::makeJsObject (const jstpl::Thread *thread)
 	return thread->makeJsObject (this);
 }
 
+void WiimoteDevice::releaseJsObject (jstpl::Thread *thread)
+{
+	thread->releaseJsObject (this);
+}
+
 bool WiimoteDevice::_registered = jstpl::ClassManager::registerClass<WiimoteDevice::JsClass> ("InputDevice");
@@ -59,6 +59,7 @@ public:
 	typedef jstpl::AbstractClass<WiimoteDevice> JsClass;
 
 	JSObject *makeJsObject (const jstpl::Thread *thread) override;
+	void releaseJsObject (jstpl::Thread *thread) override;
 
 private:
 	void readEvents ();
@@ -0,0 +1,33 @@
+/*
+ * Copyright 2017 Clément Vuchener
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef SCRIPT_MANAGER_H
+#define SCRIPT_MANAGER_H
+
+#include "dbus/ScriptManagerInterfaceProxy.h"
+
+class ScriptManager:
+	public com::github::cvuchener::InputScripts::ScriptManager_proxy,
+	public DBus::IntrospectableProxy,
+	public DBus::ObjectProxy
+{
+public:
+	ScriptManager (DBus::Connection &connection, const char *path, const char *name);
+};
+
+#endif
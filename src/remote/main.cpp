@@ -18,8 +18,10 @@
 
 #include "ObjectManager.h"
 #include "Script.h"
+#include "ScriptManager.h"
 
 #include <iostream>
+#include <fstream>
 #include <cstdio>
 #include <cstring>
 
@@ -48,6 +50,11 @@ list:
     Print every matching device object path and properties.
 set-file filename:
     Set the script file for every matching device.
+start-tracing:
+    Start recording pipeline traces in the daemon (device options are ignored).
+stop-tracing [filename]:
+    Stop recording traces and write them in Chrome trace event format to
+    filename or to the standard output (device options are ignored).
 
 )***";
 
@@ -153,7 +160,57 @@ int main (int argc, char *argv[])
 	DBus::BusDispatcher dispatcher;
 	DBus::default_dispatcher = &dispatcher;
 	DBus::Connection connection = getConnection (bus);
-	if (paths.empty ()) {
+
+	if (command == "start-tracing") {
+		ScriptManager script_manager (connection, ScriptManagerPath, ServiceName);
+		script_manager.StartTracing ();
+		return EXIT_SUCCESS;
+	}
+	else if (command == "stop-tracing") {
+		ScriptManager script_manager (connection, ScriptManagerPath, ServiceName);
+		std::ofstream file;
+		if (optind+1 < argc) {
+			file.open (argv[optind+1]);
+			if (!file) {
+				std::cerr << "Failed to open " << argv[optind+1] << std::endl;
+				return EXIT_FAILURE;
+			}
+		}
+		std::ostream &out = file.is_open () ? file : std::cout;
+		script_manager.StopTracing ();
+		// Read until an empty chunk so the daemon releases the trace
+		uint64_t offset = 0;
+		while (true) {
+			std::vector<uint8_t> chunk = script_manager.ReadTrace (offset, 1 << 20);
+			if (chunk.empty ())
+				break;
+			out.write (reinterpret_cast<const char *> (chunk.data ()), chunk.size ());
+			offset += chunk.size ();
+		}
+		return EXIT_SUCCESS;
+	}
+
+	if (command == "set-file" && paths.empty ()) {
+		// Let the daemon match and update every device in one call
+		if (optind+1 >= argc) {
+			std::cerr << "Missing file name" << std::endl;
+			return EXIT_FAILURE;
+		}
+		std::map<std::string, std::string> match;
+		if (!driver.empty ())
+			match.emplace ("driver", driver);
+		if (!name.empty ())
+			match.emplace ("name", name);
+		if (!serial.empty ())
+			match.emplace ("serial", serial);
+		ScriptManager script_manager (connection, ScriptManagerPath, ServiceName);
+		script_manager.SetFiles (match, argv[optind+1]);
+		return EXIT_SUCCESS;
+	}
+
+	// Fetch every device properties at once
+	std::map<DBus::Path, std::map<std::string, std::string>> devices;
+	if (paths.empty () || command == "list") {
 		ObjectManager object_manager (connection, ScriptManagerPath, ServiceName);
 		auto scripts = object_manager.GetManagedObjects ();
 		for (const auto &pair: scripts) {
@@ -163,7 +220,7 @@ int main (int argc, char *argv[])
 				std::cerr << path << ": Missing Script interface" << std::endl;
 				continue;
 			}
-			bool match = true;
+			auto &properties = devices[path];
 			for (const auto &property: interface->second) {
 				std::string propname = property.first;
 				DBus::MessageIter reader = property.second.reader ().recurse ();
@@ -171,39 +228,39 @@ int main (int argc, char *argv[])
 					std::cerr << path << ": Property " << propname << " is not a string" << std::endl;
 					continue;
 				}
-				std::string value = reader.get_string ();
-				if (propname == "driver") {
-					if (!driver.empty () && driver != value) {
-						match = false;
-						break;
-					}
-				}
-				else if (propname == "name") {
-					if (!name.empty () && name != value) {
-						match = false;
-						break;
-					}
-				}
-				else if (propname == "serial") {
-					if (!serial.empty () && serial != value) {
-						match = false;
-						break;
-					}
-				}
+				properties.emplace (propname, reader.get_string ());
 			}
-			if (match)
-				paths.push_back (path);
+		}
+	}
+
+	if (paths.empty ()) {
+		for (const auto &pair: devices) {
+			const auto &properties = pair.second;
+			auto matches = [&properties] (const char *propname, const std::string &expected) {
+				if (expected.empty ())
+					return true;
+				auto it = properties.find (propname);
+				return it != properties.end () && it->second == expected;
+			};
+			if (matches ("driver", driver) &&
+			    matches ("name", name) &&
+			    matches ("serial", serial))
+				paths.push_back (pair.first);
 		}
 	}
 
 	if (command == "list") {
 		for (const auto &path: paths) {
-			Script script (connection, path.c_str (), ServiceName);
+			auto it = devices.find (path);
+			if (it == devices.end ()) {
+				std::cerr << path << ": Unknown device" << std::endl;
+				continue;
+			}
 			std::cout << path << std::endl;
-			std::cout << "Driver = " << script.Script_proxy::driver () << std::endl;
-			std::cout << "Name = " << script.Script_proxy::name () << std::endl;
-			std::cout << "Serial = " << script.Script_proxy::serial () << std::endl;
-			std::cout << "File = " << script.Script_proxy::file () << std::endl;
+			std::cout << "Driver = " << it->second["driver"] << std::endl;
+			std::cout << "Name = " << it->second["name"] << std::endl;
+			std::cout << "Serial = " << it->second["serial"] << std::endl;
+			std::cout << "File = " << it->second["file"] << std::endl;
 		}
 	}
 	else if (command == "set-file") {